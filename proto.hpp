@@ -1,1144 +1,4606 @@
-#ifndef __PROTO_HPP__
-#define __PROTO_HPP__
-
-#if defined(_MSC_VER) && (_MSC_VER >= 1200)
-#  pragma once
-#endif // defined(_MSC_VER) && (_MSC_VER >= 1200)
-
-#include <vector>
-#include <list>
-#include <tuple>
-#include <string>
-
-namespace proto {
-
-namespace {
-const int MAX_VARINT32_BYTES = 5;
-const int MAX_VARINT64_BYTES = 10;
-const int INT32_BYTES        = 4;
-const int INT64_BYTES        = 8;
-} // namespace
-
-enum types {
-  type_varint    = 0,
-  type_int64     = 1,
-  type_binary    = 2,
-  type_group     = 3,
-  type_end       = 4,
-  type_int32     = 5,
-  type_reserve1  = 6,
-  type_reserve2  = 7,
-  type_undefined = 8,
-  type_packed    = 9,
-  type_repeat    = 10
-};
-
-/**
- * \brief encode a number to varint encoding
- * \param num number
- * \return encoded varint string
- */
-std::string        encode_varint(uint64_t num);
-inline std::string encode_varint(uint64_t num)
-{
-  std::string _result;
-
-  while (num > 0x7f)
-  {
-    _result += uint8_t((num & 0x7F) | 0x80);
-    num >>= 7;
-  }
-  _result += uint8_t(num);
-
-  return _result;
-}
-
-size_t        decode_varint(const void* data, size_t length, uint64_t& result);
-inline size_t decode_varint(const void* data, size_t length, uint64_t& result)
-{
-  auto _data = static_cast<const unsigned char*>(data);
-
-  if (nullptr == _data || 0 == length) return 0;
-
-  if (length > 10) length = 10;
-
-  int      _max = length;
-  int      i    = 0;
-  uint64_t r    = 0;
-  while (i < _max)
-  {
-    auto c = _data[i];
-    r += uint64_t(c & 0x7F) << (i * 7);
-    ++i;
-    if (0 == (c & 0x80))
-    {
-      result = r;
-      return i;
-    }
-  }
-
-  return 0;
-}
-
-/**
- * \brief protobuf root field class
- */
-class message
-{
-public:
-  types                      type_;
-  int                        id_;
-  std::list<message>         childs_;        // sub fields or repeat field
-  std::vector<std::uint64_t> values_;        // varint, int32, int64 data store here
-  std::vector<std::string>   binary_values_; // binary data store here
-
-  ////////////////////////////////////////////////////////////
-  message()
-    : type_(type_undefined)
-    , id_(0)
-    , values_{0}
-    , binary_values_{""}
-  {}
-
-  message(types type, int id)
-    : type_(type)
-    , id_(id)
-    , values_{0}
-    , binary_values_{""}
-  {}
-
-  message(types type, int id, std::uint64_t value)
-    : type_(type)
-    , id_(id)
-    , values_{value}
-    , binary_values_{""}
-  {}
-
-  message(types type, int id, const std::string& value)
-    : type_(type)
-    , id_(id)
-    , values_{0}
-    , binary_values_{value}
-  {}
-
-  message(types type, int id, const std::vector<std::uint32_t>& values)
-    : type_(type)
-    , id_(id)
-    , binary_values_{""}
-  {
-    append_value(values);
-  }
-
-  message(types type, int id, const std::vector<std::uint64_t>& values)
-    : type_(type)
-    , id_(id)
-    , binary_values_{""}
-  {
-    append_value(values);
-  }
-
-  message(types type, int id, const std::vector<std::string>& values)
-    : type_(type)
-    , id_(id)
-    , values_{0}
-  {
-    append_value(values);
-  }
-
-  message(types type, int id, const std::initializer_list<std::uint32_t>& values)
-    : type_(type)
-    , id_(id)
-    , binary_values_{""}
-  {
-    append_value(values);
-  }
-
-  message(types type, int id, const std::initializer_list<std::uint64_t>& values)
-    : type_(type)
-    , id_(id)
-    , binary_values_{""}
-  {
-    append_value(values);
-  }
-
-  message(types type, int id, const std::initializer_list<std::string>& values)
-    : type_(type)
-    , id_(id)
-  {
-    append_value(values);
-  }
-
-  explicit message(const std::vector<message>& fields)
-    : type_(type_undefined)
-    , id_(0)
-  {
-    append_child(fields);
-  }
-
-  explicit message(const std::list<message>& fields)
-    : type_(type_undefined)
-    , id_(0)
-  {
-    append_child(fields);
-  }
-
-  message(const std::initializer_list<message>& fields)
-    : type_(type_undefined)
-    , id_(0)
-  {
-    append_child(fields);
-  }
-
-  message(const message& obj)
-  {
-    if (&obj != this)
-    {
-      type_          = obj.type_;
-      id_            = obj.id_;
-      childs_        = obj.childs_;
-      values_        = obj.values_;
-      binary_values_ = obj.binary_values_;
-    }
-  }
-
-  message(message&& obj) noexcept
-  {
-    if (&obj != this)
-    {
-      type_          = obj.type_;
-      id_            = obj.id_;
-      childs_        = std::move(obj.childs_);
-      values_        = std::move(obj.values_);
-      binary_values_ = std::move(obj.binary_values_);
-    }
-  }
-
-  message& operator=(const message& obj)
-  {
-    if (&obj != this)
-    {
-      type_          = obj.type_;
-      id_            = obj.id_;
-      childs_        = obj.childs_;
-      values_        = obj.values_;
-      binary_values_ = obj.binary_values_;
-    }
-    return *this;
-  }
-
-  ////////////////////////////////////////////////////////////
-  void set_value(std::uint64_t value)
-  {
-    binary_values_.clear();
-    binary_values_.resize(1);
-    values_.clear();
-    values_.push_back(value);
-  }
-
-  void set_value(const std::string& value)
-  {
-    values_.clear();
-    values_.resize(1);
-    binary_values_.clear();
-    binary_values_.emplace_back(value);
-  }
-
-  ////////////////////////////////////////////////////////////
-  void set_value(const std::vector<std::uint32_t>& values)
-  {
-    binary_values_.clear();
-    binary_values_.resize(1);
-    values_.clear();
-    values_.reserve(values.size());
-    for (auto v : values)
-    {
-      values_.push_back(v);
-    }
-  }
-
-  void set_value(const std::vector<std::uint64_t>& values)
-  {
-    binary_values_.clear();
-    binary_values_.resize(1);
-    values_.clear();
-    values_.reserve(values.size());
-    for (auto v : values)
-    {
-      values_.push_back(v);
-    }
-  }
-
-  void set_value(const std::vector<std::string>& values)
-  {
-    values_.clear();
-    values_.resize(1);
-    binary_values_.clear();
-    binary_values_.reserve(values.size());
-    for (const auto& f : values)
-    {
-      binary_values_.emplace_back(f);
-    }
-  }
-
-  ////////////////////////////////////////////////////////////
-  void set_value(const std::initializer_list<std::uint32_t>& values)
-  {
-    binary_values_.clear();
-    binary_values_.resize(1);
-    values_.clear();
-    values_.reserve(values.size());
-    for (auto v : values)
-    {
-      values_.push_back(v);
-    }
-  }
-
-  void set_value(const std::initializer_list<std::uint64_t>& values)
-  {
-    binary_values_.clear();
-    binary_values_.resize(1);
-    values_.clear();
-    values_.reserve(values.size());
-    for (auto v : values)
-    {
-      values_.push_back(v);
-    }
-  }
-
-  void set_value(const std::initializer_list<std::string>& values)
-  {
-    values_.clear();
-    values_.resize(1);
-    binary_values_.clear();
-    binary_values_.reserve(values.size());
-    for (const auto& f : values)
-    {
-      binary_values_.emplace_back(f);
-    }
-  }
-
-  ////////////////////////////////////////////////////////////
-  void append_value(std::uint32_t value) { values_.push_back(value); }
-
-  void append_value(std::uint64_t value) { values_.push_back(value); }
-
-  void append_value(const std::string& value) { binary_values_.emplace_back(value); }
-
-  ////////////////////////////////////////////////////////////
-  void append_value(const std::vector<std::uint32_t>& values)
-  {
-    values_.reserve(values.size());
-    for (auto v : values)
-    {
-      values_.push_back(v);
-    }
-  }
-
-  void append_value(const std::vector<std::uint64_t>& values)
-  {
-    values_.reserve(values.size());
-    for (auto v : values)
-    {
-      values_.push_back(v);
-    }
-  }
-
-  void append_value(const std::vector<std::string>& values)
-  {
-    binary_values_.reserve(values.size());
-    for (const auto& v : values)
-    {
-      binary_values_.emplace_back(v);
-    }
-  }
-
-  ////////////////////////////////////////////////////////////
-  void append_value(const std::initializer_list<std::uint32_t>& values)
-  {
-    values_.reserve(values.size());
-    for (auto v : values)
-    {
-      values_.push_back(v);
-    }
-  }
-
-  void append_value(const std::initializer_list<std::uint64_t>& values)
-  {
-    values_.reserve(values.size());
-    for (auto v : values)
-    {
-      values_.push_back(v);
-    }
-  }
-
-  void append_value(const std::initializer_list<std::string>& values)
-  {
-    binary_values_.reserve(values.size());
-    for (const auto& v : values)
-    {
-      binary_values_.emplace_back(v);
-    }
-  }
-
-  ////////////////////////////////////////////////////////////
-  void set_child(const message& f)
-  {
-    childs_.clear();
-    this->id(f.id_) = f;
-  }
-
-  void set_child(const std::vector<message>& fields)
-  {
-    childs_.clear();
-    for (const auto& f : fields)
-    {
-      this->id(f.id_) = f;
-    }
-  }
-
-  void set_child(const std::list<message>& fields)
-  {
-    childs_.clear();
-    for (const auto& f : fields)
-    {
-      this->id(f.id_) = f;
-    }
-  }
-
-  void set_child(const std::initializer_list<message>& fields)
-  {
-    childs_.clear();
-    for (const auto& f : fields)
-    {
-      this->id(f.id_) = f;
-    }
-  }
-
-  ////////////////////////////////////////////////////////////
-  void append_child(const message& f)
-  {
-    // id not exits, append
-    if (!this->has(f.id_))
-    {
-      childs_.push_back(f);
-      return;
-    }
-
-    // get from childs
-    auto& _field = this->id(f.id_);
-
-    // else id exits, repeat field
-
-    switch (_field.type_)
-    {
-    case type_varint:
-    case type_int32:
-    case type_int64:
-    {
-      _field.append_value(f.values_);
-      break;
-    }
-    case type_binary:
-    {
-      _field.append_value(f.binary_values_);
-      break;
-    }
-    case type_group:
-    case type_packed:
-    {
-      auto _new_field = message{type_repeat, f.id_};
-      _new_field.childs_.push_back(_field);
-      _new_field.childs_.push_back(f);
-      _field = _new_field;
-      break;
-    }
-    case type_repeat:
-    {
-      _field.childs_.push_back(f);
-      break;
-    }
-    default:;
-    }
-  }
-
-  void append_child(message&& f)
-  {
-    // id not exits, append
-    if (!this->has(f.id_))
-    {
-      childs_.emplace_back(std::move(f));
-      return;
-    }
-
-    // get from childs
-    auto& _field = this->id(f.id_);
-
-    // else id exits, repeat field
-
-    switch (_field.type_)
-    {
-    case type_varint:
-    case type_int32:
-    case type_int64:
-    {
-      _field.append_value(f.values_);
-      break;
-    }
-    case type_binary:
-    {
-      _field.append_value(f.binary_values_);
-      break;
-    }
-    case type_group:
-    case type_packed:
-    {
-      auto _new_field = message{type_repeat, f.id_};
-      _new_field.childs_.push_back(_field);
-      _new_field.childs_.emplace_back(std::move(f));
-      _field = std::move(_new_field);
-      break;
-    }
-    case type_repeat:
-    {
-      _field.childs_.emplace_back(std::move(f));
-      break;
-    }
-    default:;
-    }
-  }
-
-  void append_child(const std::vector<message>& fields)
-  {
-    for (const auto& f : fields)
-    {
-      append_child(f);
-    }
-  }
-
-  void append_child(const std::list<message>& fields)
-  {
-    for (const auto& f : fields)
-    {
-      append_child(f);
-    }
-  }
-
-  void append_child(const std::initializer_list<message>& fields)
-  {
-    for (const auto& f : fields)
-    {
-      append_child(f);
-    }
-  }
-
-  ////////////////////////////////////////////////////////////
-
-  std::uint64_t value()
-  {
-    if (values_.empty())
-    {
-      values_.push_back(0);
-    }
-    return values_[0];
-  }
-
-  const std::string& binary_value()
-  {
-    if (binary_values_.empty())
-    {
-      binary_values_.emplace_back("");
-    }
-    return binary_values_[0];
-  }
-
-  bool is_repeat() const { return type_repeat == type_ || values_.size() > 1 || binary_values_.size() > 1; }
-
-  bool has(int id) const
-  {
-    for (auto& f : childs_)
-    {
-      if (id == f.id_) return true;
-    }
-    return false;
-  }
-
-  bool has_child() const { return !childs_.empty(); }
-
-  message& at(size_t index)
-  {
-    for (auto& f : childs_)
-    {
-      if (0 == index) return f;
-      --index;
-    }
-    // if not found, insert pad value first
-    while (index > 0) {
-      childs_.emplace_back(message{type_undefined, 0});
-      --index;
-    }
-    // insert it at index
-    childs_.emplace_back(message{type_undefined, 0});
-    return childs_.back();
-  }
-
-  message& id(int id)
-  {
-    for (auto& f : childs_)
-    {
-      if (id == f.id_) return f;
-    }
-    // if not found, insert it
-    childs_.emplace_back(message{type_undefined, id});
-    return childs_.back();
-  }
-
-  message& operator[](int id) { return this->id(id); }
-
-  typedef void (*unspecified_bool_type)();
-  static void unspecified_bool_true() {}
-
-  operator unspecified_bool_type() const noexcept { return (type_undefined == type_) ? 0 : unspecified_bool_true; }
-
-  /**
-   * \brief serialize to binary
-   * \return serialized binary protobuf data
-   */
-  std::string serialize() { return serialize(*this); }
-
-  /**
-   * \brief deserialize protobuf from string
-   * \param input serialized binary protobuf data
-   * \param dec_pack_depth decode packed type depth
-   * \return true if all data valid, else return false
-   */
-  bool deserialize(const std::string& input, int dec_pack_depth = -1)
-  {
-    auto result = deserialize(*this, input.data(), input.size(), 1, dec_pack_depth);
-    return std::get<0>(result);
-  }
-
-  /**
-   * \brief deserialize protobuf from string
-   * \param input serialized binary protobuf data
-   * \param length out processed length
-   * \param dec_pack_depth decode packed type depth
-   * \return true if all data valid, else return false
-   */
-  bool deserialize(const std::string& input, size_t* length, int dec_pack_depth = -1)
-  {
-    auto result = deserialize(*this, input.data(), *length, 1, dec_pack_depth);
-    *length     = std::get<1>(result);
-    return std::get<0>(result);
-  }
-
-  /**
-   * \brief deserialize protobuf from string
-   * \param input serialized binary protobuf data
-   * \param length input length, out processed length
-   * \param dec_pack_depth decode packed type depth
-   * \return true if all data valid, else return false
-   */
-  bool deserialize(const void* input, size_t* length, int dec_pack_depth = -1)
-  {
-    auto result = deserialize(*this, input, *length, 1, dec_pack_depth);
-    *length     = std::get<1>(result);
-    return std::get<0>(result);
-  }
-
-private:
-  /**
-   * \brief convert to protobuf field key
-   */
-  inline std::string encode_key(types type, int id)
-  {
-    auto _key = (std::uint64_t(id) << 3) | std::uint64_t(type);
-    return encode_varint(_key);
-  }
-
-  int calc_varint_encoded_size(std::uint64_t num)
-  {
-    // 0x000000000000007F 0 0000000 0000000 0000000 0000000 0000000 0000000 0000000 0000000 1111111
-    // 0x0000000000003F80 0 0000000 0000000 0000000 0000000 0000000 0000000 0000000 1111111 0000000
-    // 0x00000000001FC000 0 0000000 0000000 0000000 0000000 0000000 0000000 1111111 0000000 0000000
-    // 0x000000000FE00000 0 0000000 0000000 0000000 0000000 0000000 1111111 0000000 0000000 0000000
-    // 0x00000007F0000000 0 0000000 0000000 0000000 0000000 1111111 0000000 0000000 0000000 0000000
-
-    // 0x000003F800000000 0 0000000 0000000 0000000 1111111 0000000 0000000 0000000 0000000 0000000
-    // 0x0001FC0000000000 0 0000000 0000000 1111111 0000000 0000000 0000000 0000000 0000000 0000000
-    // 0x00FE000000000000 0 0000000 1111111 0000000 0000000 0000000 0000000 0000000 0000000 0000000
-    // 0x7F00000000000000 0 1111111 0000000 0000000 0000000 0000000 0000000 0000000 0000000 0000000
-    // 0x8000000000000000 1 0000000 0000000 0000000 0000000 0000000 0000000 0000000 0000000 0000000
-
-    if (num <= (std::numeric_limits<uint32_t>::max)())
-    {
-      return 1                       //
-             + !!(num & 0x000003F80) //
-             + !!(num & 0x0001FC000) //
-             + !!(num & 0x00FE00000) //
-             + !!(num & 0x7F0000000);
-    }
-
-    return 1                              //
-           + !!(num & 0x0000000000003F80) //
-           + !!(num & 0x00000000001FC000) //
-           + !!(num & 0x000000000FE00000) //
-           + !!(num & 0x00000007F0000000) //
-           + !!(num & 0x000003F800000000) //
-           + !!(num & 0x0001FC0000000000) //
-           + !!(num & 0x00FE000000000000) //
-           + !!(num & 0x7F00000000000000) //
-           + !!(num & 0x8000000000000000);
-  }
-
-  std::size_t calc_serialized_size(const message& msg, int indent, int leftspace)
-  {
-    std::size_t _totalsize     = 0;
-    auto        _cur_leftspace = leftspace + indent;
-
-    switch (msg.type_)
-    {
-    case type_varint:
-    {
-      for (const auto& value : msg.values_)
-      {
-        std::ignore = value;
-        _totalsize += calc_varint_encoded_size(msg.id_);
-        _totalsize += calc_varint_encoded_size(value);
-      }
-      break;
-    }
-    case type_int32:
-    {
-      for (const auto& value : msg.values_)
-      {
-        std::ignore = value;
-        _totalsize += calc_varint_encoded_size(msg.id_);
-        _totalsize += INT32_BYTES;
-      }
-      break;
-    }
-    case type_int64:
-    {
-      for (const auto& value : msg.values_)
-      {
-        std::ignore = value;
-        _totalsize += calc_varint_encoded_size(msg.id_);
-        _totalsize += INT64_BYTES;
-      }
-      break;
-    }
-    case type_binary:
-    {
-      for (const auto& value : msg.binary_values_)
-      {
-        _totalsize += calc_varint_encoded_size(msg.id_);
-        _totalsize += calc_varint_encoded_size(value.size());
-        _totalsize += value.size();
-      }
-      break;
-    }
-    case type_group:
-    {
-      _totalsize += calc_varint_encoded_size(msg.id_) * 2;
-
-      for (const auto& f : msg.childs_)
-      {
-        _totalsize += calc_serialized_size(f, indent, _cur_leftspace);
-      }
-
-      break;
-    }
-    case type_packed:
-    {
-      _totalsize += calc_varint_encoded_size(msg.id_);
-
-      std::size_t _subsize = 0;
-      for (const auto& f : msg.childs_)
-      {
-        _subsize += calc_serialized_size(f, indent, _cur_leftspace);
-      }
-      _totalsize += calc_varint_encoded_size(_subsize);
-      _totalsize += _subsize;
-      break;
-    }
-    case type_repeat:
-    case type_undefined:
-    {
-      for (const auto& f : msg.childs_)
-      {
-        _totalsize += calc_serialized_size(f, indent, _cur_leftspace - 2);
-      }
-      break;
-    }
-    default:;
-    }
-
-    return _totalsize;
-  }
-
-  /**
-   * \brief encode to protobuf
-   */
-  std::string serialize(const message& msg)
-  {
-    std::string _result;
-    _result.reserve(calc_serialized_size(msg, 2, 0));
-
-    switch (msg.type_)
-    {
-    case type_varint:
-    {
-      //using std_uint64_p_t = std::uint64_t*;
-      for (const auto& value : msg.values_)
-      {
-        _result += encode_key(msg.type_, msg.id_);
-        _result += encode_varint(value);
-      }
-      break;
-    }
-    case type_int32:
-    {
-      for (const auto& value : msg.values_)
-      {
-        using const_char_ptr = const char*;
-        _result += encode_key(msg.type_, msg.id_);
-        _result.append(const_char_ptr(&value), INT32_BYTES);
-      }
-      break;
-    }
-    case type_int64:
-    {
-      for (const auto& value : msg.values_)
-      {
-        using char_ptr = const char*;
-        _result += encode_key(msg.type_, msg.id_);
-        _result.append(char_ptr(&value), INT64_BYTES);
-      }
-      break;
-    }
-    case type_binary:
-    {
-      for (const auto& value : msg.binary_values_)
-      {
-        std::uint64_t _value_size = value.size();
-        _result += encode_key(msg.type_, msg.id_);
-        _result += encode_varint(_value_size);
-        _result += value;
-      }
-      break;
-    }
-    case type_group:
-    {
-      _result += encode_key(msg.type_, msg.id_);
-      for (const auto& f : msg.childs_)
-      {
-        _result += serialize(f);
-      }
-      _result += encode_key(type_end, msg.id_);
-      break;
-    }
-    case type_packed:
-    {
-      _result += encode_key(type_binary, msg.id_);
-      std::string _message;
-      for (const auto& f : msg.childs_)
-      {
-        _message += serialize(f);
-      }
-      std::uint64_t _message_size = _message.size();
-
-      _result += encode_varint(_message_size);
-      _result += _message;
-      break;
-    }
-    case type_repeat:
-    case type_undefined:
-    {
-      for (const auto& f : msg.childs_)
-      {
-        _result += serialize(f);
-      }
-      break;
-    }
-    default:;
-    }
-
-    // mutex_.unlock();
-
-    return _result;
-  }
-
-  /**
-   * \brief deserialize protobuf from string
-   * \return { bool success, int used_size, int left_size }
-   */
-  std::tuple<bool, int, int> deserialize(
-    message& msg, const void* input, const std::size_t length, int cur_depth, int dec_pack_depth)
-  {
-    if (0 == length) return std::make_tuple(false, 0, 0);
-
-    auto _pdata = static_cast<const unsigned char*>(input);
-    auto _left  = length;
-
-    while (_left > 0)
-    {
-      // get key
-      int _key;
-      {
-        std::uint64_t _key_u64;
-        auto          _size = decode_varint(_pdata, _left, _key_u64);
-        if (0 == _size) return std::make_tuple(false, int(length - _left), int(_left));
-
-        _key = int(_key_u64);
-        _pdata += _size;
-        _left -= _size;
-      }
-
-      // extra id and type
-      auto _id    = _key >> 3;
-      auto _itype = _key & 7;
-
-      if (!(_itype >= 0 && _itype < int(type_undefined)))
-        return std::make_tuple(false, int(length - _left), int(_left));
-
-      auto _type = types(_itype);
-
-      if (0 == _left && !(type_group == msg.type_ && type_end == _type)) return std::make_tuple(false, int(length), 0);
-
-      switch (_type)
-      {
-      case type_varint:
-      {
-        std::uint64_t _value;
-        {
-          auto _size = decode_varint(_pdata, _left, _value);
-          if (0 == _size) return std::make_tuple(false, int(length - _left), int(_left));
-
-          _pdata += _size;
-          _left -= _size;
-        }
-        msg.append_child({type_varint, _id, _value});
-        break;
-      }
-      case type_int64:
-      {
-        if (_left < sizeof(std::uint64_t)) return std::make_tuple(false, int(length - _left), int(_left));
-
-        auto _value = *(reinterpret_cast<const std::uint64_t*>(_pdata));
-        _pdata += sizeof(std::uint64_t);
-        _left -= sizeof(std::uint64_t);
-
-        msg.append_child({type_int64, _id, _value});
-        break;
-      }
-      case type_binary:
-      {
-        std::size_t _binary_length;
-        {
-          std::uint64_t _binary_length_u64;
-          auto          _size = decode_varint(_pdata, _left, _binary_length_u64);
-          if (0 == _size) return std::make_tuple(false, int(length - _left), int(_left));
-
-          _binary_length = std::size_t(_binary_length_u64);
-          _pdata += _size;
-          _left -= _size;
-        }
-
-        if (_left < _binary_length) return std::make_tuple(false, int(length - _left), int(_left));
-
-        message _message{type_binary, _id};
-
-        if (-1 == dec_pack_depth || (-1 != dec_pack_depth && cur_depth <= dec_pack_depth))
-        // try dec packed message
-        {
-          message _packed{type_packed, _id};
-          auto    _result = deserialize(_packed, _pdata, std::size_t(_binary_length), cur_depth + 1, dec_pack_depth);
-          if (std::get<0>(_result))
-          {
-            _message.type_   = type_packed;
-            _message.childs_ = std::move(_packed.childs_);
-          }
-        }
-
-        // add raw binary message
-        {
-          using std_string_elem_t  = const std::string::value_type* const;
-          using std_string_value_t = std::string::size_type;
-          _message.binary_values_.clear();
-          _message.binary_values_.emplace_back(std_string_elem_t(_pdata), std_string_value_t(_binary_length));
-        }
-
-        // append
-        msg.append_child(std::move(_message));
-
-        _pdata += _binary_length;
-        _left -= _binary_length;
-
-        break;
-      }
-      case type_group:
-      {
-        message _subgroup{type_group, _id};
-        auto    _result = deserialize(_subgroup, _pdata, _left, cur_depth + 1, dec_pack_depth);
-        if (!std::get<0>(_result))
-        {
-          return std::make_tuple(false, int(length - _left), int(_left));
-        }
-
-        _pdata += std::get<1>(_result);
-        _left = std::get<2>(_result);
-        msg.append_child(_subgroup);
-        break;
-      }
-      case type_end:
-      {
-        if (msg.type_ == type_group)
-        {
-          return std::make_tuple(true, int(length - _left), int(_left));
-        }
-        break;
-      }
-      case type_int32:
-      {
-        if (_left < sizeof(std::uint32_t)) return std::make_tuple(false, int(length - _left), int(_left));
-
-        auto _value = *(reinterpret_cast<const std::uint32_t*>(_pdata));
-        _pdata += sizeof(std::uint32_t);
-        _left -= sizeof(std::uint32_t);
-
-        msg.append_child({type_int32, _id, _value});
-        break;
-      }
-      default:
-        return std::make_tuple(false, int(length - _left), int(_left));
-      }
-    }
-
-    return std::make_tuple(0 == _left, int(length - _left), int(_left));
-  }
-
-};
-
-template<int ID>
-class varint : public message
-{
-public:
-  varint(std::uint64_t value)
-    : message(type_varint, ID, value)
-  {}
-
-  varint(const std::vector<std::uint64_t>& values)
-    : message(type_varint, ID, values)
-  {}
-
-  varint(const std::initializer_list<std::uint64_t>& values)
-    : message(type_varint, ID, values)
-  {}
-};
-
-template<int ID>
-class int32 : public message
-{
-public:
-  int32(std::uint32_t value)
-    : message(type_int32, ID, value)
-  {}
-
-  int32(const std::vector<std::uint32_t>& values)
-    : message(type_int32, ID, values)
-  {}
-
-  int32(const std::initializer_list<std::uint32_t>& values)
-    : message(type_int32, ID, values)
-  {}
-};
-
-template<int ID>
-class int64 : public message
-{
-public:
-  int64(const std::uint64_t value)
-    : message(type_int64, ID, value)
-  {}
-
-  int64(const std::vector<std::uint64_t>& values)
-    : message(type_int64, ID, values)
-  {}
-
-  int64(const std::initializer_list<std::uint64_t>& values)
-    : message(type_int64, ID, values)
-  {}
-};
-
-template<int ID>
-class binary : public message
-{
-public:
-  binary(const std::string& value)
-    : message(type_binary, ID, value)
-  {}
-
-  binary(const std::vector<std::string>& values)
-    : message(type_binary, ID, values)
-  {}
-
-  binary(const std::initializer_list<std::string>& values)
-    : message(type_binary, ID, values)
-  {}
-};
-
-template<int ID>
-class group : public message
-{
-public:
-  group(const std::vector<message>& fields)
-    : message(fields)
-  {
-    type_ = type_group;
-    id_   = ID;
-  }
-
-  group(const std::list<message>& fields)
-    : message(fields)
-  {
-    type_ = type_group;
-    id_   = ID;
-  }
-
-  group(const std::initializer_list<message>& fields)
-    : message(fields)
-  {
-    type_ = type_group;
-    id_   = ID;
-  }
-};
-
-template<int ID>
-class packed : public message
-{
-public:
-  packed(const std::vector<message>& fields)
-    : message(fields)
-  {
-    type_ = type_packed;
-    id_   = ID;
-  }
-
-  packed(const std::list<message>& fields)
-    : message(fields)
-  {
-    type_ = type_packed;
-    id_   = ID;
-  }
-
-  packed(const std::initializer_list<message>& fields)
-    : message(fields)
-  {
-    type_ = type_packed;
-    id_   = ID;
-  }
-};
-
-} // namespace proto
-
-#endif // !__PROTO_HPP__
+#ifndef __PROTO_HPP__
+#define __PROTO_HPP__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#  pragma once
+#endif // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <initializer_list>
+#include <iterator>
+#include <vector>
+#include <list>
+#include <tuple>
+#include <string>
+#include <unordered_map>
+#include "proto_trace.hpp"
+
+// serialize_iov() hands out buffers for writev
+#if !defined(_WIN32)
+#  include <cerrno>
+#  include <climits>
+#  include <sys/uio.h>
+#  include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#  define PROTO_SIMD_X64 1
+#  include <immintrin.h>
+#endif // defined(__x86_64__) || defined(_M_X64)
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#endif // defined(_MSC_VER)
+
+namespace proto {
+
+namespace {
+const int MAX_VARINT32_BYTES = 5;
+const int MAX_VARINT64_BYTES = 10;
+const int INT32_BYTES        = 4;
+const int INT64_BYTES        = 8;
+const int MAX_FIELD_NUMBER   = (1 << 29) - 1; // field numbers are 29 bits in the key
+const int MAX_RECURSIVE_RELEASE = 256; // tree levels released by recursion, deeper levels are released in a loop
+const std::size_t MAX_PARKED_NODES = 1024; // spare nodes kept per thread between deserialize_into_reuse calls
+const std::size_t MAX_PARKED_STRING = 4096; // larger spare strings are freed rather than kept per thread
+const std::size_t MAX_PARKED_VALUES = 512; // spare nodes holding more value capacity free their buffer
+const std::size_t MAX_THREAD_CACHE_BYTES = 1024 * 1024; // decoder scratch kept per thread is freed after use beyond this
+} // namespace
+
+enum types {
+  type_varint    = 0,
+  type_int64     = 1,
+  type_binary    = 2,
+  type_group     = 3,
+  type_end       = 4,
+  type_int32     = 5,
+  type_reserve1  = 6,
+  type_reserve2  = 7,
+  type_undefined = 8,
+  type_packed    = 9,
+  type_repeat    = 10
+};
+
+/**
+ * \brief encode a number to varint encoding
+ * \param num number
+ * \return encoded varint string
+ */
+std::string        encode_varint(uint64_t num);
+inline std::string encode_varint(uint64_t num)
+{
+  std::string _result;
+
+  while (num > 0x7f)
+  {
+    _result += uint8_t((num & 0x7F) | 0x80);
+    num >>= 7;
+  }
+  _result += uint8_t(num);
+
+  return _result;
+}
+
+size_t        decode_varint(const void* data, size_t length, uint64_t& result);
+inline size_t decode_varint(const void* data, size_t length, uint64_t& result)
+{
+  auto _data = static_cast<const unsigned char*>(data);
+
+  if (nullptr == _data || 0 == length) return 0;
+
+  if (length > 10) length = 10;
+
+  size_t   _max = length;
+  size_t   i    = 0;
+  uint64_t r    = 0;
+  while (i < _max)
+  {
+    auto c = _data[i];
+    r += uint64_t(c & 0x7F) << (i * 7);
+    ++i;
+    if (0 == (c & 0x80))
+    {
+      result = r;
+      return i;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * \brief instruction sets for the stage 1 varint scan, picked once at run time
+ */
+enum simd_levels {
+  simd_none = 0, // portable, 8 bytes per step
+  simd_sse2 = 1, // 16 bytes per step, every x86-64 CPU
+  simd_avx2 = 2  // 32 bytes per step
+};
+
+namespace detail {
+inline simd_levels detect_simd()
+{
+#if defined(PROTO_SIMD_X64) && (defined(__GNUC__) || defined(__clang__))
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? simd_avx2 : simd_sse2;
+#elif defined(PROTO_SIMD_X64)
+  int _regs[4];
+  __cpuid(_regs, 0);
+  if (_regs[0] < 7) return simd_sse2;
+  __cpuid(_regs, 1);
+  if (0 == (_regs[2] & (1 << 27)) || 6 != (_xgetbv(0) & 6)) return simd_sse2; // OS saves ymm registers
+  __cpuidex(_regs, 7, 0);
+  return (_regs[1] & (1 << 5)) ? simd_avx2 : simd_sse2;
+#else
+  return simd_none;
+#endif
+}
+
+inline unsigned count_trailing_zeros(std::uint64_t bits)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long _index;
+  _BitScanForward64(&_index, bits);
+  return unsigned(_index);
+#else
+  return unsigned(__builtin_ctzll(bits));
+#endif
+}
+
+inline unsigned count_leading_zeros(std::uint64_t bits)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long _index;
+  _BitScanReverse64(&_index, bits);
+  return 63 - unsigned(_index);
+#else
+  return unsigned(__builtin_clzll(bits));
+#endif
+}
+
+/**
+ * \brief bit i of the result set when byte i of 64 has the high bit clear
+ */
+inline std::uint64_t varint_ends_portable(const unsigned char* data)
+{
+  std::uint64_t _bits = 0;
+  for (auto i = 0; i < 64; i += 8)
+  {
+    std::uint64_t _word;
+    std::memcpy(&_word, data + i, 8); // little endian hosts, as the decoder
+    _word = ~_word & 0x8080808080808080ULL;
+    _bits |= ((_word >> 7) * 0x0102040810204080ULL >> 56) << i; // byte k to bit k
+  }
+  return _bits;
+}
+
+#if defined(PROTO_SIMD_X64)
+inline std::uint64_t varint_ends_sse2(const unsigned char* data)
+{
+  std::uint64_t _bits = 0;
+  for (auto i = 0; i < 64; i += 16)
+  {
+    auto _chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    _bits |= std::uint64_t(std::uint32_t(_mm_movemask_epi8(_chunk))) << i;
+  }
+  return ~_bits;
+}
+
+#  if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("avx2")))
+#  endif
+inline std::uint64_t varint_ends_avx2(const unsigned char* data)
+{
+  auto _low  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+  auto _high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 32));
+  return ~(std::uint64_t(std::uint32_t(_mm256_movemask_epi8(_low))) |
+           (std::uint64_t(std::uint32_t(_mm256_movemask_epi8(_high))) << 32));
+}
+#endif // defined(PROTO_SIMD_X64)
+
+/**
+ * \brief value of a varint of known size, readable bytes left at data
+ */
+inline std::uint64_t join_varint(const unsigned char* data, std::size_t size, std::size_t readable)
+{
+  if (readable < 8)
+  {
+    std::uint64_t _value = 0;
+    for (std::size_t i = 0; i < size; ++i) _value |= std::uint64_t(data[i] & 0x7F) << (i * 7);
+    return _value;
+  }
+
+  // the length is known, the 7 bit groups of up to 8 bytes are joined without a loop
+  std::uint64_t _word;
+  std::memcpy(&_word, data, 8); // little endian hosts, as the decoder
+  _word &= ~std::uint64_t(0) >> (64 - 8 * (size < 8 ? size : 8));
+  _word = ((_word & 0x7F007F007F007F00ULL) >> 1) | (_word & 0x007F007F007F007FULL);
+  _word = ((_word & 0x3FFF00003FFF0000ULL) >> 2) | (_word & 0x00003FFF00003FFFULL);
+  _word = ((_word & 0x0FFFFFFF00000000ULL) >> 4) | (_word & 0x000000000FFFFFFFULL);
+  if (size > 8)
+  {
+    _word |= std::uint64_t(data[8] & 0x7F) << 56;
+    if (size > 9) _word |= std::uint64_t(data[9]) << 63;
+  }
+  return _word;
+}
+} // namespace detail
+
+/**
+ * \brief instruction set of this CPU used by varint_index
+ */
+inline simd_levels simd_level()
+{
+  static const simd_levels _level = detail::detect_simd();
+  return _level;
+}
+
+/**
+ * \brief two stage varint decoding, build() marks every byte with the high bit clear in one bulk pass,
+ *   decode() then takes the varint length from the next marked byte instead of testing byte by byte
+ */
+class varint_index
+{
+public:
+  /**
+   * \brief stage 1, index length bytes of data, data must outlive the index
+   * \param level instruction set, the best one of this CPU by default
+   */
+  void build(const void* data, std::size_t length, simd_levels level = simd_level())
+  {
+    data_   = static_cast<const unsigned char*>(data);
+    length_ = length;
+    bits_.resize(length / 64 + 2); // a zero word at the end, a varint starting in the last word finds no end
+
+    auto _pos  = std::size_t(0);
+    auto _word = std::size_t(0);
+#if defined(PROTO_SIMD_X64)
+    if (simd_avx2 == level)
+    {
+      for (; _pos + 64 <= length; _pos += 64) bits_[_word++] = detail::varint_ends_avx2(data_ + _pos);
+    }
+    else if (simd_sse2 == level)
+    {
+      for (; _pos + 64 <= length; _pos += 64) bits_[_word++] = detail::varint_ends_sse2(data_ + _pos);
+    }
+#endif // defined(PROTO_SIMD_X64)
+    for (; _pos + 64 <= length; _pos += 64) bits_[_word++] = detail::varint_ends_portable(data_ + _pos);
+
+    // the tail padded with bytes that end no varint
+    unsigned char _tail[64];
+    std::memset(_tail, 0x80, sizeof(_tail));
+    if (length > _pos) std::memcpy(_tail, data_ + _pos, length - _pos);
+    bits_[_word++] = detail::varint_ends_portable(_tail);
+    while (_word < bits_.size()) bits_[_word++] = 0;
+  }
+
+  /**
+   * \brief stage 2, decode_varint() of indexed bytes
+   * \param data inside the indexed bytes
+   * \param length bytes left at data
+   */
+  std::size_t decode(const unsigned char* data, std::size_t length, std::uint64_t& result) const
+  {
+    if (0 == length) return 0;
+    if (data[0] < 0x80)
+    {
+      result = data[0];
+      return 1;
+    }
+
+    auto _pos   = std::size_t(data - data_);
+    auto _shift = unsigned(_pos & 63);
+    auto _bits  = bits_[_pos >> 6] >> _shift;
+
+    std::size_t _size;
+    if (0 != _bits)
+    {
+      _size = detail::count_trailing_zeros(_bits) + 1;
+    }
+    else
+    {
+      auto _next = bits_[(_pos >> 6) + 1];
+      if (0 == _next) return 0;
+      _size = 64 - _shift + detail::count_trailing_zeros(_next) + 1;
+    }
+    if (_size > length || _size > std::size_t(MAX_VARINT64_BYTES)) return 0;
+
+    result = detail::join_varint(data, _size, length_ - _pos);
+    return _size;
+  }
+
+  const unsigned char* data() const { return data_; }
+  std::size_t          size() const { return length_; }
+  std::size_t          memory() const { return bits_.capacity() * sizeof(std::uint64_t); }
+
+private:
+  const unsigned char*       data_   = nullptr;
+  std::size_t                length_ = 0;
+  std::vector<std::uint64_t> bits_;
+};
+
+/**
+ * \brief one field found by scan_fields, payload points into the scanned data
+ */
+struct wire_field
+{
+  int                  id;
+  types                type;    // varint, int64, binary, group or int32
+  std::uint64_t        value;   // varint, int64 and int32 value
+  const unsigned char* payload; // binary payload or group body
+  std::size_t          size;
+};
+
+namespace detail {
+/**
+ * \brief find the end key of a group, nested groups skipped
+ * \param body out, bytes before the end key
+ * \return bytes up to and including the end key, 0 if the group is not terminated
+ */
+inline std::size_t skip_group(const unsigned char* data, std::size_t length, std::size_t& body)
+{
+  std::size_t _pos   = 0;
+  std::size_t _depth = 0; // open nested groups
+
+  while (_pos < length)
+  {
+    auto          _key_begin = _pos;
+    std::uint64_t _key;
+    auto          _size = decode_varint(data + _pos, length - _pos, _key);
+    if (0 == _size) return 0;
+    _pos += _size;
+
+    std::uint64_t _skip = 0;
+    switch (types(_key & 7))
+    {
+    case type_varint:
+    {
+      std::uint64_t _value;
+      _skip = decode_varint(data + _pos, length - _pos, _value);
+      if (0 == _skip) return 0;
+      break;
+    }
+    case type_int64: _skip = INT64_BYTES; break;
+    case type_int32: _skip = INT32_BYTES; break;
+    case type_binary:
+    {
+      _size = decode_varint(data + _pos, length - _pos, _skip);
+      if (0 == _size) return 0;
+      _pos += _size;
+      break;
+    }
+    case type_group: ++_depth; break;
+    case type_end:
+    {
+      if (0 == _depth)
+      {
+        body = _key_begin;
+        return _pos;
+      }
+      --_depth;
+      break;
+    }
+    default: return 0;
+    }
+
+    if (_skip > length - _pos) return 0;
+    _pos += std::size_t(_skip);
+  }
+  return 0;
+}
+
+/**
+ * \brief empty a scratch vector kept per thread, its buffer is freed when it grew over MAX_THREAD_CACHE_BYTES
+ */
+template<typename T>
+void trim_cache(std::vector<T>& cache)
+{
+  if (cache.capacity() * sizeof(T) > MAX_THREAD_CACHE_BYTES)
+    std::vector<T>().swap(cache);
+  else
+    cache.clear();
+}
+} // namespace detail
+
+/**
+ * \brief call f(const wire_field&) for each field of encoded data without building a tree
+ *   binary payloads and groups are skipped by length, f scans them itself if wanted,
+ *   f returns false to stop early
+ * \return false if data is malformed before f stopped the scan
+ */
+template<typename F>
+bool scan_fields(const void* data, std::size_t length, F&& f)
+{
+  auto _pdata = static_cast<const unsigned char*>(data);
+  auto _left  = length;
+
+  while (_left > 0)
+  {
+    std::uint64_t _key;
+    auto          _size = decode_varint(_pdata, _left, _key);
+    if (0 == _size || (_key >> 3) > std::uint64_t(MAX_FIELD_NUMBER)) return false;
+    _pdata += _size;
+    _left -= _size;
+
+    wire_field _field{int(_key >> 3), types(_key & 7), 0, nullptr, 0};
+    switch (_field.type)
+    {
+    case type_varint:
+    {
+      _size = decode_varint(_pdata, _left, _field.value);
+      if (0 == _size) return false;
+      break;
+    }
+    case type_int64:
+    case type_int32:
+    {
+      _size = (type_int64 == _field.type) ? INT64_BYTES : INT32_BYTES;
+      if (_left < _size) return false;
+      std::memcpy(&_field.value, _pdata, _size); // little endian hosts, as the decoder
+      break;
+    }
+    case type_binary:
+    {
+      std::uint64_t _length;
+      _size = decode_varint(_pdata, _left, _length);
+      if (0 == _size || _length > _left - _size) return false;
+      _field.payload = _pdata + _size;
+      _field.size    = std::size_t(_length);
+      _size += _field.size;
+      break;
+    }
+    case type_group:
+    {
+      _size = detail::skip_group(_pdata, _left, _field.size);
+      if (0 == _size) return false;
+      _field.payload = _pdata;
+      break;
+    }
+    default: return false;
+    }
+
+    _pdata += _size;
+    _left -= _size;
+    if (!f(static_cast<const wire_field&>(_field))) return true;
+  }
+  return true;
+}
+
+namespace detail {
+/**
+ * \brief combine value into hash, splitmix64 finalizer
+ */
+inline std::uint64_t hash_mix(std::uint64_t hash, std::uint64_t value)
+{
+  hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9ULL;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111ebULL;
+  hash ^= hash >> 31;
+  return hash;
+}
+
+/**
+ * \brief hash of bytes, 8 at a time
+ */
+inline std::uint64_t hash_bytes(const void* data, std::size_t size)
+{
+  auto _data = static_cast<const unsigned char*>(data);
+  auto _hash = hash_mix(0, size);
+
+  std::size_t i = 0;
+  for (; i + 8 <= size; i += 8)
+  {
+    std::uint64_t _word;
+    std::memcpy(&_word, _data + i, 8);
+    _hash = hash_mix(_hash, _word);
+  }
+
+  std::uint64_t _tail = 0;
+  if (i < size) std::memcpy(&_tail, _data + i, size - i);
+  return hash_mix(_hash, _tail);
+}
+
+/**
+ * \brief bytes of num encoded as varint
+ */
+inline std::size_t varint_size(std::uint64_t num)
+{
+  std::size_t _size = 1;
+  while (num > 0x7f)
+  {
+    num >>= 7;
+    ++_size;
+  }
+  return _size;
+}
+
+/**
+ * \brief append num encoded as varint, no temporary string
+ */
+inline void append_varint(std::string& out, std::uint64_t num)
+{
+  char        _bytes[MAX_VARINT64_BYTES];
+  std::size_t _size = 0;
+  while (num > 0x7f)
+  {
+    _bytes[_size++] = char((num & 0x7f) | 0x80);
+    num >>= 7;
+  }
+  _bytes[_size++] = char(num);
+  out.append(_bytes, _size);
+}
+
+template<typename T, std::size_t N>
+struct inline_buffer
+{
+  alignas(T) unsigned char bytes[sizeof(T) * N];
+};
+
+template<typename T>
+struct inline_buffer<T, 0>
+{};
+} // namespace detail
+
+/**
+ * \brief vector keeping up to N elements inline, spilled to heap beyond
+ *   no allocation while size <= N, clear() keeps capacity, at most 2^32-1 elements
+ */
+template<typename T, std::size_t N>
+class small_vector
+{
+public:
+  using value_type     = T;
+  using size_type      = std::size_t;
+  using iterator       = T*;
+  using const_iterator = const T*;
+
+  small_vector() noexcept {}
+
+  small_vector(std::initializer_list<T> values)
+  {
+    reserve(values.size());
+    for (const auto& v : values)
+    {
+      emplace_back(v);
+    }
+  }
+
+  small_vector(const small_vector& obj)
+  {
+    reserve(obj.size());
+    for (const auto& v : obj)
+    {
+      emplace_back(v);
+    }
+  }
+
+  small_vector(small_vector&& obj) noexcept { steal(obj); }
+
+  ~small_vector() { reset(); }
+
+  small_vector& operator=(const small_vector& obj)
+  {
+    if (&obj != this)
+    {
+      clear();
+      reserve(obj.size());
+      for (const auto& v : obj)
+      {
+        emplace_back(v);
+      }
+    }
+    return *this;
+  }
+
+  small_vector& operator=(small_vector&& obj) noexcept
+  {
+    if (&obj != this)
+    {
+      reset();
+      steal(obj);
+    }
+    return *this;
+  }
+
+  ////////////////////////////////////////////////////////////
+  T*       data() noexcept { return (N > 0 && is_inline()) ? inline_data() : storage_.heap; }
+  const T* data() const noexcept { return (N > 0 && is_inline()) ? inline_data() : storage_.heap; }
+
+  iterator       begin() noexcept { return data(); }
+  iterator       end() noexcept { return data() + size_; }
+  const_iterator begin() const noexcept { return data(); }
+  const_iterator end() const noexcept { return data() + size_; }
+  const_iterator cbegin() const noexcept { return data(); }
+  const_iterator cend() const noexcept { return data() + size_; }
+
+  size_type size() const noexcept { return size_; }
+  size_type capacity() const noexcept { return capacity_; }
+  bool      empty() const noexcept { return 0 == size_; }
+
+  T&       operator[](size_type index) { return data()[index]; }
+  const T& operator[](size_type index) const { return data()[index]; }
+  T&       at(size_type index) { return index < size_ ? data()[index] : throw std::out_of_range("proto::small_vector"); }
+  const T& at(size_type index) const
+  {
+    return index < size_ ? data()[index] : throw std::out_of_range("proto::small_vector");
+  }
+  T&       front() { return data()[0]; }
+  const T& front() const { return data()[0]; }
+  T&       back() { return data()[size_ - 1]; }
+  const T& back() const { return data()[size_ - 1]; }
+
+  ////////////////////////////////////////////////////////////
+  void clear() noexcept
+  {
+    auto _data = data();
+    for (size_type i = 0; i < size_; ++i)
+    {
+      _data[i].~T();
+    }
+    size_ = 0;
+  }
+
+  void reserve(size_type count)
+  {
+    if (count > capacity_) grow(count);
+  }
+
+  void resize(size_type count)
+  {
+    reserve(count);
+    while (size_ < count)
+    {
+      emplace_back();
+    }
+    while (size_ > count)
+    {
+      pop_back();
+    }
+  }
+
+  void push_back(const T& value) { emplace_back(value); }
+
+  void push_back(T&& value) { emplace_back(std::move(value)); }
+
+  template<typename... Args>
+  T& emplace_back(Args&&... args)
+  {
+    if (size_ == capacity_)
+    {
+      // construct first, args may refer to an element
+      T _value(std::forward<Args>(args)...);
+      grow(capacity_ ? size_type(capacity_) * 2 : 1);
+      return *new (data() + size_++) T(std::move(_value));
+    }
+    return *new (data() + size_++) T(std::forward<Args>(args)...);
+  }
+
+  void pop_back()
+  {
+    data()[--size_].~T();
+  }
+
+  ////////////////////////////////////////////////////////////
+  // the std::vector operations not above, new elements are appended and rotated into place
+
+  template<typename... Args>
+  iterator emplace(const_iterator pos, Args&&... args)
+  {
+    auto _index = size_type(pos - begin());
+    emplace_back(std::forward<Args>(args)...);
+    std::rotate(begin() + _index, end() - 1, end());
+    return begin() + _index;
+  }
+
+  iterator insert(const_iterator pos, const T& value) { return emplace(pos, value); }
+  iterator insert(const_iterator pos, T&& value) { return emplace(pos, std::move(value)); }
+
+  iterator insert(const_iterator pos, size_type count, const T& value)
+  {
+    auto _index = size_type(pos - begin());
+    auto _size  = size_type(size_);
+    T    _value(value); // value may be an element
+    reserve(_size + count);
+    for (size_type i = 0; i < count; ++i)
+    {
+      emplace_back(_value);
+    }
+    std::rotate(begin() + _index, begin() + _size, end());
+    return begin() + _index;
+  }
+
+  template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+  iterator insert(const_iterator pos, InputIt first, InputIt last)
+  {
+    auto _index = size_type(pos - begin());
+    auto _size  = size_type(size_);
+    for (; first != last; ++first)
+    {
+      emplace_back(*first);
+    }
+    std::rotate(begin() + _index, begin() + _size, end());
+    return begin() + _index;
+  }
+
+  iterator insert(const_iterator pos, std::initializer_list<T> values)
+  {
+    return insert(pos, values.begin(), values.end());
+  }
+
+  iterator erase(const_iterator pos) { return erase(pos, pos + 1); }
+
+  iterator erase(const_iterator first, const_iterator last)
+  {
+    auto _first = begin() + (first - begin());
+    auto _count = size_type(last - first);
+    if (0 == _count) return _first; // moving elements onto themselves would empty strings
+    std::move(_first + _count, end(), _first);
+    for (size_type i = 0; i < _count; ++i)
+    {
+      pop_back();
+    }
+    return _first;
+  }
+
+  void assign(size_type count, const T& value)
+  {
+    clear();
+    insert(end(), count, value);
+  }
+
+  template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+  void assign(InputIt first, InputIt last)
+  {
+    clear();
+    insert(end(), first, last);
+  }
+
+  void assign(std::initializer_list<T> values) { assign(values.begin(), values.end()); }
+
+  void resize(size_type count, const T& value)
+  {
+    if (count > size_) insert(end(), count - size_, value);
+    while (size_ > count)
+    {
+      pop_back();
+    }
+  }
+
+  void swap(small_vector& obj) noexcept
+  {
+    small_vector _temp(std::move(obj));
+    obj   = std::move(*this);
+    *this = std::move(_temp);
+  }
+
+  friend bool operator==(const small_vector& a, const small_vector& b)
+  {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+  }
+  friend bool operator!=(const small_vector& a, const small_vector& b) { return !(a == b); }
+
+private:
+  std::uint32_t size_     = 0;
+  std::uint32_t capacity_ = N; // N: elements are inline
+
+  union storage
+  {
+    storage() noexcept
+      : heap(nullptr)
+    {}
+
+    T*                          heap;
+    detail::inline_buffer<T, N> local;
+  } storage_;
+
+  bool is_inline() const noexcept { return capacity_ <= N; }
+
+  T*       inline_data() noexcept { return reinterpret_cast<T*>(&storage_.local); }
+  const T* inline_data() const noexcept { return reinterpret_cast<const T*>(&storage_.local); }
+
+  void grow(size_type count)
+  {
+    if (count > (std::numeric_limits<std::uint32_t>::max)()) throw std::length_error("proto::small_vector too long");
+
+    auto _heap = static_cast<T*>(::operator new(count * sizeof(T)));
+    auto _data = data();
+    for (size_type i = 0; i < size_; ++i)
+    {
+      new (_heap + i) T(std::move(_data[i]));
+      _data[i].~T();
+    }
+    if (!is_inline()) ::operator delete(storage_.heap);
+
+    storage_.heap = _heap;
+    capacity_     = std::uint32_t(count);
+  }
+
+  void reset() noexcept
+  {
+    clear();
+    if (!is_inline()) ::operator delete(storage_.heap);
+    storage_.heap = nullptr;
+    capacity_     = N;
+  }
+
+  void steal(small_vector& obj) noexcept
+  {
+    // N == 0 has no inline elements, an empty heap pointer is taken below
+    if (N > 0 && obj.is_inline())
+    {
+      for (size_type i = 0; i < obj.size_; ++i)
+      {
+        new (inline_data() + i) T(std::move(obj.inline_data()[i]));
+      }
+      size_ = obj.size_;
+      obj.clear();
+      return;
+    }
+
+    storage_.heap     = obj.storage_.heap;
+    size_             = obj.size_;
+    capacity_         = obj.capacity_;
+    obj.storage_.heap = nullptr;
+    obj.size_         = 0;
+    obj.capacity_     = N;
+  }
+};
+
+/**
+ * \brief list shared between copies until one of them is modified
+ *   copying is O(1), non-const access clones a shared list first, so only modified
+ *   lists are copied, elements copy their own lists the same way
+ *   non-const begin(), end(), front() and back() count as access, a range for over a non-const
+ *   list clones it when shared, iterate a const reference to only read
+ *   the list is allocated on first non-const access, an empty list holds no memory
+ *   the owner count is atomic, a copy sees the releases of other threads before it modifies a list
+ *   it found unshared, so copies may be modified and dropped on different threads
+ */
+template<typename T>
+class cow_list
+{
+public:
+  using value_type     = T;
+  using size_type      = std::size_t;
+  using iterator       = typename std::list<T>::iterator;
+  using const_iterator = typename std::list<T>::const_iterator;
+
+  cow_list() noexcept {}
+
+  cow_list(const cow_list& obj) noexcept
+    : list_(obj.list_)
+  {
+    if (list_) list_->owners.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  cow_list(cow_list&& obj) noexcept
+    : list_(obj.list_)
+  {
+    obj.list_ = nullptr;
+  }
+
+  ~cow_list() { release(); }
+
+  cow_list& operator=(const cow_list& obj) noexcept
+  {
+    cow_list _copy(obj);
+    std::swap(list_, _copy.list_);
+    return *this;
+  }
+
+  cow_list& operator=(cow_list&& obj) noexcept
+  {
+    std::swap(list_, obj.list_);
+    return *this;
+  }
+
+  ////////////////////////////////////////////////////////////
+  const_iterator begin() const noexcept { return get().begin(); }
+  const_iterator end() const noexcept { return get().end(); }
+  iterator       begin() { return list().begin(); } // clones a shared list
+  iterator       end() { return list().end(); }     // clones a shared list
+
+  size_type size() const noexcept { return get().size(); }
+  bool      empty() const noexcept { return !list_ || list_->items.empty(); }
+
+  const T& front() const { return get().front(); }
+  const T& back() const { return get().back(); }
+  T&       front() { return list().front(); }
+  T&       back() { return list().back(); }
+
+  ////////////////////////////////////////////////////////////
+  /**
+   * \brief drop all elements, a shared list is left to its other owners
+   */
+  void clear() noexcept
+  {
+    if (unique())
+    {
+      list_->items.clear();
+      return;
+    }
+    release();
+  }
+
+  void push_back(const T& value) { list().push_back(value); }
+  void push_back(T&& value) { list().push_back(std::move(value)); }
+
+  template<typename... Args>
+  T& emplace_back(Args&&... args)
+  {
+    return list().emplace_back(std::forward<Args>(args)...);
+  }
+
+  iterator erase(iterator pos) { return list().erase(pos); }
+
+  void splice(iterator pos, std::list<T>& other) { list().splice(pos, other); }
+  void splice(iterator pos, std::list<T>& other, iterator it) { list().splice(pos, other, it); }
+  void splice(iterator pos, cow_list& other, iterator it) { list().splice(pos, other.list(), it); }
+
+  ////////////////////////////////////////////////////////////
+  /**
+   * \brief true if the list is allocated and owned by this copy alone
+   *   the acquire load pairs with the release of the other owners, their reads happen before a modification
+   */
+  bool unique() const noexcept { return list_ && 1 == list_->owners.load(std::memory_order_acquire); }
+
+  /**
+   * \brief the list owned by this copy alone, cloned first if shared
+   */
+  std::list<T>& list()
+  {
+    if (!list_)
+    {
+      list_ = new shared_list();
+    }
+    else if (!unique())
+    {
+      auto _copy = new shared_list(list_->items);
+      release();
+      list_ = _copy;
+    }
+    return list_->items;
+  }
+
+  /**
+   * \brief the list for reading, an empty list if none allocated
+   */
+  const std::list<T>& get() const noexcept
+  {
+    static const std::list<T> _empty;
+    return list_ ? list_->items : _empty;
+  }
+
+private:
+  struct shared_list
+  {
+    shared_list() = default;
+    explicit shared_list(const std::list<T>& obj)
+      : items(obj)
+    {}
+
+    std::list<T>             items;
+    std::atomic<std::size_t> owners{1};
+  };
+
+  /**
+   * \brief drop this owner, the last one frees the list
+   */
+  void release() noexcept
+  {
+    if (list_ && 1 == list_->owners.fetch_sub(1, std::memory_order_acq_rel)) delete list_;
+    list_ = nullptr;
+  }
+
+  shared_list* list_ = nullptr;
+};
+
+/**
+ * \brief original encoded bytes of a decoded field, shared with the input buffer
+ */
+struct raw_span
+{
+  std::shared_ptr<const std::string> source;
+  std::size_t                        offset = 0;
+  std::size_t                        size   = 0;
+
+  explicit operator bool() const noexcept { return !!source; }
+
+  void reset() noexcept
+  {
+    source.reset();
+    offset = 0;
+    size   = 0;
+  }
+};
+
+/**
+ * \brief decode statistics, collected when passed in decode_options
+ *   fields and bytes of a failed speculative packed decode are not counted,
+ *   bytes of nested messages and groups are counted at every level
+ */
+struct decode_stats
+{
+  std::uint64_t fields[8] = {0}; // decoded fields per wire type
+  std::uint64_t bytes[8]  = {0}; // encoded bytes per wire type, key included
+
+  std::uint64_t packed_attempts     = 0; // binary fields tried as nested message
+  std::uint64_t packed_successes    = 0; // binary fields decoded as nested message
+  std::uint64_t packed_wasted_bytes = 0; // bytes scanned by failed attempts
+  std::uint64_t packed_hint_skips   = 0; // attempts left out, decode_hints expected a failure and a scan confirmed it
+  std::uint64_t packed_check_skips  = 0; // attempts left out, the first fields can not decode, see check_fields
+  std::uint64_t packed_text_skips   = 0; // attempts left out, mostly printable text, see text_percent
+  std::uint64_t packed_scalar_skips = 0; // attempts left out, taken for packed repeated scalars, see scalars
+
+  std::uint64_t repeat_conversions = 0; // group or packed fields turned into repeat field
+  std::uint64_t node_allocations   = 0; // new field nodes
+  std::uint64_t binary_allocations = 0; // binary values too long for inline string storage
+
+  int           max_depth  = 0; // deepest nesting reached, speculative attempts included
+  std::uint64_t work_bytes = 0; // bytes scanned at every level, speculative attempts included
+  std::uint64_t decode_ns = 0; // time spent in deserialize
+
+  /**
+   * \brief drop field counts made after saved, keep attempt counts
+   */
+  void rollback_fields(const decode_stats& saved)
+  {
+    for (auto i = 0; i < 8; ++i)
+    {
+      fields[i] = saved.fields[i];
+      bytes[i]  = saved.bytes[i];
+    }
+    repeat_conversions = saved.repeat_conversions;
+    node_allocations   = saved.node_allocations;
+    binary_allocations = saved.binary_allocations;
+  }
+};
+
+/**
+ * \brief why deserialize stopped
+ */
+enum decode_errors {
+  decode_ok              = 0,
+  decode_malformed       = 1, // input is not a valid protobuf
+  decode_depth_exceeded  = 2, // groups nested deeper than max_depth
+  decode_budget_exceeded = 3  // more bytes scanned than work_budget
+};
+
+namespace detail {
+/**
+ * \brief false when data can not decode as a packed field, checked without building nodes
+ *   true is not a promise, nested fields are not followed and an unterminated group leaves the answer
+ *   to the decoder
+ * \param fields top level fields to check, 0 all
+ * \param odd optional out, set when a top level field has id 0 or is a group or an end key, legal but unlikely
+ *   in a message written today
+ */
+inline bool may_be_message(const unsigned char* data, std::size_t length, std::size_t fields = 0, bool* odd = nullptr)
+{
+  if (0 == length) return false;
+
+  for (std::size_t _field = 0; length > 0 && (0 == fields || _field < fields); ++_field)
+  {
+    std::uint64_t _key;
+    auto          _size = decode_varint(data, length, _key);
+    if (0 == _size || (_key >> 3) > std::uint64_t(MAX_FIELD_NUMBER)) return false;
+    if (odd && (0 == (_key >> 3) || type_end == types(_key & 7) || type_group == types(_key & 7))) *odd = true;
+    data += _size;
+    length -= _size;
+    if (0 == length) return false;
+
+    std::uint64_t _skip = 0;
+    switch (types(_key & 7))
+    {
+    case type_varint:
+    {
+      std::uint64_t _value;
+      _skip = decode_varint(data, length, _value);
+      if (0 == _skip) return false;
+      break;
+    }
+    case type_int64: _skip = INT64_BYTES; break;
+    case type_int32: _skip = INT32_BYTES; break;
+    case type_binary:
+    {
+      _size = decode_varint(data, length, _skip);
+      if (0 == _size) return false;
+      data += _size;
+      length -= _size;
+      break;
+    }
+    case type_end: break;
+    case type_group:
+    {
+      // an unterminated group may still decode, as the last field
+      std::size_t _body;
+      _skip = skip_group(data, length, _body);
+      if (0 == _skip) return true;
+      break;
+    }
+    default: return false;
+    }
+
+    if (_skip > length) return false;
+    data += std::size_t(_skip);
+    length -= std::size_t(_skip);
+  }
+  return true;
+}
+
+inline unsigned count_bits(std::uint32_t bits)
+{
+  bits = bits - ((bits >> 1) & 0x55555555u);
+  bits = (bits & 0x33333333u) + ((bits >> 2) & 0x33333333u);
+  return unsigned((((bits + (bits >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24);
+}
+
+/**
+ * \brief bytes of data that are printable ASCII, tab, line feed or carriage return
+ */
+inline std::size_t count_printable(const unsigned char* data, std::size_t length)
+{
+  std::size_t _count = 0;
+  std::size_t i      = 0;
+#if defined(PROTO_SIMD_X64)
+  // SSE2 is part of x86-64, no run time check
+  const auto _space = _mm_set1_epi8(0x1F);
+  const auto _del   = _mm_set1_epi8(0x7F);
+  const auto _tab   = _mm_set1_epi8('\t');
+  const auto _lf    = _mm_set1_epi8('\n');
+  const auto _cr    = _mm_set1_epi8('\r');
+  for (; i + 16 <= length; i += 16)
+  {
+    auto _chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    // signed compare, bytes over 0x7F are negative and not printable
+    auto _text = _mm_and_si128(_mm_cmpgt_epi8(_chunk, _space), _mm_cmplt_epi8(_chunk, _del));
+    _text      = _mm_or_si128(_text, _mm_cmpeq_epi8(_chunk, _tab));
+    _text      = _mm_or_si128(_text, _mm_or_si128(_mm_cmpeq_epi8(_chunk, _lf), _mm_cmpeq_epi8(_chunk, _cr)));
+    _count += count_bits(std::uint32_t(_mm_movemask_epi8(_text)));
+  }
+#endif // defined(PROTO_SIMD_X64)
+  for (; i < length; ++i)
+  {
+    auto c = data[i];
+    if ((c >= 0x20 && c < 0x7F) || '\t' == c || '\n' == c || '\r' == c) ++_count;
+  }
+  return _count;
+}
+
+/**
+ * \brief true when data is a run of complete varints, as packed repeated scalars encode
+ */
+inline bool is_varint_run(const unsigned char* data, std::size_t length)
+{
+  while (length > 0)
+  {
+    std::uint64_t _value;
+    auto          _size = decode_varint(data, length, _value);
+    if (0 == _size) return false;
+    data += _size;
+    length -= _size;
+  }
+  return true;
+}
+
+inline unsigned count_bits(std::uint64_t bits)
+{
+  return count_bits(std::uint32_t(bits)) + count_bits(std::uint32_t(bits >> 32));
+}
+
+/**
+ * \brief varints in data if it is a run of complete varints, 0 otherwise, 64 bytes per step
+ */
+inline std::size_t count_varint_run(const unsigned char* data, std::size_t length)
+{
+  if (0 == length || data[length - 1] >= 0x80) return 0;
+
+  std::size_t _count = 0;
+  std::size_t _carry = 0; // continuation bytes at the end of the previous 64
+  for (std::size_t _pos = 0; _pos < length; _pos += 64)
+  {
+    std::uint64_t _ends;
+    std::uint64_t _bytes = ~std::uint64_t(0); // bits of bytes inside data
+    if (_pos + 64 <= length)
+    {
+#if defined(PROTO_SIMD_X64)
+      _ends = varint_ends_sse2(data + _pos);
+#else
+      _ends = varint_ends_portable(data + _pos);
+#endif // defined(PROTO_SIMD_X64)
+    }
+    else
+    {
+      unsigned char _tail[64];
+      std::memset(_tail, 0x80, sizeof(_tail));
+      std::memcpy(_tail, data + _pos, length - _pos);
+      _ends  = varint_ends_portable(_tail);
+      _bytes = ~(~std::uint64_t(0) << (length - _pos));
+    }
+
+    if (0 == _ends)
+    {
+      _carry += 64;
+      if (_carry >= std::size_t(MAX_VARINT64_BYTES)) return 0;
+      continue;
+    }
+    if (_carry + count_trailing_zeros(_ends) >= std::size_t(MAX_VARINT64_BYTES)) return 0;
+
+    // a bit left set starts MAX_VARINT64_BYTES continuation bytes in a row, runs reaching the next 64 go to _carry
+    auto _more = ~_ends & _bytes;
+    auto _long = _more;
+    for (auto i = 1; i < MAX_VARINT64_BYTES; ++i) _long &= _more >> i;
+    if (0 != _long) return 0;
+
+    _count += count_bits(_ends);
+    _carry = count_leading_zeros(_ends);
+  }
+  return _count;
+}
+
+/**
+ * \brief true when data is valid UTF-8 with at least one multi byte sequence and no control bytes
+ */
+inline bool is_utf8_text(const unsigned char* data, std::size_t length)
+{
+  bool _multi = false;
+  for (std::size_t i = 0; i < length;)
+  {
+    auto c = data[i];
+    if (c < 0x80)
+    {
+      if (c < 0x20 && '\t' != c && '\n' != c && '\r' != c) return false;
+      ++i;
+      continue;
+    }
+
+    std::size_t _follow = (c >= 0xC2 && c < 0xE0) ? 1 : (c >= 0xE0 && c < 0xF0) ? 2 : (c >= 0xF0 && c < 0xF5) ? 3 : 0;
+    if (0 == _follow || i + _follow >= length) return false;
+    for (std::size_t k = 1; k <= _follow; ++k)
+    {
+      if (0x80 != (data[i + k] & 0xC0)) return false;
+    }
+    _multi = true;
+    i += _follow + 1;
+  }
+  return _multi;
+}
+} // namespace detail
+
+/**
+ * \brief packed repeated scalars a binary payload can hold
+ */
+enum packed_kinds {
+  packed_none    = 0, // not taken for scalars
+  packed_varint  = 1, // int32, int64, uint32, uint64, sint32, sint64, bool, enum
+  packed_fixed32 = 2, // fixed32, sfixed32, float
+  packed_fixed64 = 3  // fixed64, sfixed64, double
+};
+
+/**
+ * \brief heuristic of classify_packed(), the wire format does not tell packed scalars from strings or messages
+ */
+struct packed_scalar_options
+{
+  std::size_t min_values   = 4;    // shorter runs stay binary
+  int         text_percent = 50;   // payloads with at least this percent of printable bytes in the first
+                                   // TEXT_SAMPLE_BYTES are strings
+  bool        fixed        = false; // also take fixed32 and fixed64 runs, payloads that are neither a varint run
+                                    // nor a message nor UTF-8 text and have a length multiple of 4, opaque
+                                    // bytes such as hashes often pass
+};
+
+namespace detail {
+const std::size_t TEXT_SAMPLE_BYTES = 64;
+
+/**
+ * \brief true when the varints of a run differ by at most one byte in width, as values of one field usually do
+ *   random bytes give widths of 1 to 5 and more
+ */
+inline bool has_even_widths(const unsigned char* data, std::size_t length)
+{
+  std::size_t _shortest = ~std::size_t(0);
+  std::size_t _longest  = 0;
+  std::size_t _begin    = 0;
+  for (std::size_t i = 0; i < length; ++i)
+  {
+    if (data[i] >= 0x80) continue;
+    auto _width = i + 1 - _begin;
+    _shortest   = (_width < _shortest) ? _width : _shortest;
+    _longest    = (_width > _longest) ? _width : _longest;
+    if (_longest > _shortest + 1) return false;
+    _begin = i + 1;
+  }
+  return true;
+}
+
+/**
+ * \brief true when value reads as a small integer, |value| < 2^24, or a float of magnitude 2^-32 to 2^33
+ *   about one random value in four passes
+ */
+inline bool is_plausible_fixed32(std::uint32_t value)
+{
+  auto _high     = value >> 24;
+  auto _exponent = (value >> 23) & 0xFF;
+  return 0 == _high || 0xFF == _high || (_exponent >= 127 - 32 && _exponent <= 127 + 32);
+}
+} // namespace detail
+
+/**
+ * \brief kind of packed scalars data is taken for
+ *   a varint run is taken only if its widths are even, see detail::has_even_widths(), and if it may also decode
+ *   as a message only if a top level field has id 0 or is a group or an end key,
+ *   a varint run that could be fixed and has more zero bytes than half its values is taken for fixed,
+ *   a fixed run is fixed64 when every high 32 bits are a sign extension or every low 32 bits are 0, as doubles
+ *   with short mantissas, and fixed32 when every value is detail::is_plausible_fixed32()
+ */
+inline packed_kinds classify_packed(const void* data, std::size_t length, const packed_scalar_options& options = {})
+{
+  auto _data = static_cast<const unsigned char*>(data);
+  auto _min  = options.min_values > 0 ? options.min_values : 1;
+  if (0 == length) return packed_none;
+
+  auto _sample = (length < detail::TEXT_SAMPLE_BYTES) ? length : detail::TEXT_SAMPLE_BYTES;
+  if (options.text_percent > 0 && detail::count_printable(_data, _sample) * 100 >= std::size_t(options.text_percent) * _sample)
+    return packed_none;
+
+  // the top level fields are checked first, a decoded packed field mostly fails here before its bytes are scanned
+  bool _odd     = false;
+  auto _message = detail::may_be_message(_data, length, 0, &_odd);
+  if (_message && !_odd) return packed_none;
+
+  auto _count = detail::count_varint_run(_data, length);
+  auto _fixed = options.fixed && 0 == length % 4 && length / 4 >= _min;
+  if (_count < _min && !_fixed) return packed_none;
+
+  auto _varint = _count >= _min && detail::has_even_widths(_data, length);
+
+  // zero bytes are zero values or end over long varints, a varint run mostly made of them is checked as fixed first
+  if (_varint && (!_fixed || std::size_t(std::count(_data, _data + length, 0)) * 2 <= _count)) return packed_varint;
+  if (!_fixed || detail::is_utf8_text(_data, length)) return _varint ? packed_varint : packed_none;
+
+  bool _plausible = true;
+  for (std::size_t i = 0; i < length && _plausible; i += 4)
+  {
+    std::uint32_t _value;
+    std::memcpy(&_value, _data + i, 4);
+    _plausible = detail::is_plausible_fixed32(_value);
+  }
+  if (0 != length % 8) return _plausible ? packed_fixed32 : _varint ? packed_varint : packed_none;
+
+  bool _extended = true;
+  bool _low_zero = true;
+  for (std::size_t i = 0; i < length && (_extended || _low_zero); i += 8)
+  {
+    std::uint32_t _low, _high;
+    std::memcpy(&_low, _data + i, 4); // little endian hosts, as the decoder
+    std::memcpy(&_high, _data + i + 4, 4);
+    _extended = _extended && (0 == _high || 0xFFFFFFFFu == _high);
+    _low_zero = _low_zero && 0 == _low;
+  }
+  if (_extended || _low_zero) return packed_fixed64;
+  return _plausible ? packed_fixed32 : _varint ? packed_varint : packed_none;
+}
+
+/**
+ * \brief decode data as packed repeated scalars of kind, values appended, fixed32 zero extended
+ * \return false if data is not a complete run of kind, values is left as it was
+ */
+inline bool decode_packed(const void* data, std::size_t length, packed_kinds kind, std::vector<std::uint64_t>& values)
+{
+  auto _data = static_cast<const unsigned char*>(data);
+  auto _old  = values.size();
+
+  switch (kind)
+  {
+  case packed_varint:
+  {
+    auto _count = detail::count_varint_run(_data, length);
+    if (0 == _count && 0 != length) return false;
+
+    // the run is checked, each varint runs from one end bit to the next, ends are found 64 bytes per step
+    values.resize(_old + _count);
+    auto        _out   = values.data() + _old;
+    std::size_t _begin = 0;
+    for (std::size_t _pos = 0; _pos < length; _pos += 64)
+    {
+      std::uint64_t _ends;
+      if (_pos + 64 <= length)
+      {
+#if defined(PROTO_SIMD_X64)
+        _ends = detail::varint_ends_sse2(_data + _pos);
+#else
+        _ends = detail::varint_ends_portable(_data + _pos);
+#endif // defined(PROTO_SIMD_X64)
+      }
+      else
+      {
+        unsigned char _tail[64];
+        std::memset(_tail, 0x80, sizeof(_tail));
+        std::memcpy(_tail, _data + _pos, length - _pos);
+        _ends = detail::varint_ends_portable(_tail);
+      }
+
+      for (; 0 != _ends; _ends &= _ends - 1)
+      {
+        auto _end = _pos + detail::count_trailing_zeros(_ends) + 1;
+        *_out++   = detail::join_varint(_data + _begin, _end - _begin, length - _begin);
+        _begin    = _end;
+      }
+    }
+    return true;
+  }
+  case packed_fixed32:
+  {
+    if (0 != length % 4) return false;
+    values.resize(_old + length / 4);
+    for (std::size_t i = 0; i < length / 4; ++i)
+    {
+      std::uint32_t _value;
+      std::memcpy(&_value, _data + i * 4, 4);
+      values[_old + i] = _value;
+    }
+    return true;
+  }
+  case packed_fixed64:
+  {
+    if (0 != length % 8) return false;
+    values.resize(_old + length / 8);
+    if (length > 0) std::memcpy(values.data() + _old, _data, length);
+    return true;
+  }
+  default: return false;
+  }
+}
+
+/**
+ * \brief outcomes of speculative packed decodes per field path, learned over a stream of similar records
+ *   binary fields on a path whose attempts mostly failed are scanned by detail::may_be_message() first,
+ *   the attempt is left out only when the scan rules it out, so trees are the same with or without hints,
+ *   bytes of attempts left out do not count against work_budget
+ *   one instance per stream, it is not locked
+ */
+class decode_hints
+{
+public:
+  enum kinds {
+    kind_unknown        = 0, // too few fields seen
+    kind_message        = 1, // mostly decoded as nested message
+    kind_string         = 2, // mostly failed, a string or bytes
+    kind_packed_scalars = 3  // mostly failed, every failed payload a run of varints
+  };
+
+  /**
+   * \brief attempts seen on one path
+   */
+  struct outcomes
+  {
+    std::uint32_t attempts  = 0;
+    std::uint32_t successes = 0;
+    std::uint32_t scalars   = 0; // failures whose payload is a run of varints
+
+    kinds kind() const
+    {
+      if (attempts < MIN_OUTCOMES) return kind_unknown;
+
+      auto _failures = attempts - successes;
+      if (successes >= _failures) return kind_message;
+      return (scalars == _failures) ? kind_packed_scalars : kind_string;
+    }
+
+    bool expect_failure() const
+    {
+      auto _kind = kind();
+      return kind_string == _kind || kind_packed_scalars == _kind;
+    }
+
+    /**
+     * \brief count an attempt, the payload of a failure is checked for a varint run
+     */
+    void record(bool success, const unsigned char* payload, std::size_t length)
+    {
+      if (std::numeric_limits<std::uint32_t>::max() == attempts) return;
+
+      ++attempts;
+      if (success)
+        ++successes;
+      else if (detail::is_varint_run(payload, length))
+        ++scalars;
+    }
+  };
+
+  /**
+   * \brief path key of field id under the field with path key parent, 0 is the root
+   */
+  static std::uint64_t path_key(std::uint64_t parent, int id)
+  {
+    return detail::hash_mix(parent, std::uint64_t(std::uint32_t(id)));
+  }
+
+  static std::uint64_t path_key(const std::vector<int>& path)
+  {
+    std::uint64_t _key = 0;
+    for (auto id : path)
+    {
+      _key = path_key(_key, id);
+    }
+    return _key;
+  }
+
+  kinds kind(std::uint64_t path) const
+  {
+    auto it = paths_.find(path);
+    return (paths_.end() == it) ? kind_unknown : it->second.kind();
+  }
+
+  kinds kind(const std::vector<int>& path) const { return kind(path_key(path)); }
+
+  /**
+   * \brief outcomes of path, added if new, references stay valid until clear()
+   */
+  outcomes& at(std::uint64_t path) { return paths_[path]; }
+
+  std::size_t size() const { return paths_.size(); }
+  void        clear() { paths_.clear(); }
+
+private:
+  static const std::uint32_t MIN_OUTCOMES = 4; // attempts seen on a path before it gets a kind
+
+  std::unordered_map<std::uint64_t, outcomes> paths_;
+};
+
+/**
+ * \brief deserialize options
+ *   max_depth and work_budget bound the cost of untrusted input, speculative packed decodes are
+ *   not tried beyond max_depth and the bytes they scan count against work_budget
+ */
+struct decode_options
+{
+  int            dec_pack_depth = -1;      // decode packed type depth, -1 unlimited
+  decode_stats*  stats          = nullptr; // optional statistics collector
+  int            max_depth      = 0;       // deepest nesting of groups and packed fields, 0 unlimited
+  std::uint64_t  work_budget    = 0;       // bytes scanned at every level, 0 unlimited
+  decode_errors* error          = nullptr; // optional out, why decode stopped
+  bool           index_varints  = false;   // flat_message: find varint ends with a varint_index, if simd_level() has one
+  bool           packed_copies  = true;    // decoded packed fields also keep their bytes in binary_values_,
+                                           // false keeps the sub fields and raw_ only, payload() reads raw_,
+                                           // ignored by the overloads that copy the input and keep no raw_
+  decode_hints*  hints          = nullptr; // optional, learns and skips packed attempts bound to fail, message only
+
+  // pre-checks of binary fields before a packed attempt, skipped attempts are not counted as attempts
+  int check_fields = 0; // exact, first top level fields scanned by detail::may_be_message(), 0 off
+  int text_percent = 0; // heuristic, payloads with at least this percent of printable bytes in the first
+                        // TEXT_SAMPLE_BYTES are kept as binary even if they decode, 0 off
+  const packed_scalar_options* scalars = nullptr; // optional, payloads classify_packed() takes for scalars stay binary
+};
+
+namespace detail {
+/**
+ * \brief true when options rule out a packed attempt on payload, the skip is counted in stats
+ */
+inline bool skip_packed_attempt(const unsigned char* payload, std::size_t length, const decode_options& options)
+{
+  if (options.check_fields > 0 && !may_be_message(payload, length, std::size_t(options.check_fields)))
+  {
+    if (options.stats) ++options.stats->packed_check_skips;
+    return true;
+  }
+
+  if (options.text_percent > 0 && length > 0)
+  {
+    auto _sample = (length < TEXT_SAMPLE_BYTES) ? length : TEXT_SAMPLE_BYTES;
+    if (count_printable(payload, _sample) * 100 >= std::size_t(options.text_percent) * _sample)
+    {
+      if (options.stats) ++options.stats->packed_text_skips;
+      return true;
+    }
+  }
+
+  if (options.scalars && packed_none != classify_packed(payload, length, *options.scalars))
+  {
+    if (options.stats) ++options.stats->packed_scalar_skips;
+    return true;
+  }
+  return false;
+}
+} // namespace detail
+
+const std::size_t SERIALIZE_PIECE_BYTES = 256 * 1024; // encoded bytes per task of serialize_parallel()
+const std::size_t IOV_MIN_BYTES = 4 * 1024; // serialize_iov() points at values from this size, smaller ones are copied
+
+#if !defined(_WIN32)
+/**
+ * \brief write all buffers to fd, writev() takes at most IOV_MAX of them a call and may write part of them
+ * \return all bytes written, errno is set otherwise
+ */
+inline bool write_iov(int fd, std::vector<iovec> buffers)
+{
+#  if defined(IOV_MAX)
+  const std::size_t _max = IOV_MAX;
+#  else
+  const std::size_t _max = 1024;
+#  endif
+  std::size_t _first = 0;
+  while (_first < buffers.size())
+  {
+    auto _count   = std::min(buffers.size() - _first, _max);
+    auto _written = ::writev(fd, buffers.data() + _first, int(_count));
+    if (_written < 0)
+    {
+      if (EINTR == errno) continue;
+      return false;
+    }
+
+    // skip the buffers written, the next call starts inside a buffer written in part
+    auto _left = std::size_t(_written);
+    while (_first < buffers.size() && _left >= buffers[_first].iov_len)
+    {
+      _left -= buffers[_first].iov_len;
+      ++_first;
+    }
+    if (_left > 0)
+    {
+      buffers[_first].iov_base = static_cast<char*>(buffers[_first].iov_base) + _left;
+      buffers[_first].iov_len -= _left;
+    }
+  }
+  return true;
+}
+#endif
+
+class message;
+class thread_pool;
+
+namespace detail {
+struct serialize_plan;
+
+/**
+ * \brief appends into a slot of a preallocated buffer, for pieces of serialize_parallel()
+ */
+struct slot_writer
+{
+  char* pos;
+
+  void append(const char* data, std::size_t size)
+  {
+    std::memcpy(pos, data, size);
+    pos += size;
+  }
+
+  slot_writer& operator+=(const std::string& value)
+  {
+    append(value.data(), value.size());
+    return *this;
+  }
+};
+
+/**
+ * \brief collects the output of serialize() as spans, keys and small values are copied to scratch,
+ *   appended spans of min_bytes or more are values of the tree or its input and are pointed at
+ */
+struct span_writer
+{
+  struct span
+  {
+    const char* data;   // nullptr for bytes in scratch
+    std::size_t offset; // into scratch, it may grow while spans are added
+    std::size_t size;
+  };
+
+  std::string&      scratch;
+  std::vector<span> spans;
+  std::size_t       min_bytes;
+
+  void append(const char* data, std::size_t size)
+  {
+    if (size < min_bytes) return copy(data, size);
+    spans.push_back(span{data, 0, size});
+  }
+
+  span_writer& operator+=(const std::string& value)
+  {
+    copy(value.data(), value.size());
+    return *this;
+  }
+
+  void copy(const char* data, std::size_t size)
+  {
+    if (spans.empty() || spans.back().data) spans.push_back(span{nullptr, scratch.size(), 0});
+    scratch.append(data, size);
+    spans.back().size += size;
+  }
+};
+
+/**
+ * \brief one level of the iterative decoder, the root, a group or a speculative packed decode
+ */
+struct decode_frame
+{
+  const unsigned char* begin       = nullptr; // first byte of the frame
+  const unsigned char* pdata       = nullptr; // next byte to decode
+  std::size_t          length      = 0;       // bytes given to the frame
+  std::size_t          left        = 0;       // bytes not decoded yet
+  const unsigned char* field_begin = nullptr; // key of the field that opened the frame
+  int                  id          = 0;
+  int                  depth       = 0;
+  types                type        = type_undefined; // type_undefined root, type_group or type_packed
+  std::uint64_t        trace_begin = 0;
+  std::uint64_t        path        = 0;       // decode_hints key of the ids from the root
+  decode_hints::outcomes* hint     = nullptr; // outcomes of the path of a packed attempt
+};
+} // namespace detail
+
+/**
+ * \brief protobuf root field class
+ */
+class message
+{
+public:
+  types                               type_;
+  int                                 id_;
+  cow_list<message>                   childs_;        // sub fields or repeat field, shared between copies
+  small_vector<std::uint64_t, 1>      values_;        // varint, int32, int64 data store here
+  small_vector<std::string, 0>        binary_values_; // binary data store here
+  raw_span                            raw_;           // decoded bytes, copied verbatim by serialize() until modified
+
+  ////////////////////////////////////////////////////////////
+  message()
+    : type_(type_undefined)
+    , id_(0)
+  {}
+
+  message(types type, int id)
+    : type_(type)
+    , id_(id)
+  {}
+
+  message(types type, int id, std::uint64_t value)
+    : type_(type)
+    , id_(id)
+    , values_{value}
+  {}
+
+  message(types type, int id, const std::string& value)
+    : type_(type)
+    , id_(id)
+    , binary_values_{value}
+  {}
+
+  message(types type, int id, std::string&& value)
+    : type_(type)
+    , id_(id)
+  {
+    binary_values_.emplace_back(std::move(value));
+  }
+
+  message(types type, int id, const std::vector<std::uint32_t>& values)
+    : type_(type)
+    , id_(id)
+  {
+    append_value(values);
+  }
+
+  message(types type, int id, const std::vector<std::uint64_t>& values)
+    : type_(type)
+    , id_(id)
+  {
+    append_value(values);
+  }
+
+  message(types type, int id, const std::vector<std::string>& values)
+    : type_(type)
+    , id_(id)
+  {
+    append_value(values);
+  }
+
+  message(types type, int id, std::vector<std::string>&& values)
+    : type_(type)
+    , id_(id)
+  {
+    append_value(std::move(values));
+  }
+
+  message(types type, int id, const std::initializer_list<std::uint32_t>& values)
+    : type_(type)
+    , id_(id)
+  {
+    append_value(values);
+  }
+
+  message(types type, int id, const std::initializer_list<std::uint64_t>& values)
+    : type_(type)
+    , id_(id)
+  {
+    append_value(values);
+  }
+
+  message(types type, int id, const std::initializer_list<std::string>& values)
+    : type_(type)
+    , id_(id)
+  {
+    append_value(values);
+  }
+
+  explicit message(const std::vector<message>& fields)
+    : type_(type_undefined)
+    , id_(0)
+  {
+    append_child(fields);
+  }
+
+  explicit message(const std::list<message>& fields)
+    : type_(type_undefined)
+    , id_(0)
+  {
+    append_child(fields);
+  }
+
+  message(const std::initializer_list<message>& fields)
+    : type_(type_undefined)
+    , id_(0)
+  {
+    append_child(fields);
+  }
+
+  message(const message& obj)
+    : type_(obj.type_)
+    , id_(obj.id_)
+    , childs_(obj.childs_)
+    , values_(obj.values_)
+    , binary_values_(obj.binary_values_)
+    , raw_(obj.raw_)
+  {}
+
+  message(message&& obj) noexcept
+    : type_(obj.type_)
+    , id_(obj.id_)
+    , childs_(std::move(obj.childs_))
+    , values_(std::move(obj.values_))
+    , binary_values_(std::move(obj.binary_values_))
+    , raw_(std::move(obj.raw_))
+  {}
+
+  /**
+   * \brief release sub fields, trees deeper than MAX_RECURSIVE_RELEASE are released without recursion
+   */
+  ~message()
+  {
+    // a list shared with other copies is released by its last owner
+    if (!childs_.unique() || childs_.empty()) return;
+
+    static thread_local int _depth = 0;
+    if (_depth < MAX_RECURSIVE_RELEASE)
+    {
+      ++_depth;
+      childs_.clear();
+      --_depth;
+      return;
+    }
+
+    // depth first, the order the decoder allocated them
+    std::list<message> _pending;
+    _pending.splice(_pending.end(), childs_.list());
+    while (!_pending.empty())
+    {
+      std::list<message> _node;
+      _node.splice(_node.end(), _pending, _pending.begin());
+      auto& _childs = _node.front().childs_;
+      if (_childs.unique()) _pending.splice(_pending.begin(), _childs.list());
+    }
+  }
+
+  message& operator=(const message& obj)
+  {
+    if (&obj != this)
+    {
+      type_          = obj.type_;
+      id_            = obj.id_;
+      childs_        = obj.childs_;
+      values_        = obj.values_;
+      binary_values_ = obj.binary_values_;
+      raw_           = obj.raw_;
+    }
+    return *this;
+  }
+
+  message& operator=(message&& obj) noexcept
+  {
+    if (&obj != this)
+    {
+      type_          = obj.type_;
+      id_            = obj.id_;
+      childs_        = std::move(obj.childs_);
+      values_        = std::move(obj.values_);
+      binary_values_ = std::move(obj.binary_values_);
+      raw_           = std::move(obj.raw_);
+    }
+    return *this;
+  }
+
+  ////////////////////////////////////////////////////////////
+  void set_value(std::uint64_t value)
+  {
+    touch();
+    binary_values_.clear();
+    values_.clear();
+    values_.push_back(value);
+  }
+
+  void set_value(const std::string& value)
+  {
+    touch();
+    values_.clear();
+    binary_values_.clear();
+    binary_values_.emplace_back(value);
+  }
+
+  void set_value(std::string&& value)
+  {
+    touch();
+    values_.clear();
+    binary_values_.clear();
+    binary_values_.emplace_back(std::move(value));
+  }
+
+  ////////////////////////////////////////////////////////////
+  void set_value(const std::vector<std::uint32_t>& values)
+  {
+    touch();
+    binary_values_.clear();
+    values_.clear();
+    values_.reserve(values.size());
+    for (auto v : values)
+    {
+      values_.push_back(v);
+    }
+  }
+
+  void set_value(const std::vector<std::uint64_t>& values)
+  {
+    touch();
+    binary_values_.clear();
+    values_.clear();
+    values_.reserve(values.size());
+    for (auto v : values)
+    {
+      values_.push_back(v);
+    }
+  }
+
+  void set_value(const std::vector<std::string>& values)
+  {
+    touch();
+    values_.clear();
+    binary_values_.clear();
+    binary_values_.reserve(values.size());
+    for (const auto& f : values)
+    {
+      binary_values_.emplace_back(f);
+    }
+  }
+
+  void set_value(std::vector<std::string>&& values)
+  {
+    touch();
+    values_.clear();
+    binary_values_.clear();
+    binary_values_.reserve(values.size());
+    for (auto& f : values)
+    {
+      binary_values_.emplace_back(std::move(f));
+    }
+  }
+
+  ////////////////////////////////////////////////////////////
+  void set_value(const std::initializer_list<std::uint32_t>& values)
+  {
+    touch();
+    binary_values_.clear();
+    values_.clear();
+    values_.reserve(values.size());
+    for (auto v : values)
+    {
+      values_.push_back(v);
+    }
+  }
+
+  void set_value(const std::initializer_list<std::uint64_t>& values)
+  {
+    touch();
+    binary_values_.clear();
+    values_.clear();
+    values_.reserve(values.size());
+    for (auto v : values)
+    {
+      values_.push_back(v);
+    }
+  }
+
+  void set_value(const std::initializer_list<std::string>& values)
+  {
+    touch();
+    values_.clear();
+    binary_values_.clear();
+    binary_values_.reserve(values.size());
+    for (const auto& f : values)
+    {
+      binary_values_.emplace_back(f);
+    }
+  }
+
+  ////////////////////////////////////////////////////////////
+  void append_value(std::uint32_t value)
+  {
+    touch();
+    values_.push_back(value);
+  }
+
+  void append_value(std::uint64_t value)
+  {
+    touch();
+    values_.push_back(value);
+  }
+
+  void append_value(const std::string& value)
+  {
+    touch();
+    binary_values_.emplace_back(value);
+  }
+
+  void append_value(std::string&& value)
+  {
+    touch();
+    binary_values_.emplace_back(std::move(value));
+  }
+
+  ////////////////////////////////////////////////////////////
+  void append_value(const std::vector<std::uint32_t>& values)
+  {
+    touch();
+    values_.reserve(values.size());
+    for (auto v : values)
+    {
+      values_.push_back(v);
+    }
+  }
+
+  void append_value(const std::vector<std::uint64_t>& values)
+  {
+    touch();
+    values_.reserve(values.size());
+    for (auto v : values)
+    {
+      values_.push_back(v);
+    }
+  }
+
+  void append_value(const std::vector<std::string>& values)
+  {
+    touch();
+    binary_values_.reserve(values.size());
+    for (const auto& v : values)
+    {
+      binary_values_.emplace_back(v);
+    }
+  }
+
+  void append_value(std::vector<std::string>&& values)
+  {
+    touch();
+    binary_values_.reserve(values.size());
+    for (auto& v : values)
+    {
+      binary_values_.emplace_back(std::move(v));
+    }
+  }
+
+  ////////////////////////////////////////////////////////////
+  void append_value(const std::initializer_list<std::uint32_t>& values)
+  {
+    touch();
+    values_.reserve(values.size());
+    for (auto v : values)
+    {
+      values_.push_back(v);
+    }
+  }
+
+  void append_value(const std::initializer_list<std::uint64_t>& values)
+  {
+    touch();
+    values_.reserve(values.size());
+    for (auto v : values)
+    {
+      values_.push_back(v);
+    }
+  }
+
+  void append_value(const std::initializer_list<std::string>& values)
+  {
+    touch();
+    binary_values_.reserve(values.size());
+    for (const auto& v : values)
+    {
+      binary_values_.emplace_back(v);
+    }
+  }
+
+  ////////////////////////////////////////////////////////////
+  void set_child(const message& f)
+  {
+    touch();
+    childs_.clear();
+    this->id(f.id_) = f;
+  }
+
+  void set_child(message&& f)
+  {
+    touch();
+    childs_.clear();
+    childs_.emplace_back(std::move(f));
+  }
+
+  void set_child(const std::vector<message>& fields)
+  {
+    touch();
+    childs_.clear();
+    for (const auto& f : fields)
+    {
+      this->id(f.id_) = f;
+    }
+  }
+
+  void set_child(const std::list<message>& fields)
+  {
+    touch();
+    childs_.clear();
+    for (const auto& f : fields)
+    {
+      this->id(f.id_) = f;
+    }
+  }
+
+  void set_child(const std::initializer_list<message>& fields)
+  {
+    touch();
+    childs_.clear();
+    for (const auto& f : fields)
+    {
+      this->id(f.id_) = f;
+    }
+  }
+
+  ////////////////////////////////////////////////////////////
+  void append_child(const message& f) { append_child(message(f), nullptr); }
+
+  void append_child(message&& f) { append_child(std::move(f), nullptr); }
+
+  void append_child(const std::vector<message>& fields)
+  {
+    for (const auto& f : fields)
+    {
+      append_child(f);
+    }
+  }
+
+  void append_child(std::vector<message>&& fields)
+  {
+    for (auto& f : fields)
+    {
+      append_child(std::move(f), nullptr);
+    }
+  }
+
+  void append_child(const std::list<message>& fields)
+  {
+    for (const auto& f : fields)
+    {
+      append_child(f);
+    }
+  }
+
+  void append_child(const std::initializer_list<message>& fields)
+  {
+    for (const auto& f : fields)
+    {
+      append_child(f);
+    }
+  }
+
+  ////////////////////////////////////////////////////////////
+
+  std::uint64_t value() const { return values_.empty() ? 0 : values_[0]; }
+
+  const std::string& binary_value() const
+  {
+    static const std::string _empty;
+    return binary_values_.empty() ? _empty : binary_values_[0];
+  }
+
+  /**
+   * \brief bytes of a packed field, the kept copy, the decoded span or the sub fields encoded again
+   */
+  std::string payload() const
+  {
+    std::string _result;
+    append_payload(_result);
+    return _result;
+  }
+
+  void append_payload(std::string& result) const
+  {
+    if (!binary_values_.empty())
+    {
+      result += binary_values_[0];
+      return;
+    }
+
+    if (raw_)
+    {
+      auto _size = raw_payload_size();
+      result.append(raw_.source->data() + raw_.offset + raw_.size - _size, _size);
+      return;
+    }
+
+    for (const auto& f : childs_)
+    {
+      serialize(result, f);
+    }
+  }
+
+  /**
+   * \brief bytes of a packed field without a copy, the kept copy or the decoded span, null if neither exists
+   *   valid for payload_size() bytes until the field is modified
+   */
+  const char* payload_data() const
+  {
+    if (!binary_values_.empty()) return binary_values_[0].data();
+    if (raw_) return raw_.source->data() + raw_.offset + raw_.size - raw_payload_size();
+    return nullptr;
+  }
+
+  /**
+   * \brief payload().size() without building it
+   */
+  std::size_t payload_size() const
+  {
+    if (!binary_values_.empty()) return binary_values_[0].size();
+    if (raw_) return raw_payload_size();
+
+    std::size_t _size = 0;
+    for (const auto& f : childs_)
+    {
+      _size += calc_serialized_size(f, 2, 0);
+    }
+    return _size;
+  }
+
+  /**
+   * \brief binary value index read as packed repeated scalars of kind, see decode_packed()
+   *   a packed field without a kept copy reads its payload()
+   */
+  bool packed_values(packed_kinds kind, std::vector<std::uint64_t>& values, std::size_t index = 0) const
+  {
+    if (index < binary_values_.size())
+      return decode_packed(binary_values_[index].data(), binary_values_[index].size(), kind, values);
+    if (type_packed != type_ || 0 != index) return false;
+    if (raw_) return decode_packed(payload_data(), payload_size(), kind, values);
+
+    auto _payload = payload();
+    return decode_packed(_payload.data(), _payload.size(), kind, values);
+  }
+
+  bool is_repeat() const { return type_repeat == type_ || values_.size() > 1 || binary_values_.size() > 1; }
+
+  bool has(int id) const
+  {
+    for (auto& f : childs_)
+    {
+      if (id == f.id_) return true;
+    }
+    return false;
+  }
+
+  bool has_child() const { return !childs_.empty(); }
+
+  /**
+   * \brief hash of type, id, values and sub fields in order, equal trees hash equal
+   *   raw_ is not hashed, a decoded tree and a built one of the same content hash equal,
+   *   the value depends on byte order and is not meant to be stored
+   */
+  std::uint64_t hash() const { return hash(nullptr); }
+
+  /**
+   * \brief hash of the tree, the hash of every field is stored in hashes when not null
+   *   hash once, then compare any pair of sub trees in O(1)
+   */
+  std::uint64_t hash(std::unordered_map<const message*, std::uint64_t>* hashes) const
+  {
+    // post order without recursion, deep trees are hashed like flat ones
+    struct frame
+    {
+      const message*                    node;
+      cow_list<message>::const_iterator next;
+      std::uint64_t                     hash;
+    };
+
+    std::vector<frame> _stack;
+    _stack.push_back(frame{this, childs_.begin(), hash_fields()});
+    while (true)
+    {
+      auto& f = _stack.back();
+      if (f.node->childs_.end() != f.next)
+      {
+        const auto& _child = *f.next++;
+        _stack.push_back(frame{&_child, _child.childs_.begin(), _child.hash_fields()});
+        continue;
+      }
+
+      auto _hash = f.hash;
+      if (hashes) (*hashes)[f.node] = _hash;
+      _stack.pop_back();
+      if (_stack.empty()) return _hash;
+      _stack.back().hash = detail::hash_mix(_stack.back().hash, _hash);
+    }
+  }
+
+
+  message& at(size_t index)
+  {
+    // caller may modify the returned child
+    touch();
+
+    for (auto& f : childs_)
+    {
+      if (0 == index) return f;
+      --index;
+    }
+    // if not found, insert pad value first
+    while (index > 0) {
+      childs_.emplace_back(message{type_undefined, 0});
+      --index;
+    }
+    // insert it at index
+    childs_.emplace_back(message{type_undefined, 0});
+    return childs_.back();
+  }
+
+  message& id(int id)
+  {
+    // caller may modify the returned child
+    touch();
+
+    for (auto& f : childs_)
+    {
+      if (id == f.id_) return f;
+    }
+    // if not found, insert it
+    childs_.emplace_back(message{type_undefined, id});
+    return childs_.back();
+  }
+
+  message& operator[](int id) { return this->id(id); }
+
+  /**
+   * \brief mark this field modified, serialize() re-encode it instead of copy the decoded bytes
+   *   set_value, append_value, set_child, append_child, at and id call it, call it yourself
+   *   after change public members directly
+   */
+  void touch() noexcept
+  {
+    raw_.reset();
+  }
+
+  typedef void (*unspecified_bool_type)();
+  static void unspecified_bool_true() {}
+
+  operator unspecified_bool_type() const noexcept { return (type_undefined == type_) ? 0 : unspecified_bool_true; }
+
+  /**
+   * \brief serialize to binary
+   *   unmodified decoded fields are copied from the input bytes, only touched fields are re-encoded
+   * \return serialized binary protobuf data
+   */
+  std::string serialize() const
+  {
+    PROTO_TRACE_SCOPE("serialize");
+
+    std::string _result;
+    {
+      PROTO_TRACE_SCOPE("calc_serialized_size");
+      _result.reserve(calc_serialized_size(*this, 2, 0));
+    }
+    serialize(_result, *this);
+    return _result;
+  }
+
+#if !defined(_WIN32)
+  /**
+   * \brief serialize() as buffers for writev(), keys and small fields are copied to scratch,
+   *   binary values and unmodified decoded spans of min_bytes or more point into the tree and its input
+   *   the buffers are valid while the tree and scratch are not modified
+   * \param scratch out, the copied bytes
+   * \return buffers in output order
+   */
+  std::vector<iovec> serialize_iov(std::string& scratch, std::size_t min_bytes = IOV_MIN_BYTES) const
+  {
+    PROTO_TRACE_SCOPE("serialize_iov");
+
+    detail::span_writer _writer{scratch, {}, min_bytes};
+    scratch.clear();
+    serialize(_writer, *this);
+
+    std::vector<iovec> _result;
+    _result.reserve(_writer.spans.size());
+    for (const auto& s : _writer.spans)
+    {
+      auto _data = s.data ? s.data : scratch.data() + s.offset;
+      _result.push_back(iovec{const_cast<char*>(_data), s.size});
+    }
+    return _result;
+  }
+
+  /**
+   * \brief write serialize() to fd with writev(), large values go from the tree to the kernel without a copy
+   * \return all bytes written
+   */
+  bool serialize_to_fd(int fd, std::size_t min_bytes = IOV_MIN_BYTES) const
+  {
+    std::string _scratch;
+    return write_iov(fd, serialize_iov(_scratch, min_bytes));
+  }
+#endif
+
+  /**
+   * \brief serialize() with runs of sibling fields encoded on pool into their slots of one buffer, the same output
+   *   the offset of every field follows from the sizes of the fields before it, fields larger than a few pieces
+   *   have their keys written in place and their sub fields cut into pieces, defined in proto_parallel.hpp
+   * \param piece_bytes encoded bytes per task
+   */
+  std::string serialize_parallel(thread_pool& pool, std::size_t piece_bytes = SERIALIZE_PIECE_BYTES) const;
+
+  /**
+   * \brief deserialize protobuf from string
+   * \param input serialized binary protobuf data
+   * \param dec_pack_depth decode packed type depth
+   * \return true if all data valid, else return false
+   */
+  bool deserialize(const std::string& input, int dec_pack_depth = -1)
+  {
+    return deserialize(input, decode_options{dec_pack_depth});
+  }
+
+  /**
+   * \brief deserialize protobuf from string
+   *   decoded fields keep no span of input, serialize() encodes them again, the std::string&& and shared
+   *   buffer overloads keep spans and copy unmodified fields verbatim
+   * \param input serialized binary protobuf data
+   * \param options decode options
+   * \return true if all data valid, else return false
+   */
+  bool deserialize(const std::string& input, const decode_options& options)
+  {
+    std::size_t _length = input.size();
+    return deserialize(input.data(), &_length, options);
+  }
+
+  /**
+   * \brief deserialize protobuf from string, take over the input buffer without copy
+   * \param input serialized binary protobuf data
+   * \param dec_pack_depth decode packed type depth
+   * \return true if all data valid, else return false
+   */
+  bool deserialize(std::string&& input, int dec_pack_depth = -1)
+  {
+    return deserialize(std::move(input), decode_options{dec_pack_depth});
+  }
+
+  /**
+   * \brief deserialize protobuf from string, take over the input buffer without copy
+   * \param input serialized binary protobuf data
+   * \param options decode options
+   * \return true if all data valid, else return false
+   */
+  bool deserialize(std::string&& input, const decode_options& options)
+  {
+    std::size_t _length = input.size();
+    return deserialize(std::make_shared<const std::string>(std::move(input)), &_length, options);
+  }
+
+  /**
+   * \brief deserialize protobuf from shared buffer, decoded fields keep a reference to it
+   * \param input serialized binary protobuf data
+   * \param dec_pack_depth decode packed type depth
+   * \return true if all data valid, else return false
+   */
+  bool deserialize(const std::shared_ptr<const std::string>& input, int dec_pack_depth = -1)
+  {
+    return deserialize(input, decode_options{dec_pack_depth});
+  }
+
+  /**
+   * \brief deserialize protobuf from shared buffer, decoded fields keep a reference to it
+   * \param input serialized binary protobuf data
+   * \param options decode options
+   * \return true if all data valid, else return false
+   */
+  bool deserialize(const std::shared_ptr<const std::string>& input, const decode_options& options)
+  {
+    std::size_t _length = input->size();
+    return deserialize(input, &_length, options);
+  }
+
+  /**
+   * \brief deserialize protobuf from string, decoded fields keep no span of input
+   * \param input serialized binary protobuf data
+   * \param length input length, out processed length
+   * \param dec_pack_depth decode packed type depth
+   * \return true if all data valid, else return false
+   */
+  bool deserialize(const std::string& input, size_t* length, int dec_pack_depth = -1)
+  {
+    *length = std::min(*length, input.size());
+    return deserialize(input.data(), length, decode_options{dec_pack_depth});
+  }
+
+  /**
+   * \brief deserialize protobuf from string, decoded fields keep no span of input
+   * \param input serialized binary protobuf data
+   * \param length input length, out processed length
+   * \param dec_pack_depth decode packed type depth
+   * \return true if all data valid, else return false
+   */
+  bool deserialize(const void* input, size_t* length, int dec_pack_depth = -1)
+  {
+    return deserialize(input, length, decode_options{dec_pack_depth});
+  }
+
+  /**
+   * \brief deserialize protobuf from string, decoded fields keep no span of input
+   * \param input serialized binary protobuf data
+   * \param length input length, out processed length
+   * \param options decode options
+   * \return true if all data valid, else return false
+   */
+  bool deserialize(const void* input, size_t* length, const decode_options& options)
+  {
+    std::list<message> _spare;
+    return decode(nullptr, static_cast<const char*>(input), *length, length, options, _spare);
+  }
+
+  /**
+   * \brief deserialize protobuf from shared buffer
+   * \param input serialized binary protobuf data
+   * \param length input length, out processed length
+   * \param options decode options
+   * \return true if all data valid, else return false
+   */
+  bool deserialize(const std::shared_ptr<const std::string>& input, size_t* length, const decode_options& options)
+  {
+    return deserialize(input, 0, length, options);
+  }
+
+  /**
+   * \brief deserialize protobuf from part of a shared buffer, as one record of a stream
+   * \param input buffer holding serialized binary protobuf data
+   * \param offset first byte of the data in input
+   * \param length data length, out processed length
+   * \param options decode options
+   * \return true if all data valid, else return false
+   */
+  bool deserialize(
+    const std::shared_ptr<const std::string>& input, std::size_t offset, size_t* length, const decode_options& options)
+  {
+    std::list<message> _spare;
+    return decode_at(input, offset, length, options, _spare);
+  }
+
+  /**
+   * \brief deserialize into this message again, fields of the previous decode are reused
+   *   nodes, value buffers, strings and raw spans are overwritten in place, so a stream of records
+   *   of the same shape decodes without allocation once the first record has been decoded
+   * \param input buffer holding serialized binary protobuf data
+   * \param offset first byte of the data in input
+   * \param length data length, out processed length
+   * \param options decode options
+   * \return true if all data valid, else return false
+   */
+  bool deserialize_into_reuse(const std::shared_ptr<const std::string>& input, std::size_t offset, size_t* length,
+    const decode_options& options = decode_options{})
+  {
+    if (offset > input->size() || *length > input->size() - offset)
+    {
+      *length = 0;
+      if (options.error) *options.error = decode_malformed;
+      return false;
+    }
+    return decode_into_reuse(input, input->data() + offset, length, options);
+  }
+
+  /**
+   * \brief deserialize into this message again, fields of the previous decode are reused
+   *   decoded fields keep no span of input, use the shared buffer overload to copy them verbatim
+   * \param input serialized binary protobuf data
+   * \param options decode options
+   * \return true if all data valid, else return false
+   */
+  bool deserialize_into_reuse(const std::string& input, const decode_options& options = decode_options{})
+  {
+    std::size_t _length = input.size();
+    return decode_into_reuse(nullptr, input.data(), &_length, options);
+  }
+
+  /**
+   * \brief free the spare nodes, strings and decoder scratch the calling thread keeps for decoding
+   *   they are trimmed after every decode, this frees the rest, e.g. before the thread goes idle
+   */
+  static void release_thread_caches() { cache() = thread_cache(); }
+
+  /**
+   * \brief remove all fields and values, value buffers keep their capacity
+   *   deserialize_into_reuse keeps the field nodes too
+   */
+  void clear()
+  {
+    touch();
+    type_ = type_undefined;
+    childs_.clear();
+    values_.clear();
+    binary_values_.clear();
+  }
+
+private:
+  /**
+   * \brief decode into this message, the root of a deserialize call
+   * \param spare nodes new fields are taken from before allocating
+   */
+  bool decode_at(const std::shared_ptr<const std::string>& input, std::size_t offset, size_t* length,
+    const decode_options& options, std::list<message>& spare)
+  {
+    if (offset > input->size() || *length > input->size() - offset)
+    {
+      *length = 0;
+      if (options.error) *options.error = decode_malformed;
+      return false;
+    }
+    return decode(input, input->data() + offset, *length, length, options, spare);
+  }
+
+  /**
+   * \brief deserialize_into_reuse with the nodes of the previous decode as spare nodes
+   * \param source buffer holding data, nullptr to keep no spans
+   */
+  bool decode_into_reuse(const std::shared_ptr<const std::string>& source, const char* data, size_t* length,
+    const decode_options& options)
+  {
+    // nodes left over by the previous record are parked per thread, not freed
+    auto& _parked = cache().parked;
+
+    std::list<message> _spare;
+    recycle(_spare, childs_);
+    _spare.splice(_spare.end(), _parked);
+    values_.clear();
+    binary_values_.clear();
+
+    auto _result = decode(source, data, *length, length, options, _spare);
+
+    std::size_t _count = 0;
+    for (auto it = _spare.begin(); it != _spare.end();)
+    {
+      if (++_count > MAX_PARKED_NODES)
+      {
+        it = _spare.erase(it);
+        continue;
+      }
+      it->raw_.reset(); // do not keep the input buffer alive
+
+      // large buffers of one odd record are not kept
+      if (it->values_.capacity() > MAX_PARKED_VALUES) it->values_ = small_vector<std::uint64_t, 1>();
+      it->release_binary(1);
+      if (!it->binary_values_.empty() && it->binary_values_[0].capacity() > MAX_PARKED_STRING)
+        it->binary_values_.clear();
+      ++it;
+    }
+    _parked.splice(_parked.end(), _spare);
+    return _result;
+  }
+
+  /**
+   * \brief decode size bytes at data into this message
+   * \param source buffer holding data, decoded fields keep spans in it, nullptr to keep none
+   * \param length out processed length
+   */
+  bool decode(const std::shared_ptr<const std::string>& source, const char* data, std::size_t size, size_t* length,
+    const decode_options& options, std::list<message>& spare)
+  {
+    PROTO_TRACE_SCOPE("deserialize");
+
+    // only a fresh root covers exactly the input bytes
+    bool _fresh = (type_undefined == type_ && childs_.empty());
+    auto _begin = std::chrono::steady_clock::now();
+    if (!_fresh) touch();
+
+    decode_errors _error;
+    auto          result = deserialize(*this, source, data, size, options, spare, _error);
+    *length              = std::get<1>(result);
+    if (options.error) *options.error = _error;
+
+    auto& _cache = cache();
+    detail::trim_cache(_cache.frames);
+    detail::trim_cache(_cache.nodes);
+    detail::trim_cache(_cache.saved);
+
+    if (_fresh)
+    {
+      if (std::get<0>(result) && source)
+        set_raw(source, std::size_t(data - source->data()), *length);
+      else
+        raw_.reset();
+    }
+
+    if (options.stats)
+    {
+      options.stats->decode_ns += std::uint64_t(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _begin).count());
+    }
+    return std::get<0>(result);
+  }
+
+  /**
+   * \brief append_child, count new nodes and repeat conversions into stats
+   */
+  void append_child(message&& f, decode_stats* stats)
+  {
+    touch();
+
+    std::list<message> _node;
+    std::list<message> _spare;
+    _node.emplace_back(std::move(f));
+    adopt_child(_node, _spare, stats);
+  }
+
+  /**
+   * \brief move the single node of list into childs_, or merge it into the field of the same id
+   *   nodes left over by a merge go to spare, this field is not touched
+   */
+  void adopt_child(std::list<message>& node, std::list<message>& spare, decode_stats* stats)
+  {
+    auto& f       = node.front();
+    auto& _childs = childs_.list();
+
+    auto _field = _childs.begin();
+    while (_field != _childs.end() && f.id_ != _field->id_)
+    {
+      ++_field;
+    }
+
+    // id not exits, append
+    if (_childs.end() == _field)
+    {
+      _childs.splice(_childs.end(), node);
+      if (stats) ++stats->node_allocations;
+      return;
+    }
+
+    // else id exits, repeat field
+
+    switch (_field->type_)
+    {
+    case type_varint:
+    case type_int32:
+    case type_int64:
+    {
+      _field->touch();
+      for (auto v : f.values_)
+      {
+        _field->values_.push_back(v);
+      }
+      recycle(spare, node);
+      break;
+    }
+    case type_binary:
+    {
+      _field->touch();
+      if (type_packed == f.type_ && f.binary_values_.empty())
+      {
+        // a packed field decoded without a copy of its bytes
+        _field->binary_values_.emplace_back(f.payload());
+      }
+      for (auto& v : f.binary_values_)
+      {
+        _field->binary_values_.emplace_back(std::move(v));
+      }
+      recycle(spare, node);
+      break;
+    }
+    case type_group:
+    case type_packed:
+    {
+      // move the existing field under a new repeat node, no subtree is copied
+      auto  _repeat = take_node(spare, type_repeat, f.id_);
+      auto& _items  = _repeat.front().childs_.list();
+      _items.splice(_items.end(), _childs, _field++);
+      _items.splice(_items.end(), node);
+      _childs.splice(_field, _repeat);
+      if (stats)
+      {
+        ++stats->repeat_conversions;
+        stats->node_allocations += 2;
+      }
+      break;
+    }
+    case type_repeat:
+    {
+      auto& _items = _field->childs_.list();
+      _items.splice(_items.end(), node);
+      if (stats) ++stats->node_allocations;
+      break;
+    }
+    default:
+      recycle(spare, node);
+      break;
+    }
+  }
+
+  /**
+   * \brief payload bytes at the end of the span of a decoded packed field, after its key and length
+   */
+  std::size_t raw_payload_size() const
+  {
+    auto          _data = reinterpret_cast<const unsigned char*>(raw_.source->data() + raw_.offset);
+    std::uint64_t _key, _length = 0;
+    auto          _key_size = decode_varint(_data, raw_.size, _key);
+    decode_varint(_data + _key_size, raw_.size - _key_size, _length);
+    return std::size_t(_length);
+  }
+
+  /**
+   * \brief hash of type, id and values, the start of hash() for this field
+   */
+  std::uint64_t hash_fields() const
+  {
+    auto _hash = detail::hash_mix(std::uint64_t(type_), std::uint64_t(std::uint32_t(id_)));
+
+    _hash = detail::hash_mix(_hash, values_.size());
+    for (auto v : values_)
+    {
+      _hash = detail::hash_mix(_hash, v);
+    }
+
+    // the bytes of a packed field are its sub fields, the same whether a copy is kept or not
+    if (type_packed == type_) return detail::hash_mix(_hash, childs_.size());
+
+    _hash = detail::hash_mix(_hash, binary_values_.size());
+    for (const auto& v : binary_values_)
+    {
+      _hash = detail::hash_mix(_hash, detail::hash_bytes(v.data(), v.size()));
+    }
+    return detail::hash_mix(_hash, childs_.size());
+  }
+
+  /**
+   * \brief spare nodes and strings and decoder scratch, kept per thread so decode loops do not allocate
+   *   trimmed after each decode, release_thread_caches() frees them
+   */
+  struct thread_cache
+  {
+    std::list<message>                parked;  // spare nodes between deserialize_into_reuse calls
+    std::vector<std::string>          strings; // spare strings for set_binary
+    std::vector<detail::decode_frame> frames;  // open frames, root first
+    std::vector<std::list<message>>   nodes;   // node of each frame, the root frame decodes into msg
+    std::vector<decode_stats>         saved;   // stats before each open speculative packed decode
+  };
+
+  static thread_cache& cache()
+  {
+    static thread_local thread_cache _cache;
+    return _cache;
+  }
+
+  /**
+   * \brief list holding one node for a decoded field, taken from spare when there is one
+   *   a spare node keeps its value buffers, binary and packed nodes also keep their strings
+   *   and group and packed nodes their raw span, callers overwrite them
+   */
+  static std::list<message> take_node(std::list<message>& spare, types type, int id)
+  {
+    std::list<message> _node;
+    if (spare.empty())
+    {
+      _node.emplace_back(type, id);
+      return _node;
+    }
+
+    _node.splice(_node.end(), spare, spare.begin());
+    auto& f = _node.front();
+    f.type_ = type;
+    f.id_   = id;
+    f.values_.clear();
+    if (type_binary != type && type_packed != type) f.release_binary(0);
+    if (type_group != type && type_packed != type) f.raw_.reset();
+    return _node;
+  }
+
+  /**
+   * \brief move nodes and all their sub fields to the front of spare, flattened depth first
+   */
+  static void recycle(std::list<message>& spare, std::list<message>& nodes)
+  {
+    for (auto it = nodes.begin(); it != nodes.end(); ++it)
+    {
+      // sub fields shared with a copy stay with it
+      if (it->childs_.unique())
+        nodes.splice(std::next(it), it->childs_.list());
+      else
+        it->childs_.clear();
+    }
+    spare.splice(spare.begin(), nodes);
+  }
+
+  static void recycle(std::list<message>& spare, cow_list<message>& nodes)
+  {
+    if (nodes.unique())
+      recycle(spare, nodes.list());
+    else
+      nodes.clear();
+  }
+
+  /**
+   * \brief hold a copy of payload as the only binary value, reuse the string kept from a previous decode
+   */
+  void set_binary(const unsigned char* payload, std::size_t size, decode_stats* stats)
+  {
+    using std_string_elem_t = const std::string::value_type*;
+    auto& _strings = cache().strings;
+    release_binary(1);
+    if (binary_values_.empty())
+    {
+      if (_strings.empty())
+      {
+        binary_values_.emplace_back();
+      }
+      else
+      {
+        binary_values_.emplace_back(std::move(_strings.back()));
+        _strings.pop_back();
+      }
+    }
+
+    if (stats && size > binary_values_[0].capacity()) ++stats->binary_allocations;
+    binary_values_[0].assign(std_string_elem_t(payload), size);
+  }
+
+  /**
+   * \brief drop binary values after the first keep, small strings are kept per thread for set_binary
+   */
+  void release_binary(std::size_t keep)
+  {
+    auto& _strings = cache().strings;
+    while (binary_values_.size() > keep)
+    {
+      auto& _last = binary_values_.back();
+      if (_last.capacity() <= MAX_PARKED_STRING && _strings.size() < MAX_PARKED_NODES)
+      {
+        _strings.push_back(std::move(_last));
+      }
+      binary_values_.pop_back();
+    }
+  }
+
+
+  /**
+   * \brief point raw_ at decoded bytes
+   */
+  void set_raw(const std::shared_ptr<const std::string>& source, std::size_t offset, std::size_t size)
+  {
+    raw_.source = source;
+    raw_.offset = offset;
+    raw_.size   = size;
+  }
+
+  /**
+   * \brief convert to protobuf field key
+   */
+  inline std::string encode_key(types type, int id) const
+  {
+    auto _key = (std::uint64_t(id) << 3) | std::uint64_t(type);
+    return encode_varint(_key);
+  }
+
+  int calc_varint_encoded_size(std::uint64_t num) const
+  {
+    // 7 bits per byte, up to the highest set bit
+    int _size = 1;
+    while (num > 0x7f)
+    {
+      num >>= 7;
+      ++_size;
+    }
+    return _size;
+  }
+
+  int calc_key_encoded_size(int id) const
+  {
+    // the wire type takes the low 3 bits of the key
+    return calc_varint_encoded_size(std::uint64_t(id) << 3);
+  }
+
+  std::size_t calc_serialized_size(const message& msg, int indent, int leftspace) const
+  {
+    if (msg.raw_) return msg.raw_.size;
+
+    std::size_t _totalsize     = 0;
+    auto        _cur_leftspace = leftspace + indent;
+
+    switch (msg.type_)
+    {
+    case type_varint:
+    {
+      for (const auto& value : msg.values_)
+      {
+        std::ignore = value;
+        _totalsize += calc_key_encoded_size(msg.id_);
+        _totalsize += calc_varint_encoded_size(value);
+      }
+      break;
+    }
+    case type_int32:
+    {
+      for (const auto& value : msg.values_)
+      {
+        std::ignore = value;
+        _totalsize += calc_key_encoded_size(msg.id_);
+        _totalsize += INT32_BYTES;
+      }
+      break;
+    }
+    case type_int64:
+    {
+      for (const auto& value : msg.values_)
+      {
+        std::ignore = value;
+        _totalsize += calc_key_encoded_size(msg.id_);
+        _totalsize += INT64_BYTES;
+      }
+      break;
+    }
+    case type_binary:
+    {
+      for (const auto& value : msg.binary_values_)
+      {
+        _totalsize += calc_key_encoded_size(msg.id_);
+        _totalsize += calc_varint_encoded_size(value.size());
+        _totalsize += value.size();
+      }
+      break;
+    }
+    case type_group:
+    {
+      _totalsize += calc_key_encoded_size(msg.id_) * 2;
+
+      for (const auto& f : msg.childs_)
+      {
+        _totalsize += calc_serialized_size(f, indent, _cur_leftspace);
+      }
+
+      break;
+    }
+    case type_packed:
+    {
+      _totalsize += calc_key_encoded_size(msg.id_);
+
+      std::size_t _subsize = 0;
+      for (const auto& f : msg.childs_)
+      {
+        _subsize += calc_serialized_size(f, indent, _cur_leftspace);
+      }
+      _totalsize += calc_varint_encoded_size(_subsize);
+      _totalsize += _subsize;
+      break;
+    }
+    case type_repeat:
+    case type_undefined:
+    {
+      for (const auto& f : msg.childs_)
+      {
+        _totalsize += calc_serialized_size(f, indent, _cur_leftspace - 2);
+      }
+      break;
+    }
+    default:;
+    }
+
+    return _totalsize;
+  }
+
+  /**
+   * \brief calc_serialized_size() if it is below limit, limit otherwise, group, packed and repeat fields stop
+   *   counting at limit
+   */
+  std::size_t calc_serialized_size_below(const message& msg, std::size_t limit) const
+  {
+    auto _counted = type_group == msg.type_ || type_packed == msg.type_ || type_repeat == msg.type_
+                    || type_undefined == msg.type_;
+    if (msg.raw_ || msg.childs_.empty() || !_counted) return calc_serialized_size(msg, 2, 0);
+
+    std::size_t _size = 0;
+    for (const auto& f : msg.childs_)
+    {
+      _size += calc_serialized_size_below(f, limit - _size);
+      if (_size >= limit) return limit;
+    }
+
+    if (type_group == msg.type_)
+      _size += 2 * std::size_t(calc_key_encoded_size(msg.id_));
+    else if (type_packed == msg.type_)
+      _size += std::size_t(calc_key_encoded_size(msg.id_)) + std::size_t(calc_varint_encoded_size(_size));
+    return _size < limit ? _size : limit;
+  }
+
+  /**
+   * \brief lay out msg at offset for serialize_parallel(), sub field sizes are found on pool
+   *   fields at or over the size of 4 pieces are laid out in turn, so every size is counted about once,
+   *   defined in proto_parallel.hpp
+   * \return encoded size of msg
+   */
+  std::size_t plan_serialize(detail::serialize_plan& plan, thread_pool& pool, const message& msg, std::size_t offset) const;
+
+  /**
+   * \brief encode to protobuf, append to result, a std::string, a detail::slot_writer or a detail::span_writer
+   *   append() gets bytes of the tree or its input, operator+= gets encoded keys and lengths
+   */
+  template<typename Out>
+  void serialize(Out& result, const message& msg) const
+  {
+    // unmodified decoded field, copy the original bytes
+    if (msg.raw_)
+    {
+      result.append(msg.raw_.source->data() + msg.raw_.offset, msg.raw_.size);
+      return;
+    }
+
+    switch (msg.type_)
+    {
+    case type_varint:
+    {
+      for (const auto& value : msg.values_)
+      {
+        result += encode_key(msg.type_, msg.id_);
+        result += encode_varint(value);
+      }
+      break;
+    }
+    case type_int32:
+    {
+      for (const auto& value : msg.values_)
+      {
+        using const_char_ptr = const char*;
+        result += encode_key(msg.type_, msg.id_);
+        result.append(const_char_ptr(&value), INT32_BYTES);
+      }
+      break;
+    }
+    case type_int64:
+    {
+      for (const auto& value : msg.values_)
+      {
+        using char_ptr = const char*;
+        result += encode_key(msg.type_, msg.id_);
+        result.append(char_ptr(&value), INT64_BYTES);
+      }
+      break;
+    }
+    case type_binary:
+    {
+      for (const auto& value : msg.binary_values_)
+      {
+        std::uint64_t _value_size = value.size();
+        result += encode_key(msg.type_, msg.id_);
+        result += encode_varint(_value_size);
+        result.append(value.data(), value.size());
+      }
+      break;
+    }
+    case type_group:
+    {
+      result += encode_key(msg.type_, msg.id_);
+      for (const auto& f : msg.childs_)
+      {
+        serialize(result, f);
+      }
+      result += encode_key(type_end, msg.id_);
+      break;
+    }
+    case type_packed:
+    {
+      std::uint64_t _message_size = 0;
+      for (const auto& f : msg.childs_)
+      {
+        _message_size += calc_serialized_size(f, 2, 0);
+      }
+
+      result += encode_key(type_binary, msg.id_);
+      result += encode_varint(_message_size);
+      for (const auto& f : msg.childs_)
+      {
+        serialize(result, f);
+      }
+      break;
+    }
+    case type_repeat:
+    case type_undefined:
+    {
+      for (const auto& f : msg.childs_)
+      {
+        serialize(result, f);
+      }
+      break;
+    }
+    default:;
+    }
+  }
+
+  /**
+   * \brief deserialize protobuf from string, groups and speculative packed decodes are kept on a heap stack
+   * \param source buffer holding input, decoded group and packed fields keep their span in it, or nullptr
+   * \param spare nodes new fields are taken from before allocating
+   * \param error out, why decode stopped
+   * \return { bool success, used_size, left_size }
+   */
+  std::tuple<bool, std::size_t, std::size_t> deserialize(message& msg, const std::shared_ptr<const std::string>& source,
+    const void* input, const std::size_t length, const decode_options& options, std::list<message>& spare,
+    decode_errors& error)
+  {
+    using frame_t = detail::decode_frame;
+
+    auto _stats = options.stats;
+    auto _pbase = reinterpret_cast<const unsigned char*>(source ? source->data() : nullptr);
+
+    // kept per thread, a decode loop does not allocate them again
+    auto&         _frames = cache().frames;
+    auto&         _nodes  = cache().nodes;
+    auto&         _saved  = cache().saved;
+    std::uint64_t _work   = 0;
+
+    _frames.clear();
+    _nodes.clear();
+    _saved.clear();
+
+    error = decode_ok;
+
+    auto _open = [&](types type, int id, const unsigned char* field_begin, const unsigned char* begin,
+                   std::size_t size, int depth) {
+      frame_t _frame;
+      _frame.begin       = begin;
+      _frame.pdata       = begin;
+      _frame.length      = size;
+      _frame.left        = size;
+      _frame.field_begin = field_begin;
+      _frame.id          = id;
+      _frame.depth       = depth;
+      _frame.type        = type;
+      _frame.trace_begin = PROTO_TRACE_BEGIN();
+      if (options.hints && !_frames.empty()) _frame.path = decode_hints::path_key(_frames.back().path, id);
+      if (_stats)
+      {
+        if (depth > _stats->max_depth) _stats->max_depth = depth;
+        if (type_packed == type)
+        {
+          ++_stats->packed_attempts;
+          _saved.push_back(*_stats);
+        }
+      }
+      _frames.push_back(_frame);
+      if (type_undefined == type)
+        _nodes.emplace_back();
+      else
+        _nodes.push_back(take_node(spare, type, id));
+    };
+
+    auto _over_budget = [&]() { return options.work_budget && _work > options.work_budget; };
+
+    _open(type_undefined, 0, static_cast<const unsigned char*>(input), static_cast<const unsigned char*>(input), length,
+      1);
+
+    for (;;)
+    {
+      bool _ok     = true;
+      bool _opened = false;
+
+      // decode fields of the innermost frame until it ends or opens a child frame
+      {
+        auto  _index = _frames.size() - 1;
+        auto& _frame = _frames[_index];
+        auto& _msg   = (0 == _index) ? msg : _nodes[_index].front();
+        auto  _pdata = _frame.pdata;
+        auto  _left  = _frame.left;
+        auto  _depth = _frame.depth;
+
+        if (0 == _frame.length) _ok = false;
+
+        while (_ok && _left > 0)
+        {
+          auto _field_begin = _pdata;
+
+          // get key
+          std::uint64_t _key;
+          {
+            auto _size = decode_varint(_pdata, _left, _key);
+            if (0 == _size)
+            {
+              _ok = false;
+              break;
+            }
+
+            _pdata += _size;
+            _left -= _size;
+          }
+
+          if ((_key >> 3) > std::uint64_t(MAX_FIELD_NUMBER))
+          {
+            _ok = false;
+            break;
+          }
+
+          // extra id and type
+          auto _id    = int(_key >> 3);
+          auto _itype = int(_key & 7);
+
+          if (!(_itype >= 0 && _itype < int(type_undefined)))
+          {
+            _ok = false;
+            break;
+          }
+
+          auto _type = types(_itype);
+
+          if (0 == _left && !(type_group == _msg.type_ && type_end == _type))
+          {
+            _ok = false;
+            break;
+          }
+
+          bool _closed = false;
+
+          switch (_type)
+          {
+          case type_varint:
+          {
+            std::uint64_t _value;
+            {
+              auto _size = decode_varint(_pdata, _left, _value);
+              if (0 == _size)
+              {
+                _ok = false;
+                break;
+              }
+
+              _pdata += _size;
+              _left -= _size;
+            }
+            auto _node = take_node(spare, type_varint, _id);
+            _node.front().values_.push_back(_value);
+            _msg.adopt_child(_node, spare, _stats);
+            break;
+          }
+          case type_int64:
+          {
+            if (_left < sizeof(std::uint64_t))
+            {
+              _ok = false;
+              break;
+            }
+
+            std::uint64_t _value;
+            std::memcpy(&_value, _pdata, sizeof(_value)); // fields are not aligned, little endian hosts
+            _pdata += sizeof(std::uint64_t);
+            _left -= sizeof(std::uint64_t);
+
+            auto _node = take_node(spare, type_int64, _id);
+            _node.front().values_.push_back(_value);
+            _msg.adopt_child(_node, spare, _stats);
+            break;
+          }
+          case type_binary:
+          {
+            std::size_t _binary_length;
+            {
+              std::uint64_t _binary_length_u64;
+              auto          _size = decode_varint(_pdata, _left, _binary_length_u64);
+              if (0 == _size)
+              {
+                _ok = false;
+                break;
+              }
+
+              _pdata += _size;
+              _left -= _size;
+
+              // compare before narrowing, size_t may be 32 bits
+              if (_binary_length_u64 > _left)
+              {
+                _ok = false;
+                break;
+              }
+              _binary_length = std::size_t(_binary_length_u64);
+            }
+
+            // try dec packed message, the field is appended when the attempt frame closes
+            if ((-1 == options.dec_pack_depth || _depth <= options.dec_pack_depth)
+                && (0 == options.max_depth || _depth < options.max_depth)
+                && !detail::skip_packed_attempt(_pdata, _binary_length, options))
+            {
+              // a path that keeps failing is scanned first, the scan may rule the attempt out
+              auto _hint = options.hints ? &options.hints->at(decode_hints::path_key(_frame.path, _id)) : nullptr;
+              if (!_hint || !_hint->expect_failure() || detail::may_be_message(_pdata, _binary_length))
+              {
+                _frame.pdata = _pdata;
+                _frame.left  = _left;
+                _open(type_packed, _id, _field_begin, _pdata, _binary_length, _depth + 1);
+                _frames.back().hint = _hint;
+                _opened = true;
+                break;
+              }
+
+              _hint->record(false, _pdata, _binary_length);
+              if (_stats) ++_stats->packed_hint_skips;
+            }
+
+            auto _node = take_node(spare, type_binary, _id);
+            _node.front().set_binary(_pdata, _binary_length, _stats);
+            _msg.adopt_child(_node, spare, _stats);
+            _pdata += _binary_length;
+            _left -= _binary_length;
+            break;
+          }
+          case type_group:
+          {
+            if (0 != options.max_depth && _depth >= options.max_depth)
+            {
+              error = decode_depth_exceeded;
+              _ok   = false;
+              break;
+            }
+
+            _work += std::uint64_t(_pdata - _field_begin);
+            _frame.pdata = _pdata;
+            _frame.left  = _left;
+            _open(type_group, _id, _field_begin, _pdata, _left, _depth + 1);
+            _opened = true;
+            break;
+          }
+          case type_end:
+          {
+            _closed = (_msg.type_ == type_group);
+            break;
+          }
+          case type_int32:
+          {
+            if (_left < sizeof(std::uint32_t))
+            {
+              _ok = false;
+              break;
+            }
+
+            std::uint32_t _value;
+            std::memcpy(&_value, _pdata, sizeof(_value)); // fields are not aligned, little endian hosts
+            _pdata += sizeof(std::uint32_t);
+            _left -= sizeof(std::uint32_t);
+
+            auto _node = take_node(spare, type_int32, _id);
+            _node.front().values_.push_back(_value);
+            _msg.adopt_child(_node, spare, _stats);
+            break;
+          }
+          default:
+            _ok = false;
+            break;
+          }
+
+          // _frame is not valid after a child frame opened
+          if (_opened || !_ok) break;
+
+          if (_stats)
+          {
+            ++_stats->fields[_itype];
+            _stats->bytes[_itype] += std::uint64_t(_pdata - _field_begin);
+          }
+
+          _work += std::uint64_t(_pdata - _field_begin);
+          if (_over_budget())
+          {
+            error = decode_budget_exceeded;
+            _ok   = false;
+            break;
+          }
+
+          if (_closed) break;
+        }
+
+        if (!_opened)
+        {
+          _frame.pdata = _pdata;
+          _frame.left  = _left;
+        }
+      }
+
+      if (_opened) continue;
+
+      // close frames, hand each result to its parent until one can go on decoding
+      for (;;)
+      {
+        auto _index = _frames.size() - 1;
+        auto _child = _frames[_index];
+
+        if (0 == _index)
+        {
+          if (!_ok && decode_ok == error) error = decode_malformed;
+          if (_stats) _stats->work_bytes += _work;
+          return std::make_tuple(_ok, std::size_t(_child.pdata - _child.begin), _child.left);
+        }
+
+        auto _node = std::move(_nodes[_index]);
+        _frames.pop_back();
+        _nodes.pop_back();
+
+        auto& _parent = _frames.back();
+        auto& _msg    = (1 == _index) ? msg : _nodes.back().front();
+        auto& f       = _node.front();
+
+        if (type_group == _child.type)
+        {
+          PROTO_TRACE_END("group", "depth", _child.depth, _child.trace_begin);
+
+          // a broken group breaks the parent
+          if (!_ok)
+          {
+            recycle(spare, _node);
+            continue;
+          }
+
+          if (source)
+            f.set_raw(source, std::size_t(_child.field_begin - _pbase), std::size_t(_child.pdata - _child.field_begin));
+          _parent.pdata = _child.pdata;
+          _parent.left  = _child.left;
+          _msg.adopt_child(_node, spare, _stats);
+
+          if (_stats)
+          {
+            ++_stats->fields[type_group];
+            _stats->bytes[type_group] += std::uint64_t(_child.pdata - _child.field_begin);
+          }
+          break;
+        }
+
+        // speculative packed decode
+        PROTO_TRACE_END("packed_attempt", "bytes", _child.length, _child.trace_begin);
+
+        decode_stats _before;
+        if (_stats)
+        {
+          _before = _saved.back();
+          _saved.pop_back();
+        }
+
+        // out of budget, give up instead of keeping the bytes as binary
+        if (!_ok && decode_budget_exceeded == error)
+        {
+          recycle(spare, _node);
+          continue;
+        }
+
+        if (_child.hint) _child.hint->record(_ok, _child.begin, _child.length);
+        if (_ok)
+        {
+          if (_stats) ++_stats->packed_successes;
+        }
+        else
+        {
+          // keep the bytes as binary, nodes of the attempt can be used by later fields
+          f.type_ = type_binary;
+          f.raw_.reset();
+          recycle(spare, f.childs_);
+
+          error = decode_ok;
+          if (_stats)
+          {
+            _stats->rollback_fields(_before);
+            _stats->packed_wasted_bytes += std::uint64_t(_child.pdata - _child.begin);
+          }
+        }
+
+        _parent.pdata = _child.begin + _child.length;
+        _parent.left -= _child.length;
+
+        if (type_packed == f.type_ && source)
+        {
+          f.set_raw(source, std::size_t(_child.field_begin - _pbase), std::size_t(_parent.pdata - _child.field_begin));
+        }
+        // without a source buffer the copy is the only record of the bytes, sub fields encoded again may differ
+        if (type_packed == f.type_ && !options.packed_copies && source)
+          f.release_binary(0);
+        else
+          f.set_binary(_child.begin, _child.length, _stats);
+        _msg.adopt_child(_node, spare, _stats);
+
+        if (_stats)
+        {
+          ++_stats->fields[type_binary];
+          _stats->bytes[type_binary] += std::uint64_t(_parent.pdata - _child.field_begin);
+        }
+
+        _work += std::uint64_t(_parent.pdata - _child.field_begin);
+        if (_over_budget())
+        {
+          error = decode_budget_exceeded;
+          _ok   = false;
+          continue;
+        }
+
+        _ok = true;
+        break;
+      }
+    }
+  }
+
+};
+
+/**
+ * \brief read only handle to a decoded tree shared between threads
+ *   copies and sub field handles share the tree and keep all of it alive, copying is O(1)
+ *   the tree is never modified, so threads read it concurrently without locking
+ *   unmodified fields keep raw spans into the shared input buffer, serialize() copies from it
+ */
+class frozen_message
+{
+public:
+  frozen_message() = default;
+
+  /**
+   * \brief take over a tree, msg is left empty
+   */
+  explicit frozen_message(message&& msg)
+    : node_(std::make_shared<const message>(std::move(msg)))
+  {}
+
+  /**
+   * \brief decode input into a new shared tree
+   * \param input buffer holding serialized binary protobuf data, kept alive by the tree
+   * \param options decode options
+   * \return true if all data valid, else return false, the tree holds the fields decoded so far
+   */
+  bool deserialize(const std::shared_ptr<const std::string>& input, const decode_options& options = decode_options{})
+  {
+    message _msg;
+    auto    _result = _msg.deserialize(input, options);
+    node_           = std::make_shared<const message>(std::move(_msg));
+    return _result;
+  }
+
+  ////////////////////////////////////////////////////////////
+  const message& operator*() const { return node_ ? *node_ : empty(); }
+  const message* operator->() const { return &**this; }
+
+  explicit operator bool() const noexcept { return node_ && type_undefined != node_->type_; }
+
+  /**
+   * \brief handle to a sub field sharing this tree
+   * \return empty handle if id not exists
+   */
+  frozen_message id(int id) const
+  {
+    if (node_)
+    {
+      for (const auto& f : node_->childs_)
+      {
+        if (id == f.id_) return frozen_message(node_, f);
+      }
+    }
+    return frozen_message();
+  }
+
+  frozen_message operator[](int id) const { return this->id(id); }
+
+  /**
+   * \brief handle to the sub field at index sharing this tree
+   * \return empty handle if index out of range
+   */
+  frozen_message at(std::size_t index) const
+  {
+    if (node_)
+    {
+      for (const auto& f : node_->childs_)
+      {
+        if (0 == index--) return frozen_message(node_, f);
+      }
+    }
+    return frozen_message();
+  }
+
+  /**
+   * \brief copy for modification, sub fields stay shared with the frozen tree until modified
+   */
+  message thaw() const { return **this; }
+
+  std::string serialize() const { return (**this).serialize(); }
+
+  /**
+   * \brief handles sharing this tree, the root included
+   */
+  long use_count() const noexcept { return node_.use_count(); }
+
+private:
+  frozen_message(const std::shared_ptr<const message>& owner, const message& node)
+    : node_(owner, &node)
+  {}
+
+  static const message& empty()
+  {
+    static const message _empty;
+    return _empty;
+  }
+
+  std::shared_ptr<const message> node_; // aliases a node of the tree owned by the root
+};
+
+/**
+ * \brief one field of a flat_message
+ */
+struct flat_node
+{
+  std::uint64_t value; // varint, int32 or int64 value, or offset of the binary bytes in the buffer
+  std::uint32_t end;   // index one past the sub fields, the next field of the same parent
+  std::uint32_t size;  // binary bytes, packed fields included
+  std::int32_t  id;
+  types         type;
+};
+
+/**
+ * \brief decoded tree stored as one array of nodes in pre-order, like a tape
+ *   fields keep input order and a repeated field has one node per occurrence, there are no repeat nodes
+ *   binary values are offsets into the shared input buffer, decoding allocates nothing per field
+ *   walking the array front to back visits the tree, the printers and serialize() do only that
+ *   node counts and binary sizes are limited to 32 bits, larger input does not decode
+ */
+class flat_message
+{
+public:
+  flat_message() = default;
+
+  /**
+   * \brief flatten a message tree, values of a field and items of a repeat field become one node each
+   */
+  explicit flat_message(const message& msg)
+  {
+    auto _pool = std::make_shared<std::string>();
+
+    // pre-order, a repeat field or a padding field adds no node, its items become nodes of its parent
+    struct frame
+    {
+      const message*                    msg;
+      cow_list<message>::const_iterator next;
+      std::size_t                       node; // node to close after the sub fields, npos if none
+    };
+    const auto         _none = std::size_t(-1);
+    std::vector<frame> _stack;
+
+    auto _push = [&](const message& f, bool root) {
+      auto _node = _none;
+      switch (f.type_)
+      {
+      case type_varint:
+      case type_int32:
+      case type_int64:
+      {
+        for (auto v : f.values_)
+        {
+          push_node(f.type_, f.id_, v, 0);
+        }
+        return;
+      }
+      case type_binary:
+      {
+        for (const auto& v : f.binary_values_)
+        {
+          push_node(type_binary, f.id_, _pool->size(), v.size());
+          *_pool += v;
+        }
+        return;
+      }
+      case type_group:
+      {
+        _node = push_node(type_group, f.id_, 0, 0);
+        break;
+      }
+      case type_packed:
+      {
+        auto _offset = _pool->size();
+        f.append_payload(*_pool);
+        _node = push_node(type_packed, f.id_, _offset, _pool->size() - _offset);
+        break;
+      }
+      default:
+        if (root) _node = push_node(f.type_, f.id_, 0, 0);
+        break;
+      }
+      _stack.push_back(frame{&f, f.childs_.begin(), _node});
+    };
+
+    _push(msg, true);
+    while (!_stack.empty())
+    {
+      auto& _top = _stack.back();
+      if (_top.next != _top.msg->childs_.end())
+      {
+        _push(*_top.next++, false);
+        continue;
+      }
+      if (_none != _top.node) nodes_[_top.node].end = std::uint32_t(nodes_.size());
+      _stack.pop_back();
+    }
+    buffer_ = std::move(_pool);
+  }
+
+  ////////////////////////////////////////////////////////////
+  const std::vector<flat_node>& nodes() const noexcept { return nodes_; }
+  const flat_node&              operator[](std::size_t index) const { return nodes_[index]; }
+  std::size_t                   size() const noexcept { return nodes_.size(); }
+  bool                          empty() const noexcept { return nodes_.empty(); }
+
+  const char* binary_data(const flat_node& node) const { return buffer_->data() + node.value; }
+  std::string binary(const flat_node& node) const { return std::string(binary_data(node), node.size); }
+
+  /**
+   * \brief drop the nodes and the buffer, the node array keeps its capacity
+   */
+  void clear()
+  {
+    nodes_.clear();
+    buffer_.reset();
+  }
+
+  /**
+   * \brief deserialize protobuf into the node array, the tree of message::deserialize() in input order
+   * \param input buffer holding serialized binary protobuf data, kept alive by this
+   * \param options decode options, stats count no node allocations, binary allocations or repeat conversions
+   * \return true if all data valid, else return false, the nodes hold the fields decoded so far
+   */
+  bool deserialize(const std::shared_ptr<const std::string>& input, const decode_options& options = decode_options{})
+  {
+    auto _length = input->size();
+    return deserialize(input, 0, &_length, options);
+  }
+
+  bool deserialize(std::string&& input, const decode_options& options = decode_options{})
+  {
+    return deserialize(std::make_shared<const std::string>(std::move(input)), options);
+  }
+
+  /**
+   * \brief deserialize one message of a shared buffer, see message::deserialize()
+   * \param length in, bytes to decode at offset, out, bytes used
+   */
+  bool deserialize(const std::shared_ptr<const std::string>& input, std::size_t offset, std::size_t* length,
+    const decode_options& options)
+  {
+    PROTO_TRACE_SCOPE("flat_deserialize");
+
+    nodes_.clear();
+    buffer_ = input;
+
+    decode_errors _error = decode_malformed;
+    auto          _ok    = false;
+    auto          _begin = std::chrono::steady_clock::now();
+    if (offset <= input->size() && *length <= input->size() - offset)
+    {
+      _ok = decode(reinterpret_cast<const unsigned char*>(input->data()), offset, length, options, _error);
+      trim_cache();
+    }
+    else
+    {
+      *length = 0;
+    }
+    if (options.error) *options.error = _error;
+
+    if (options.stats)
+    {
+      options.stats->decode_ns += std::uint64_t(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _begin).count());
+    }
+    return _ok;
+  }
+
+  /**
+   * \brief build a message tree, repeated fields are merged as message::deserialize() does
+   *   no raw spans, serialize() of the result encodes the fields
+   */
+  message to_message() const
+  {
+    if (nodes_.empty()) return message();
+
+    // fields with sub fields are appended to their parent when their last sub field is done
+    struct frame
+    {
+      message     msg;
+      std::size_t end;
+    };
+    std::vector<frame> _stack;
+    _stack.push_back(frame{make_field(nodes_[0]), nodes_[0].end});
+
+    for (std::size_t i = 1; i < nodes_.size(); ++i)
+    {
+      while (_stack.back().end == i)
+      {
+        auto _done = std::move(_stack.back().msg);
+        _stack.pop_back();
+        _stack.back().msg.append_child(std::move(_done));
+      }
+
+      const auto& _node = nodes_[i];
+      if (i + 1 < _node.end)
+        _stack.push_back(frame{make_field(_node), _node.end});
+      else
+        _stack.back().msg.append_child(make_field(_node));
+    }
+
+    while (_stack.size() > 1)
+    {
+      auto _done = std::move(_stack.back().msg);
+      _stack.pop_back();
+      _stack.back().msg.append_child(std::move(_done));
+    }
+    return std::move(_stack.back().msg);
+  }
+
+  /**
+   * \brief encode to protobuf, fields in node order
+   *   one pass back to front sums the sizes of packed fields, one pass front to back writes
+   */
+  std::string serialize() const
+  {
+    PROTO_TRACE_SCOPE("flat_serialize");
+
+    std::string _result;
+    if (nodes_.empty()) return _result;
+
+    // encoded size of every node with its sub fields, sub fields come after their parent
+    auto& _sizes = cache().sizes;
+    _sizes.resize(nodes_.size());
+    for (auto i = nodes_.size(); i-- > 0;)
+    {
+      const auto& _node = nodes_[i];
+      auto        _key  = detail::varint_size(key(_node.type, _node.id));
+
+      std::size_t _childs = 0;
+      for (auto j = i + 1; j < _node.end; j = nodes_[j].end)
+      {
+        _childs += _sizes[j];
+      }
+
+      switch (_node.type)
+      {
+      case type_varint: _sizes[i] = _key + detail::varint_size(_node.value); break;
+      case type_int32: _sizes[i] = _key + INT32_BYTES; break;
+      case type_int64: _sizes[i] = _key + INT64_BYTES; break;
+      case type_binary: _sizes[i] = _key + detail::varint_size(_node.size) + _node.size; break;
+      case type_group: _sizes[i] = 2 * _key + _childs; break;
+      case type_packed: _sizes[i] = _key + detail::varint_size(_childs) + _childs; break;
+      default: _sizes[i] = _childs; break;
+      }
+    }
+    _result.reserve(_sizes[0]);
+
+    // open groups, their end key follows their last sub field
+    auto& _groups = cache().groups;
+    _groups.clear();
+    for (std::size_t i = 0; i < nodes_.size(); ++i)
+    {
+      while (!_groups.empty() && nodes_[_groups.back()].end == i)
+      {
+        detail::append_varint(_result, key(type_end, nodes_[_groups.back()].id));
+        _groups.pop_back();
+      }
+
+      const auto& _node = nodes_[i];
+      switch (_node.type)
+      {
+      case type_varint:
+      case type_int32:
+      case type_int64:
+      {
+        detail::append_varint(_result, key(_node.type, _node.id));
+        if (type_varint == _node.type)
+          detail::append_varint(_result, _node.value);
+        else
+          append_fixed(_result, _node.value, type_int32 == _node.type ? INT32_BYTES : INT64_BYTES);
+        break;
+      }
+      case type_binary:
+      {
+        detail::append_varint(_result, key(type_binary, _node.id));
+        detail::append_varint(_result, _node.size);
+        _result.append(binary_data(_node), _node.size);
+        break;
+      }
+      case type_group:
+      {
+        detail::append_varint(_result, key(type_group, _node.id));
+        _groups.push_back(i);
+        break;
+      }
+      case type_packed:
+      {
+        std::size_t _childs = 0;
+        for (auto j = i + 1; j < _node.end; j = nodes_[j].end)
+        {
+          _childs += _sizes[j];
+        }
+        detail::append_varint(_result, key(type_binary, _node.id));
+        detail::append_varint(_result, _childs);
+        break;
+      }
+      default: break;
+      }
+    }
+    while (!_groups.empty())
+    {
+      detail::append_varint(_result, key(type_end, nodes_[_groups.back()].id));
+      _groups.pop_back();
+    }
+    trim_cache();
+    return _result;
+  }
+
+  /**
+   * \brief free the decoder and encoder scratch the calling thread keeps, it is trimmed after every use
+   */
+  static void release_thread_caches() { cache() = thread_cache(); }
+
+private:
+  /**
+   * \brief the root or an open group or packed field of decode()
+   */
+  struct frame
+  {
+    const unsigned char* begin;       // first byte of the frame
+    const unsigned char* pdata;       // next byte to decode
+    std::size_t          length;      // bytes given to the frame
+    std::size_t          left;        // bytes not decoded yet
+    const unsigned char* field_begin; // key of the field that opened the frame
+    std::size_t          node;        // node of the group or packed field
+    int                  depth;
+    types                type;        // type_undefined root, type_group or type_packed
+  };
+
+  /**
+   * \brief scratch of decode() and serialize(), kept per thread so loops do not allocate
+   */
+  struct thread_cache
+  {
+    std::vector<frame>        frames; // open frames, root first
+    std::vector<decode_stats> saved;  // stats before each open speculative packed decode
+    varint_index              index;  // one pass over the input serves every nesting level
+    std::vector<std::size_t>  sizes;  // serialize(): encoded size of every node with its sub fields
+    std::vector<std::size_t>  groups; // serialize(): open groups
+  };
+
+  static thread_cache& cache()
+  {
+    static thread_local thread_cache _cache;
+    return _cache;
+  }
+
+  static void trim_cache()
+  {
+    auto& _cache = cache();
+    detail::trim_cache(_cache.frames);
+    detail::trim_cache(_cache.saved);
+    detail::trim_cache(_cache.sizes);
+    detail::trim_cache(_cache.groups);
+    if (_cache.index.memory() > MAX_THREAD_CACHE_BYTES) _cache.index = varint_index();
+  }
+
+  static std::uint64_t key(types type, int id) { return (std::uint64_t(id) << 3) | std::uint64_t(type); }
+
+  static void append_fixed(std::string& result, std::uint64_t value, std::size_t bytes)
+  {
+    for (std::size_t i = 0; i < bytes; ++i)
+    {
+      result += char((value >> (8 * i)) & 0xff);
+    }
+  }
+
+  /**
+   * \brief leaf node, its end is the next index
+   * \return index of the node
+   */
+  std::size_t push_node(types type, int id, std::uint64_t value, std::size_t size)
+  {
+    auto _index = nodes_.size();
+    nodes_.push_back(flat_node{value, std::uint32_t(_index + 1), std::uint32_t(size), id, type});
+    return _index;
+  }
+
+  /**
+   * \brief message of one node without sub fields
+   */
+  message make_field(const flat_node& node) const
+  {
+    switch (node.type)
+    {
+    case type_varint:
+    case type_int32:
+    case type_int64: return message(node.type, node.id, node.value);
+    case type_binary: return message(type_binary, node.id, binary(node));
+    case type_packed:
+    {
+      message _field(type_packed, node.id);
+      _field.binary_values_.emplace_back(binary_data(node), node.size);
+      return _field;
+    }
+    default: return message(node.type, node.id);
+    }
+  }
+
+  /**
+   * \brief iterative decoder, same rules as message::deserialize(), a failed packed attempt is undone by
+   *   truncating the node array
+   */
+  bool decode(const unsigned char* base, std::size_t offset, std::size_t* length, const decode_options& options,
+    decode_errors& error)
+  {
+    // kept per thread, a decode loop does not allocate them again
+    auto& _frames = cache().frames;
+    auto& _saved  = cache().saved;
+    _frames.clear();
+    _saved.clear();
+
+    auto&      _index   = cache().index;
+    const bool _indexed = options.index_varints && simd_none != simd_level();
+    if (_indexed) _index.build(base + offset, *length);
+    auto _varint = [&](const unsigned char* data, std::size_t size, std::uint64_t& value) {
+      return _indexed ? _index.decode(data, size, value) : decode_varint(data, size, value);
+    };
+
+    auto          _stats = options.stats;
+    std::uint64_t _work  = 0;
+    error                = decode_ok;
+
+    const auto _max_u32 = std::size_t(std::numeric_limits<std::uint32_t>::max());
+    auto       _open    = [&](types type, int id, const unsigned char* field_begin, const unsigned char* begin,
+                     std::size_t size, int depth) {
+      if (_stats)
+      {
+        if (depth > _stats->max_depth) _stats->max_depth = depth;
+        if (type_packed == type)
+        {
+          ++_stats->packed_attempts;
+          _saved.push_back(*_stats);
+        }
+      }
+      auto _node = (type_packed == type) ? push_node(type, id, std::uint64_t(begin - base), size)
+                                         : push_node(type, id, 0, 0);
+      _frames.push_back(frame{begin, begin, size, size, field_begin, _node, depth, type});
+    };
+
+    auto _over_budget = [&]() { return options.work_budget && _work > options.work_budget; };
+
+    _open(type_undefined, 0, base + offset, base + offset, *length, 1);
+
+    for (;;)
+    {
+      bool _ok     = true;
+      bool _opened = false;
+
+      // decode fields of the innermost frame until it ends or opens a child frame
+      {
+        auto& _frame = _frames.back();
+        auto  _pdata = _frame.pdata;
+        auto  _left  = _frame.left;
+        auto  _depth = _frame.depth;
+
+        if (0 == _frame.length) _ok = false;
+
+        while (_ok && _left > 0)
+        {
+          auto _field_begin = _pdata;
+
+          std::uint64_t _key;
+          {
+            auto _size = _varint(_pdata, _left, _key);
+            if (0 == _size)
+            {
+              _ok = false;
+              break;
+            }
+
+            _pdata += _size;
+            _left -= _size;
+          }
+
+          if ((_key >> 3) > std::uint64_t(MAX_FIELD_NUMBER) || nodes_.size() >= _max_u32)
+          {
+            _ok = false;
+            break;
+          }
+
+          auto _id    = int(_key >> 3);
+          auto _itype = int(_key & 7);
+          if (_itype >= int(type_undefined) || (0 == _left && !(type_group == _frame.type && type_end == _itype)))
+          {
+            _ok = false;
+            break;
+          }
+
+          bool _closed = false;
+
+          switch (types(_itype))
+          {
+          case type_varint:
+          {
+            std::uint64_t _value;
+            auto          _size = _varint(_pdata, _left, _value);
+            if (0 == _size)
+            {
+              _ok = false;
+              break;
+            }
+
+            _pdata += _size;
+            _left -= _size;
+            push_node(type_varint, _id, _value, 0);
+            break;
+          }
+          case type_int64:
+          case type_int32:
+          {
+            std::size_t _size = (type_int64 == _itype) ? INT64_BYTES : INT32_BYTES;
+            if (_left < _size)
+            {
+              _ok = false;
+              break;
+            }
+
+            std::uint64_t _value = 0;
+            std::memcpy(&_value, _pdata, _size);
+            _pdata += _size;
+            _left -= _size;
+            push_node(types(_itype), _id, _value, 0);
+            break;
+          }
+          case type_binary:
+          {
+            std::uint64_t _binary_length;
+            auto          _size = _varint(_pdata, _left, _binary_length);
+            if (0 == _size)
+            {
+              _ok = false;
+              break;
+            }
+
+            _pdata += _size;
+            _left -= _size;
+            if (_binary_length > _left || _binary_length > _max_u32)
+            {
+              _ok = false;
+              break;
+            }
+
+            // try dec packed message, the node turns binary when the attempt frame fails
+            if ((-1 == options.dec_pack_depth || _depth <= options.dec_pack_depth)
+                && (0 == options.max_depth || _depth < options.max_depth)
+                && !detail::skip_packed_attempt(_pdata, std::size_t(_binary_length), options))
+            {
+              _frame.pdata = _pdata;
+              _frame.left  = _left;
+              _open(type_packed, _id, _field_begin, _pdata, std::size_t(_binary_length), _depth + 1);
+              _opened = true;
+              break;
+            }
+
+            push_node(type_binary, _id, std::uint64_t(_pdata - base), std::size_t(_binary_length));
+            _pdata += _binary_length;
+            _left -= std::size_t(_binary_length);
+            break;
+          }
+          case type_group:
+          {
+            if (0 != options.max_depth && _depth >= options.max_depth)
+            {
+              error = decode_depth_exceeded;
+              _ok   = false;
+              break;
+            }
+
+            _work += std::uint64_t(_pdata - _field_begin);
+            _frame.pdata = _pdata;
+            _frame.left  = _left;
+            _open(type_group, _id, _field_begin, _pdata, _left, _depth + 1);
+            _opened = true;
+            break;
+          }
+          case type_end:
+          {
+            _closed = (type_group == _frame.type);
+            break;
+          }
+          default:
+            _ok = false;
+            break;
+          }
+
+          // _frame is not valid after a child frame opened
+          if (_opened || !_ok) break;
+
+          if (_stats)
+          {
+            ++_stats->fields[_itype];
+            _stats->bytes[_itype] += std::uint64_t(_pdata - _field_begin);
+          }
+
+          _work += std::uint64_t(_pdata - _field_begin);
+          if (_over_budget())
+          {
+            error = decode_budget_exceeded;
+            _ok   = false;
+            break;
+          }
+
+          if (_closed) break;
+        }
+
+        if (!_opened)
+        {
+          _frame.pdata = _pdata;
+          _frame.left  = _left;
+        }
+      }
+
+      if (_opened) continue;
+
+      // close frames, a failed group drops its nodes and fails its parent, a failed packed attempt turns binary
+      for (;;)
+      {
+        auto _child = _frames.back();
+        _frames.pop_back();
+
+        if (_frames.empty())
+        {
+          nodes_[0].end = std::uint32_t(nodes_.size());
+          *length       = std::size_t(_child.pdata - _child.begin);
+          if (!_ok && decode_ok == error) error = decode_malformed;
+          if (_stats) _stats->work_bytes += _work;
+          return _ok;
+        }
+
+        auto& _parent = _frames.back();
+
+        if (type_group == _child.type)
+        {
+          if (!_ok)
+          {
+            nodes_.resize(_child.node);
+            continue;
+          }
+
+          nodes_[_child.node].end = std::uint32_t(nodes_.size());
+          _parent.pdata           = _child.pdata;
+          _parent.left            = _child.left;
+
+          if (_stats)
+          {
+            ++_stats->fields[type_group];
+            _stats->bytes[type_group] += std::uint64_t(_child.pdata - _child.field_begin);
+          }
+          break;
+        }
+
+        decode_stats _before;
+        if (_stats)
+        {
+          _before = _saved.back();
+          _saved.pop_back();
+        }
+
+        // out of budget, give up instead of keeping the bytes as binary
+        if (!_ok && decode_budget_exceeded == error)
+        {
+          nodes_.resize(_child.node);
+          continue;
+        }
+
+        if (_ok)
+        {
+          if (_stats) ++_stats->packed_successes;
+        }
+        else
+        {
+          // keep the bytes as binary
+          nodes_.resize(_child.node + 1);
+          nodes_[_child.node].type = type_binary;
+
+          error = decode_ok;
+          if (_stats)
+          {
+            _stats->rollback_fields(_before);
+            _stats->packed_wasted_bytes += std::uint64_t(_child.pdata - _child.begin);
+          }
+        }
+        nodes_[_child.node].end = std::uint32_t(nodes_.size());
+
+        _parent.pdata = _child.begin + _child.length;
+        _parent.left -= _child.length;
+
+        if (_stats)
+        {
+          ++_stats->fields[type_binary];
+          _stats->bytes[type_binary] += std::uint64_t(_parent.pdata - _child.field_begin);
+        }
+
+        _work += std::uint64_t(_parent.pdata - _child.field_begin);
+        if (_over_budget())
+        {
+          error = decode_budget_exceeded;
+          _ok   = false;
+          continue;
+        }
+
+        _ok = true;
+        break;
+      }
+    }
+  }
+
+  std::shared_ptr<const std::string> buffer_; // input, or the binary values of a flattened message
+  std::vector<flat_node>             nodes_;
+};
+
+template<int ID>
+class varint : public message
+{
+public:
+  varint(std::uint64_t value)
+    : message(type_varint, ID, value)
+  {}
+
+  varint(const std::vector<std::uint64_t>& values)
+    : message(type_varint, ID, values)
+  {}
+
+  varint(const std::initializer_list<std::uint64_t>& values)
+    : message(type_varint, ID, values)
+  {}
+};
+
+template<int ID>
+class int32 : public message
+{
+public:
+  int32(std::uint32_t value)
+    : message(type_int32, ID, value)
+  {}
+
+  int32(const std::vector<std::uint32_t>& values)
+    : message(type_int32, ID, values)
+  {}
+
+  int32(const std::initializer_list<std::uint32_t>& values)
+    : message(type_int32, ID, values)
+  {}
+};
+
+template<int ID>
+class int64 : public message
+{
+public:
+  int64(const std::uint64_t value)
+    : message(type_int64, ID, value)
+  {}
+
+  int64(const std::vector<std::uint64_t>& values)
+    : message(type_int64, ID, values)
+  {}
+
+  int64(const std::initializer_list<std::uint64_t>& values)
+    : message(type_int64, ID, values)
+  {}
+};
+
+template<int ID>
+class binary : public message
+{
+public:
+  binary(const std::string& value)
+    : message(type_binary, ID, value)
+  {}
+
+  binary(std::string&& value)
+    : message(type_binary, ID, std::move(value))
+  {}
+
+  binary(const std::vector<std::string>& values)
+    : message(type_binary, ID, values)
+  {}
+
+  binary(std::vector<std::string>&& values)
+    : message(type_binary, ID, std::move(values))
+  {}
+
+  binary(const std::initializer_list<std::string>& values)
+    : message(type_binary, ID, values)
+  {}
+};
+
+template<int ID>
+class group : public message
+{
+public:
+  group(const std::vector<message>& fields)
+    : message(fields)
+  {
+    type_ = type_group;
+    id_   = ID;
+  }
+
+  group(const std::list<message>& fields)
+    : message(fields)
+  {
+    type_ = type_group;
+    id_   = ID;
+  }
+
+  group(const std::initializer_list<message>& fields)
+    : message(fields)
+  {
+    type_ = type_group;
+    id_   = ID;
+  }
+};
+
+template<int ID>
+class packed : public message
+{
+public:
+  packed(const std::vector<message>& fields)
+    : message(fields)
+  {
+    type_ = type_packed;
+    id_   = ID;
+  }
+
+  packed(const std::list<message>& fields)
+    : message(fields)
+  {
+    type_ = type_packed;
+    id_   = ID;
+  }
+
+  packed(const std::initializer_list<message>& fields)
+    : message(fields)
+  {
+    type_ = type_packed;
+    id_   = ID;
+  }
+};
+
+/**
+ * \brief free what message and flat_message keep per thread for decoding and encoding on the calling thread
+ */
+inline void release_thread_caches()
+{
+  message::release_thread_caches();
+  flat_message::release_thread_caches();
+}
+} // namespace proto
+
+#endif // !__PROTO_HPP__
@@ -0,0 +1,904 @@
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+#include "proto.hpp"
+#include "proto_parallel.hpp"
+#include "proto_print.hpp"
+
+////////////////////////////////////////////////////////////
+// allocation counter, every operator new in this process is counted,
+// a size header in front of each block keeps the live byte count
+
+namespace {
+std::atomic<std::size_t> g_alloc_count{0};
+std::atomic<std::size_t> g_alloc_bytes{0};
+std::atomic<std::size_t> g_live_bytes{0};
+
+std::atomic<std::uint64_t> g_value_sink{0}; // traversal results, kept so the loops are not optimized out
+
+const std::size_t ALLOC_HEADER = alignof(std::max_align_t);
+
+void* counted_alloc(std::size_t size)
+{
+  auto p = static_cast<unsigned char*>(std::malloc(size + ALLOC_HEADER));
+  if (nullptr == p) throw std::bad_alloc();
+
+  *reinterpret_cast<std::size_t*>(p) = size;
+  g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+  g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+  g_live_bytes.fetch_add(size, std::memory_order_relaxed);
+  return p + ALLOC_HEADER;
+}
+
+void counted_free(void* ptr)
+{
+  if (nullptr == ptr) return;
+
+  auto p = static_cast<unsigned char*>(ptr) - ALLOC_HEADER;
+  g_live_bytes.fetch_sub(*reinterpret_cast<std::size_t*>(p), std::memory_order_relaxed);
+  std::free(p);
+}
+} // namespace
+
+void* operator new(std::size_t size) { return counted_alloc(size); }
+void* operator new[](std::size_t size) { return counted_alloc(size); }
+void  operator delete(void* p) noexcept { counted_free(p); }
+void  operator delete[](void* p) noexcept { counted_free(p); }
+void  operator delete(void* p, std::size_t) noexcept { counted_free(p); }
+void  operator delete[](void* p, std::size_t) noexcept { counted_free(p); }
+
+////////////////////////////////////////////////////////////
+
+/**
+ * \brief deterministic synthetic corpus generator
+ */
+class corpus_generator
+{
+public:
+  explicit corpus_generator(std::uint64_t seed)
+    : state_(seed)
+  {}
+
+  /**
+   * \brief many scalar and short string fields directly under the root
+   */
+  proto::message wide(std::size_t bytes)
+  {
+    proto::message _msg;
+    std::size_t    _size = 0;
+    while (_size < bytes)
+    {
+      auto _field = scalar_field(int(1 + range(200)));
+      _size += field_size(_field);
+      _msg.append_child(std::move(_field));
+    }
+    return _msg;
+  }
+
+  /**
+   * \brief records made of nested messages, depth levels each
+   */
+  proto::message deep(std::size_t bytes, int depth)
+  {
+    proto::message _msg;
+    std::size_t    _size = 0;
+    while (_size < bytes)
+    {
+      proto::message _record{proto::type_packed, 3};
+      _record.append_child(proto::message{proto::type_varint, 1, range(1 << 20)});
+      for (auto i = 0; i < depth; ++i)
+      {
+        proto::message _level{proto::type_packed, 3};
+        _level.append_child(proto::message{proto::type_varint, 1, range(1 << 20)});
+        _level.append_child(proto::message{proto::type_binary, 2, text(8)});
+        _level.append_child(std::move(_record));
+        _record = std::move(_level);
+      }
+      _record.id_ = 1;
+      _size += field_size(_record);
+      _msg.append_child(std::move(_record));
+    }
+    return _msg;
+  }
+
+  /**
+   * \brief binary fields holding packed repeated varints, as a packed repeated int32 encodes
+   */
+  proto::message packed(std::size_t bytes)
+  {
+    proto::message _msg;
+    std::size_t    _size = 0;
+    while (_size < bytes)
+    {
+      std::string _payload;
+      for (auto i = 0; i < 256; ++i)
+      {
+        _payload += proto::encode_varint(range(1 << (7 * (1 + range(4)))));
+      }
+      proto::message _field{proto::type_binary, int(1 + range(4)), _payload};
+      _size += field_size(_field);
+      _msg.append_child(std::move(_field));
+    }
+    return _msg;
+  }
+
+  /**
+   * \brief large text blobs
+   */
+  proto::message strings(std::size_t bytes)
+  {
+    proto::message _msg;
+    std::size_t    _size = 0;
+    while (_size < bytes)
+    {
+      proto::message _field{proto::type_binary, int(1 + range(8)), text(1024 + range(63 * 1024))};
+      _size += field_size(_field);
+      _msg.append_child(std::move(_field));
+    }
+    return _msg;
+  }
+
+  /**
+   * \brief records made of nested groups
+   */
+  proto::message groups(std::size_t bytes)
+  {
+    proto::message _msg;
+    std::size_t    _size = 0;
+    while (_size < bytes)
+    {
+      proto::message _record{proto::type_group, 1};
+      for (auto i = 0; i < 8; ++i)
+      {
+        proto::message _inner{proto::type_group, 2 + i % 3};
+        for (auto j = 0; j < 4; ++j)
+        {
+          _inner.append_child(scalar_field(int(1 + range(16))));
+        }
+        proto::message _leaf{proto::type_group, 20};
+        _leaf.append_child(scalar_field(1));
+        _inner.append_child(std::move(_leaf));
+        _record.append_child(std::move(_inner));
+      }
+      _size += field_size(_record);
+      _msg.append_child(std::move(_record));
+    }
+    return _msg;
+  }
+
+  /**
+   * \brief nested messages of varint fields only, multi byte keys and values of every width
+   */
+  proto::message tags(std::size_t bytes)
+  {
+    proto::message _msg;
+    std::size_t    _size = 0;
+    while (_size < bytes)
+    {
+      proto::message _record{proto::type_packed, 1};
+      for (auto i = 0; i < 16; ++i)
+      {
+        auto _bits = 7 * (1 + range(9));
+        _record.append_child(proto::message{proto::type_varint, int(1 + range(1 << 14)), next() >> (64 - _bits)});
+      }
+      _size += field_size(_record);
+      _msg.append_child(std::move(_record));
+    }
+    return _msg;
+  }
+
+  /**
+   * \brief one record of a stream, every record has the same fields with different values and string lengths
+   */
+  proto::message record()
+  {
+    proto::message _msg;
+    _msg.append_child(proto::message{proto::type_varint, 1, range(1ull << 40)});
+    _msg.append_child(proto::message{proto::type_int64, 2, next()});
+    _msg.append_child(proto::message{proto::type_binary, 3, text(8 + range(56))});
+
+    proto::message _nested{proto::type_packed, 4};
+    _nested.append_child(proto::message{proto::type_varint, 1, range(1 << 20)});
+    _nested.append_child(proto::message{proto::type_binary, 2, text(16 + range(48))});
+    _msg.append_child(std::move(_nested));
+
+    for (auto i = 0; i < 4; ++i)
+    {
+      _msg.append_child(proto::message{proto::type_varint, 5, range(1 << 14)});
+    }
+
+    proto::message _group{proto::type_group, 6};
+    _group.append_child(proto::message{proto::type_int32, 1, std::uint64_t(std::uint32_t(next()))});
+    _group.append_child(proto::message{proto::type_binary, 2, text(4 + range(12))});
+    _msg.append_child(std::move(_group));
+    return _msg;
+  }
+
+private:
+  std::uint64_t state_;
+
+  // splitmix64
+  std::uint64_t next()
+  {
+    std::uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+    z               = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z               = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+
+  std::uint64_t range(std::uint64_t n) { return next() % n; }
+
+  std::string text(std::size_t len)
+  {
+    static const char _letters[] = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 ";
+
+    std::string _result(len, ' ');
+    for (auto& c : _result)
+    {
+      c = _letters[range(sizeof(_letters) - 1)];
+    }
+    return _result;
+  }
+
+  proto::message scalar_field(int id)
+  {
+    switch (range(4))
+    {
+    case 0: return proto::message{proto::type_varint, id, range(1ull << (7 * (1 + range(9))))};
+    case 1: return proto::message{proto::type_int32, id, std::uint64_t(std::uint32_t(next()))};
+    case 2: return proto::message{proto::type_int64, id, next()};
+    default: return proto::message{proto::type_binary, id, text(4 + range(28))};
+    }
+  }
+
+  static std::size_t field_size(const proto::message& field)
+  {
+    proto::message _wrap;
+    _wrap.childs_.push_back(field);
+    return _wrap.serialize().size();
+  }
+};
+
+////////////////////////////////////////////////////////////
+
+std::size_t count_fields(const proto::message& msg)
+{
+  std::size_t _count = 0;
+  switch (msg.type_)
+  {
+  case proto::type_varint:
+  case proto::type_int32:
+  case proto::type_int64: _count += msg.values_.size(); break;
+  case proto::type_binary: _count += msg.binary_values_.size(); break;
+  case proto::type_group:
+  case proto::type_packed: _count += 1; break;
+  default:;
+  }
+  for (const auto& f : msg.childs_)
+  {
+    _count += count_fields(f);
+  }
+  return _count;
+}
+
+/**
+ * \brief sum of the scalar values of a tree, visits every node
+ */
+std::uint64_t sum_values(const proto::message& msg)
+{
+  std::uint64_t                      _sum = 0;
+  std::vector<const proto::message*> _stack{&msg};
+  while (!_stack.empty())
+  {
+    auto _node = _stack.back();
+    _stack.pop_back();
+    for (auto v : _node->values_)
+    {
+      _sum += v;
+    }
+    for (const auto& f : _node->childs_)
+    {
+      _stack.push_back(&f);
+    }
+  }
+  return _sum;
+}
+
+std::uint64_t sum_values(const proto::flat_message& msg)
+{
+  std::uint64_t _sum = 0;
+  for (const auto& node : msg.nodes())
+  {
+    if (proto::type_varint == node.type || proto::type_int32 == node.type || proto::type_int64 == node.type)
+      _sum += node.value;
+  }
+  return _sum;
+}
+
+struct bench_result
+{
+  std::size_t iterations           = 0;
+  double      ns_per_iteration     = 0;
+  double      allocs_per_iteration = 0;
+  double      bytes_per_iteration  = 0;
+};
+
+/**
+ * \brief run fn until min_time_ms elapsed, at least once
+ */
+bench_result run_bench(const std::function<void()>& fn, int min_time_ms)
+{
+  using clock = std::chrono::steady_clock;
+
+  bench_result _result;
+  auto         _allocs = g_alloc_count.load();
+  auto         _bytes  = g_alloc_bytes.load();
+  auto         _begin  = clock::now();
+  auto         _end    = _begin;
+  do
+  {
+    fn();
+    ++_result.iterations;
+    _end = clock::now();
+  } while (std::chrono::duration_cast<std::chrono::milliseconds>(_end - _begin).count() < min_time_ms);
+
+  auto _ns                     = std::chrono::duration_cast<std::chrono::nanoseconds>(_end - _begin).count();
+  _result.ns_per_iteration     = double(_ns) / _result.iterations;
+  _result.allocs_per_iteration = double(g_alloc_count.load() - _allocs) / _result.iterations;
+  _result.bytes_per_iteration  = double(g_alloc_bytes.load() - _bytes) / _result.iterations;
+  return _result;
+}
+
+void print_result(const std::string& shape, const char* op, std::size_t bytes, std::size_t fields,
+  const bench_result& r)
+{
+  auto _mb_per_s     = (r.ns_per_iteration > 0) ? (double(bytes) / (1024.0 * 1024.0)) / (r.ns_per_iteration / 1e9) : 0;
+  auto _ns_per_field = fields ? r.ns_per_iteration / fields : 0;
+  std::printf("%s,%s,%zu,%zu,%zu,%.0f,%.2f,%.2f,%.1f,%.0f\n", shape.c_str(), op, bytes, fields, r.iterations,
+    r.ns_per_iteration, _mb_per_s, _ns_per_field, r.allocs_per_iteration, r.bytes_per_iteration);
+  std::fflush(stdout);
+}
+
+/**
+ * \brief allocations per field allowed for one shape, a fixed few per operation on top
+ *   values have some headroom over the measured counts, lower them when the decoder allocates less
+ */
+struct alloc_budget
+{
+  const char* shape;
+  double      decode_per_field;
+  double      encode_per_field;
+};
+
+namespace {
+const alloc_budget ALLOC_BUDGETS[] = {
+  {"wide", 0.35, 0.01},
+  {"deep", 2.9, 0.01},
+  {"packed", 4.0, 0.01},
+  {"strings", 10.5, 0.01},
+  {"groups", 2.2, 0.01},
+};
+
+const double ALLOC_BUDGET_FIXED = 4; // allocations per operation independent of the field count
+const double ALLOC_BUDGET_REUSE = 0.0001; // reused nodes changing role between records may still grow a buffer
+} // namespace
+
+/**
+ * \brief compare measured allocations with the shape budget
+ * \return false if over budget
+ */
+bool check_budget(const std::string& shape, const char* op, std::size_t fields, const bench_result& r,
+  double per_field)
+{
+  auto _limit = per_field * double(fields) + ALLOC_BUDGET_FIXED;
+  if (r.allocs_per_iteration <= _limit) return true;
+
+  std::fprintf(stderr, "%s,%s: %.1f allocations per op over budget %.1f (%.2f per field)\n", shape.c_str(), op,
+    r.allocs_per_iteration, _limit, per_field);
+  return false;
+}
+
+#if !defined(_WIN32)
+/**
+ * \brief serialize_iov() joined and serialize_to_fd() read back from a temporary file are expected
+ */
+bool check_iov(const proto::message& msg, const std::string& expected)
+{
+  std::string _scratch;
+  std::string _joined;
+  for (const auto& b : msg.serialize_iov(_scratch))
+  {
+    _joined.append(static_cast<const char*>(b.iov_base), b.iov_len);
+  }
+  if (_joined != expected) return false;
+
+  auto _file = std::tmpfile();
+  if (nullptr == _file) return false;
+
+  std::string _read(expected.size(), '\0');
+  auto        _ok = msg.serialize_to_fd(fileno(_file)) && 0 == std::fseek(_file, 0, SEEK_SET) &&
+             _read.size() == std::fread(&_read[0], 1, _read.size(), _file) && EOF == std::fgetc(_file);
+  std::fclose(_file);
+  return _ok && _read == expected;
+}
+#endif
+
+/**
+ * \brief measure one shape
+ * \return false if corpus does not decode or an allocation budget is exceeded
+ */
+bool bench_shape(const std::string& shape, proto::message& generated, int dec_pack_depth, int min_time_ms,
+  bool budget)
+{
+  auto bin = generated.serialize();
+  proto::thread_pool pool; // parallel print and encode rows
+
+  // heap held by the decoded tree, its spans keep the shared input alive, reserialize copies from them
+  bench_result   tree;
+  proto::message decoded;
+  auto           shared = std::make_shared<const std::string>(bin);
+  {
+    auto _allocs = g_alloc_count.load();
+    auto _live   = g_live_bytes.load();
+    if (!decoded.deserialize(shared, dec_pack_depth))
+    {
+      std::fprintf(stderr, "%s: generated corpus does not decode\n", shape.c_str());
+      return false;
+    }
+    tree.iterations           = 1;
+    tree.allocs_per_iteration = double(g_alloc_count.load() - _allocs);
+    tree.bytes_per_iteration  = double(g_live_bytes.load() - _live);
+  }
+  auto fields = count_fields(decoded);
+
+  print_result(shape, "tree_memory", bin.size(), fields, tree);
+
+  // the same tree without a copy of the bytes of each packed field
+  {
+    proto::decode_options _options{dec_pack_depth};
+    _options.packed_copies = false;
+
+    bench_result   _single;
+    proto::message _msg;
+    auto           _allocs = g_alloc_count.load();
+    auto           _live   = g_live_bytes.load();
+    if (!_msg.deserialize(shared, _options) || _msg.hash() != decoded.hash() || _msg.serialize() != decoded.serialize())
+    {
+      std::fprintf(stderr, "%s: decode without packed copies differs\n", shape.c_str());
+      return false;
+    }
+    _single.iterations           = 1;
+    _single.allocs_per_iteration = double(g_alloc_count.load() - _allocs);
+    _single.bytes_per_iteration  = double(g_live_bytes.load() - _live);
+    print_result(shape, "tree_memory_single", bin.size(), fields, _single);
+  }
+
+  auto dec = run_bench([&] {
+    proto::message _msg;
+    _msg.deserialize(bin, dec_pack_depth);
+  }, min_time_ms);
+  print_result(shape, "deserialize", bin.size(), fields, dec);
+
+  auto enc = run_bench([&] {
+    auto _out = generated.serialize();
+  }, min_time_ms);
+  // binary fields that can not or should not decode are kept as binary without an attempt
+  print_result(shape, "deserialize_prechecked", bin.size(), fields, run_bench([&] {
+    proto::decode_options _options{dec_pack_depth};
+    _options.check_fields = 1;
+    _options.text_percent = 90;
+    proto::message _msg;
+    _msg.deserialize(bin, _options);
+  }, min_time_ms));
+
+  // binary fields taken for packed repeated scalars stay binary, printed as numeric arrays
+  proto::packed_scalar_options scalars;
+  proto::decode_options        scalar_options{dec_pack_depth};
+  scalar_options.scalars = &scalars;
+  {
+    proto::message _msg;
+    if (!_msg.deserialize(shared, scalar_options) || _msg.serialize() != decoded.serialize())
+    {
+      std::fprintf(stderr, "%s: decode with packed scalars differs\n", shape.c_str());
+      return false;
+    }
+  }
+  print_result(shape, "deserialize_scalars", bin.size(), fields, run_bench([&] {
+    proto::message _msg;
+    _msg.deserialize(bin, scalar_options);
+  }, min_time_ms));
+
+  print_result(shape, "serialize", bin.size(), fields, enc);
+
+  // sibling subtrees encoded on the hardware threads into their slots of one buffer
+  if (generated.serialize_parallel(pool) != bin || decoded.serialize_parallel(pool) != decoded.serialize())
+  {
+    std::fprintf(stderr, "%s: parallel serialize differs\n", shape.c_str());
+    return false;
+  }
+  print_result(shape, "serialize_parallel", bin.size(), fields, run_bench([&] {
+    auto _out = generated.serialize_parallel(pool);
+  }, min_time_ms));
+
+#if !defined(_WIN32)
+  // buffers pointing at large values instead of copying them, the file written from them reads back as bin
+  if (!check_iov(generated, bin) || !check_iov(decoded, decoded.serialize()))
+  {
+    std::fprintf(stderr, "%s: vectored serialize differs\n", shape.c_str());
+    return false;
+  }
+  std::string _scratch;
+  print_result(shape, "serialize_iov", bin.size(), fields, run_bench([&] {
+    auto _buffers = generated.serialize_iov(_scratch);
+    g_value_sink.fetch_add(_buffers.size(), std::memory_order_relaxed);
+  }, min_time_ms));
+#endif
+
+  print_result(shape, "reserialize", bin.size(), fields, run_bench([&] {
+    auto _out = decoded.serialize();
+  }, min_time_ms));
+
+  print_result(shape, "to_string", bin.size(), fields, run_bench([&] {
+    auto _out = proto::to_string(decoded);
+  }, min_time_ms));
+
+  print_result(shape, "to_string_scalars", bin.size(), fields, run_bench([&] {
+    auto _out = proto::to_string(decoded, 2, 0, -1, 2, true, &scalars);
+  }, min_time_ms));
+
+  print_result(shape, "to_cpp_code", bin.size(), fields, run_bench([&] {
+    auto _out = proto::to_cpp_code(decoded);
+  }, min_time_ms));
+
+  // the same text printed in pieces on the hardware threads
+  if (proto::to_string_parallel(decoded, pool) != proto::to_string(decoded)
+      || proto::to_cpp_code_parallel(decoded, pool) != proto::to_cpp_code(decoded))
+  {
+    std::fprintf(stderr, "%s: parallel print differs\n", shape.c_str());
+    return false;
+  }
+  print_result(shape, "to_string_parallel", bin.size(), fields, run_bench([&] {
+    auto _out = proto::to_string_parallel(decoded, pool);
+  }, min_time_ms));
+
+  print_result(shape, "to_cpp_code_parallel", bin.size(), fields, run_bench([&] {
+    auto _out = proto::to_cpp_code_parallel(decoded, pool);
+  }, min_time_ms));
+
+  // hand a decoded tree to another owner, deep copy against a shared frozen handle
+  print_result(shape, "copy", bin.size(), fields, run_bench([&] {
+    proto::message _copy(decoded);
+  }, min_time_ms));
+
+  proto::frozen_message frozen{proto::message(decoded)};
+  print_result(shape, "frozen_copy", bin.size(), fields, run_bench([&] {
+    proto::frozen_message _copy(frozen);
+  }, min_time_ms));
+
+  // flat tape against the node tree, the same fields in one array
+  proto::flat_message flat;
+  proto::flat_message indexed;
+  proto::decode_options indexed_options{dec_pack_depth};
+  indexed_options.index_varints = true;
+  if (!flat.deserialize(std::string(bin), proto::decode_options{dec_pack_depth}) ||
+      flat.to_message().hash() != decoded.hash() || !indexed.deserialize(std::string(bin), indexed_options) ||
+      indexed.to_message().hash() != decoded.hash())
+  {
+    std::fprintf(stderr, "%s: flat decode differs from the tree\n", shape.c_str());
+    return false;
+  }
+
+  print_result(shape, "flat_deserialize", bin.size(), fields, run_bench([&] {
+    proto::flat_message _flat;
+    _flat.deserialize(std::string(bin), proto::decode_options{dec_pack_depth});
+  }, min_time_ms));
+
+  print_result(shape, "flat_deserialize_indexed", bin.size(), fields, run_bench([&] {
+    proto::decode_options _options{dec_pack_depth};
+    _options.index_varints = true;
+    proto::flat_message _flat;
+    _flat.deserialize(std::string(bin), _options);
+  }, min_time_ms));
+
+  print_result(shape, "varint_index", bin.size(), fields, run_bench([&] {
+    proto::varint_index _index;
+    _index.build(bin.data(), bin.size());
+  }, min_time_ms));
+
+  print_result(shape, "traverse", bin.size(), fields, run_bench([&] {
+    g_value_sink.fetch_add(sum_values(decoded), std::memory_order_relaxed);
+  }, min_time_ms));
+
+  print_result(shape, "flat_traverse", bin.size(), fields, run_bench([&] {
+    g_value_sink.fetch_add(sum_values(flat), std::memory_order_relaxed);
+  }, min_time_ms));
+
+  print_result(shape, "flat_serialize", bin.size(), fields, run_bench([&] {
+    auto _out = flat.serialize();
+  }, min_time_ms));
+
+  print_result(shape, "flat_to_string", bin.size(), fields, run_bench([&] {
+    auto _out = proto::to_string(flat);
+  }, min_time_ms));
+
+  if (!budget) return true;
+
+  for (const auto& b : ALLOC_BUDGETS)
+  {
+    if (shape != b.shape) continue;
+
+    auto _ok = check_budget(shape, "deserialize", fields, dec, b.decode_per_field);
+    return check_budget(shape, "serialize", fields, enc, b.encode_per_field) && _ok;
+  }
+  return true;
+}
+
+/**
+ * \brief encode a message over bytes directly, fields after the large blob sit past 2 GB for sizes over that
+ *   1: varint, 2: group { 1: varint, 3: blob, 4: varint }, 5: varint
+ */
+std::string huge_input(std::size_t bytes)
+{
+  auto _key = [](int id, proto::types type) { return proto::encode_varint((std::uint64_t(id) << 3) | type); };
+
+  std::string _head = _key(1, proto::type_varint) + proto::encode_varint(1) + _key(2, proto::type_group) +
+                      _key(1, proto::type_varint) + proto::encode_varint(42) + _key(3, proto::type_binary);
+  std::string _tail = _key(4, proto::type_varint) + proto::encode_varint(7) + _key(2, proto::type_end) +
+                      _key(5, proto::type_varint) + proto::encode_varint(0xDEADBEEF);
+
+  auto _overhead = _head.size() + proto::MAX_VARINT64_BYTES + _tail.size();
+  auto _blob     = bytes > _overhead ? bytes - _overhead : 1;
+
+  std::string _result;
+  _result.reserve(_head.size() + proto::MAX_VARINT64_BYTES + _blob + _tail.size());
+  _result += _head;
+  _result += proto::encode_varint(_blob);
+  _result.append(_blob, 'x');
+  _result[_result.size() - _blob] = 0x07; // invalid wire type, the speculative decode stops at once
+  _result += _tail;
+  return _result;
+}
+
+const proto::message* find_child(const proto::message& msg, int id)
+{
+  for (const auto& f : msg.childs_)
+  {
+    if (id == f.id_) return &f;
+  }
+  return nullptr;
+}
+
+/**
+ * \brief check consumed length, raw spans and the values around the blob
+ */
+bool check_huge(const proto::message& msg, const std::string& input, std::size_t length)
+{
+  auto _group = find_child(msg, 2);
+  auto _blob  = _group ? find_child(*_group, 3) : nullptr;
+  auto _after = _group ? find_child(*_group, 4) : nullptr;
+  auto _last  = find_child(msg, 5);
+
+  return length == input.size() && msg.raw_ && msg.raw_.size == input.size() && _group && _group->raw_ &&
+         _group->raw_.offset == 2 && _group->raw_.offset + _group->raw_.size + 6 == input.size() && _blob &&
+         !_blob->binary_values_.empty() && _after && 7 == _after->value() && _last &&
+         0xDEADBEEF == _last->value();
+}
+
+/**
+ * \brief decode inputs doubling in size up to bytes, mb_per_s stays flat when throughput is linear
+ */
+bool bench_huge(std::size_t bytes, int min_time_ms)
+{
+  for (std::size_t _size = 64 * 1024 * 1024;; _size *= 2)
+  {
+    if (_size > bytes) _size = bytes;
+
+    auto _input = std::make_shared<const std::string>(huge_input(_size));
+    bool _ok    = true;
+
+    print_result("huge", "deserialize", _input->size(), 5, run_bench([&] {
+      proto::message _msg;
+      std::size_t    _length = _input->size();
+      _msg.deserialize(_input, &_length, proto::decode_options{});
+      _ok = _ok && check_huge(_msg, *_input, _length);
+    }, min_time_ms));
+
+    if (!_ok)
+    {
+      std::fprintf(stderr, "huge: wrong offsets decoding %zu bytes\n", _input->size());
+      return false;
+    }
+    if (_size == bytes) return true;
+  }
+}
+
+/**
+ * \brief decode a stream of similar records, a fresh message per record and one message reused for all
+ *   ops are one pass over the stream, reuse is warmed up until pooled strings grew to the record sizes
+ */
+bool bench_records(corpus_generator& gen, std::size_t bytes, int min_time_ms, bool budget)
+{
+  std::string              _stream;
+  std::vector<std::size_t> _offsets;
+  std::size_t              _fields = 0;
+  while (_stream.size() < bytes)
+  {
+    auto _record = gen.record();
+    _offsets.push_back(_stream.size());
+    _stream += _record.serialize();
+    _fields += count_fields(_record);
+  }
+  _offsets.push_back(_stream.size());
+
+  auto _input = std::make_shared<const std::string>(std::move(_stream));
+
+  auto _fresh = [&] {
+    for (std::size_t i = 0; i + 1 < _offsets.size(); ++i)
+    {
+      proto::message _msg;
+      std::size_t    _length = _offsets[i + 1] - _offsets[i];
+      _msg.deserialize(_input, _offsets[i], &_length, proto::decode_options{});
+    }
+  };
+
+  proto::message _reused;
+  auto           _reuse = [&] {
+    for (std::size_t i = 0; i + 1 < _offsets.size(); ++i)
+    {
+      std::size_t _length = _offsets[i + 1] - _offsets[i];
+      _reused.deserialize_into_reuse(_input, _offsets[i], &_length);
+    }
+  };
+
+  _fresh();
+  print_result("records", "deserialize", _input->size(), _fields, run_bench(_fresh, min_time_ms));
+
+  for (auto i = 0; i < 4; ++i) _reuse();
+  auto _result = run_bench(_reuse, min_time_ms);
+  print_result("records", "deserialize_reuse", _input->size(), _fields, _result);
+
+  // packed attempts bound to fail are learned from the first records and left out
+  proto::decode_hints    _hints;
+  proto::decode_options  _hinted_options;
+  _hinted_options.hints = &_hints;
+  proto::message         _hinted;
+  auto                   _hinted_reuse = [&] {
+    for (std::size_t i = 0; i + 1 < _offsets.size(); ++i)
+    {
+      std::size_t _length = _offsets[i + 1] - _offsets[i];
+      _hinted.deserialize_into_reuse(_input, _offsets[i], &_length, _hinted_options);
+    }
+  };
+
+  for (auto i = 0; i < 4; ++i) _hinted_reuse();
+  for (std::size_t i = 0; i + 1 < _offsets.size(); ++i)
+  {
+    std::size_t _length = _offsets[i + 1] - _offsets[i];
+    _reused.deserialize_into_reuse(_input, _offsets[i], &_length);
+    _length = _offsets[i + 1] - _offsets[i];
+    _hinted.deserialize_into_reuse(_input, _offsets[i], &_length, _hinted_options);
+    if (_reused.hash() != _hinted.hash())
+    {
+      std::fprintf(stderr, "records: decode with hints differs at record %zu\n", i);
+      return false;
+    }
+  }
+  print_result("records", "deserialize_hinted", _input->size(), _fields, run_bench(_hinted_reuse, min_time_ms));
+
+  return !budget || check_budget("records", "deserialize_reuse", _fields, _result, ALLOC_BUDGET_REUSE);
+}
+
+void print_help()
+{
+  std::printf(
+    "protobuf benchmark\n"
+    "proto_bench [option]\n"
+    "-h, --help      show this help\n"
+    "--shape <name>  wide, deep, packed, strings, groups, tags, records or all (default all)\n"
+    "                huge is not in all, it decodes inputs doubling from 64 MB up to --size\n"
+    "                with the offsets after a single large blob checked, use sizes over 2 GB\n"
+    "--size <bytes>  corpus size per shape (default 4194304)\n"
+    "--nest <n>      nesting levels of the deep shape (default 32)\n"
+    "--seed <n>      generator seed (default 1)\n"
+    "--depth <n>     decode packed type depth (default -1, unlimited)\n"
+    "--time <ms>     minimum run time per measure (default 200)\n"
+    "--check-budget  exit non-zero if decode or encode allocates over the per field budget\n\n"
+    "output csv: shape,op,bytes,fields,iterations,ns_per_op,mb_per_s,ns_per_field,allocs_per_op,alloc_bytes_per_op\n"
+    "  tree_memory rows report the heap held by one decoded tree in alloc_bytes_per_op\n"
+    "  allocation budgets are calibrated for the default --size and --seed\n");
+}
+
+int main(int argc, char* argv[])
+{
+  std::string   opt_shape = "all";
+  std::size_t   opt_size  = 4 * 1024 * 1024;
+  int           opt_nest  = 32;
+  std::uint64_t opt_seed  = 1;
+  int           opt_depth = -1;
+  int           opt_time  = 200;
+  bool          opt_check = false;
+
+  for (auto i = 1; i < argc; ++i)
+  {
+    std::string arg(argv[i]);
+    if ("-h" == arg || "--help" == arg)
+    {
+      print_help();
+      return 0;
+    }
+    if ("--check-budget" == arg)
+    {
+      opt_check = true;
+      continue;
+    }
+    if (i + 1 >= argc)
+    {
+      print_help();
+      return -1;
+    }
+    if ("--shape" == arg)
+      opt_shape = argv[++i];
+    else if ("--size" == arg)
+      opt_size = std::size_t(std::strtoull(argv[++i], nullptr, 10));
+    else if ("--nest" == arg)
+      opt_nest = std::atoi(argv[++i]);
+    else if ("--seed" == arg)
+      opt_seed = std::strtoull(argv[++i], nullptr, 10);
+    else if ("--depth" == arg)
+      opt_depth = std::atoi(argv[++i]);
+    else if ("--time" == arg)
+      opt_time = std::atoi(argv[++i]);
+    else
+    {
+      print_help();
+      return -1;
+    }
+  }
+
+  std::printf("shape,op,bytes,fields,iterations,ns_per_op,mb_per_s,ns_per_field,allocs_per_op,alloc_bytes_per_op\n");
+
+  corpus_generator gen(opt_seed);
+
+  const std::vector<std::pair<std::string, std::function<proto::message()>>> shapes = {
+    {"wide", [&] { return gen.wide(opt_size); }},
+    {"deep", [&] { return gen.deep(opt_size, opt_nest); }},
+    {"packed", [&] { return gen.packed(opt_size); }},
+    {"strings", [&] { return gen.strings(opt_size); }},
+    {"groups", [&] { return gen.groups(opt_size); }},
+    {"tags", [&] { return gen.tags(opt_size); }},
+  };
+
+  bool found  = false;
+  bool success = true;
+
+  if ("huge" == opt_shape) return bench_huge(opt_size, opt_time) ? 0 : 1;
+  for (const auto& shape : shapes)
+  {
+    if ("all" != opt_shape && shape.first != opt_shape) continue;
+    found = true;
+
+    auto msg = shape.second();
+    if (!bench_shape(shape.first, msg, opt_depth, opt_time, opt_check)) success = false;
+  }
+
+  if ("all" == opt_shape || "records" == opt_shape)
+  {
+    found = true;
+    if (!bench_records(gen, opt_size, opt_time, opt_check)) success = false;
+  }
+
+  if (!found)
+  {
+    std::fprintf(stderr, "unknown shape: %s\n", opt_shape.c_str());
+    return -1;
+  }
+  return success ? 0 : 1;
+}
@@ -0,0 +1,458 @@
+#ifndef __PROTO_IMAGE_HPP__
+#define __PROTO_IMAGE_HPP__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#  pragma once
+#endif // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+/**
+ * tree image, a decoded tree saved in one flat position independent buffer
+ *
+ *   std::string image = proto::write_image(msg, key);   // save, key is any caller value, e.g. an input hash
+ *   proto::image_view view;
+ *   if (view.open(mapped_data, mapped_size)) { ... }     // validate, no decode
+ *   auto f = view.root().id(3);                          // navigate in place
+ *   proto::message copy = view.to_message();             // or build a message tree again
+ *
+ * layout, host byte order, all sections 8 byte aligned
+ *   header   magic, version, byte order mark, key, section counts
+ *   nodes    pre-order, each holds the index one past its subtree, children follow their parent
+ *   values   varint, int32 and int64 values of all nodes
+ *   strings  offset and size of each binary value in the pool
+ *   pool     binary value bytes
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "proto.hpp"
+
+namespace proto {
+
+namespace detail {
+namespace {
+const char          IMAGE_MAGIC[8]   = {'P', 'R', 'O', 'T', 'O', 'I', 'M', 'G'};
+const std::uint32_t IMAGE_VERSION    = 1;
+const std::uint32_t IMAGE_BYTE_ORDER = 0x01020304; // reads differently on a host of other byte order
+} // namespace
+
+struct image_header
+{
+  char          magic[8];
+  std::uint32_t version;
+  std::uint32_t byte_order;
+  std::uint64_t key;
+  std::uint64_t node_count;
+  std::uint64_t value_count;
+  std::uint64_t string_count;
+  std::uint64_t pool_size;
+};
+
+struct image_node
+{
+  std::uint32_t type;
+  std::int32_t  id;
+  std::uint64_t end;     // index one past the subtree
+  std::uint64_t values;  // first value index
+  std::uint64_t strings; // first string index
+  std::uint32_t value_count;
+  std::uint32_t string_count;
+  std::uint32_t child_count;
+  std::uint32_t reserved;
+};
+
+struct image_string
+{
+  std::uint64_t offset;
+  std::uint64_t size;
+};
+
+template<typename T>
+void append_pod(std::string& out, const T& value)
+{
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+/**
+ * \brief read a section entry, the buffer may be unaligned
+ */
+template<typename T>
+T load_pod(const unsigned char* data, std::size_t index)
+{
+  T _value;
+  std::memcpy(&_value, data + index * sizeof(T), sizeof(T));
+  return _value;
+}
+} // namespace detail
+
+/**
+ * \brief save msg as a tree image
+ * \param key caller value stored in the header, read back by image_view::key()
+ */
+inline std::string write_image(const message& msg, std::uint64_t key = 0)
+{
+  std::vector<detail::image_node>   _nodes;
+  std::vector<std::uint64_t>        _values;
+  std::vector<detail::image_string> _strings;
+  std::string                       _pool;
+
+  // pre-order walk, the end of a node is known after its last child
+  struct frame
+  {
+    std::size_t                       node;
+    cow_list<message>::const_iterator it;
+    cow_list<message>::const_iterator end;
+  };
+  std::vector<frame> _stack;
+
+  auto _visit = [&](const message& f) {
+    detail::image_node _node{};
+    _node.type         = std::uint32_t(f.type_);
+    _node.id           = f.id_;
+    _node.values       = _values.size();
+    _node.strings      = _strings.size();
+    _node.value_count  = std::uint32_t(f.values_.size());
+    _node.string_count = std::uint32_t(f.binary_values_.size());
+    _node.child_count  = std::uint32_t(f.childs_.size());
+    for (auto v : f.values_)
+    {
+      _values.push_back(v);
+    }
+    for (const auto& s : f.binary_values_)
+    {
+      _strings.push_back(detail::image_string{_pool.size(), s.size()});
+      _pool += s;
+    }
+    _nodes.push_back(_node);
+    _stack.push_back(frame{_nodes.size() - 1, f.childs_.begin(), f.childs_.end()});
+  };
+
+  _visit(msg);
+  while (!_stack.empty())
+  {
+    auto& _top = _stack.back();
+    if (_top.it == _top.end)
+    {
+      _nodes[_top.node].end = _nodes.size();
+      _stack.pop_back();
+      continue;
+    }
+    _visit(*_top.it++);
+  }
+
+  detail::image_header _header{};
+  std::memcpy(_header.magic, detail::IMAGE_MAGIC, sizeof(_header.magic));
+  _header.version      = detail::IMAGE_VERSION;
+  _header.byte_order   = detail::IMAGE_BYTE_ORDER;
+  _header.key          = key;
+  _header.node_count   = _nodes.size();
+  _header.value_count  = _values.size();
+  _header.string_count = _strings.size();
+  _header.pool_size    = _pool.size();
+
+  std::string _result;
+  _result.reserve(sizeof(_header) + _nodes.size() * sizeof(detail::image_node) + _values.size() * 8 +
+                  _strings.size() * sizeof(detail::image_string) + _pool.size());
+  detail::append_pod(_result, _header);
+  _result.append(reinterpret_cast<const char*>(_nodes.data()), _nodes.size() * sizeof(detail::image_node));
+  _result.append(reinterpret_cast<const char*>(_values.data()), _values.size() * sizeof(std::uint64_t));
+  _result.append(reinterpret_cast<const char*>(_strings.data()), _strings.size() * sizeof(detail::image_string));
+  _result += _pool;
+  return _result;
+}
+
+class image_view;
+
+/**
+ * \brief handle to one field of an image, valid while its image_view and the image buffer are
+ */
+class image_field
+{
+public:
+  image_field() = default;
+
+  explicit operator bool() const noexcept { return nullptr != view_; }
+
+  types       type() const { return types(node().type); }
+  int         id() const { return node().id; }
+  std::size_t size() const { return node().child_count; }
+
+  std::size_t   value_count() const { return node().value_count; }
+  std::uint64_t value(std::size_t index) const;
+
+  std::size_t binary_count() const { return node().string_count; }
+  const char* binary_data(std::size_t index) const;
+  std::size_t binary_size(std::size_t index) const;
+  std::string binary(std::size_t index) const { return std::string(binary_data(index), binary_size(index)); }
+
+  /**
+   * \brief first sub field, empty handle if none
+   */
+  image_field first_child() const
+  {
+    auto _end = std::size_t(node().end);
+    return (index_ + 1 < _end) ? image_field(view_, index_ + 1, _end) : image_field();
+  }
+
+  /**
+   * \brief next field of the same parent, empty handle after the last one
+   */
+  image_field next() const
+  {
+    auto _next = std::size_t(node().end);
+    return (_next < parent_end_) ? image_field(view_, _next, parent_end_) : image_field();
+  }
+
+  /**
+   * \brief sub field by id
+   * \return empty handle if id not exists
+   */
+  image_field id(int id) const
+  {
+    for (auto f = first_child(); f; f = f.next())
+    {
+      if (id == f.id()) return f;
+    }
+    return image_field();
+  }
+
+  image_field operator[](int id) const { return this->id(id); }
+
+  /**
+   * \brief sub field at index
+   * \return empty handle if index out of range
+   */
+  image_field at(std::size_t index) const
+  {
+    for (auto f = first_child(); f; f = f.next())
+    {
+      if (0 == index--) return f;
+    }
+    return image_field();
+  }
+
+private:
+  friend class image_view;
+
+  image_field(const image_view* view, std::size_t index, std::size_t parent_end)
+    : view_(view)
+    , index_(index)
+    , parent_end_(parent_end)
+  {}
+
+  detail::image_node node() const;
+
+  const image_view* view_       = nullptr;
+  std::size_t       index_      = 0;
+  std::size_t       parent_end_ = 0; // end of the parent subtree, where siblings stop
+};
+
+/**
+ * \brief read only view of a tree image in a caller owned buffer, e.g. a mapped file
+ *   open() checks every index of the image once, fields are then read in place without decoding
+ */
+class image_view
+{
+public:
+  image_view() = default;
+
+  /**
+   * \brief check an image and view it, the buffer must outlive the view
+   * \return false if data is not a valid image of this version and byte order
+   */
+  bool open(const void* data, std::size_t size)
+  {
+    *this = image_view();
+
+    detail::image_header _header;
+    if (size < sizeof(_header)) return false;
+    std::memcpy(&_header, data, sizeof(_header));
+    if (0 != std::memcmp(_header.magic, detail::IMAGE_MAGIC, sizeof(_header.magic)) ||
+        detail::IMAGE_VERSION != _header.version || detail::IMAGE_BYTE_ORDER != _header.byte_order)
+      return false;
+
+    // section sizes, each count bounded by size first so the products do not overflow
+    std::uint64_t _left = size - sizeof(_header);
+    if (_header.node_count == 0 || _header.node_count > _left / sizeof(detail::image_node)) return false;
+    _left -= _header.node_count * sizeof(detail::image_node);
+    if (_header.value_count > _left / sizeof(std::uint64_t)) return false;
+    _left -= _header.value_count * sizeof(std::uint64_t);
+    if (_header.string_count > _left / sizeof(detail::image_string)) return false;
+    _left -= _header.string_count * sizeof(detail::image_string);
+    if (_header.pool_size != _left) return false;
+
+    header_  = _header;
+    nodes_   = static_cast<const unsigned char*>(data) + sizeof(_header);
+    values_  = nodes_ + _header.node_count * sizeof(detail::image_node);
+    strings_ = values_ + _header.value_count * sizeof(std::uint64_t);
+    pool_    = strings_ + _header.string_count * sizeof(detail::image_string);
+
+    if (!check())
+    {
+      *this = image_view();
+      return false;
+    }
+    return true;
+  }
+
+  explicit operator bool() const noexcept { return nullptr != nodes_; }
+
+  /**
+   * \brief key passed to write_image()
+   */
+  std::uint64_t key() const { return header_.key; }
+
+  /**
+   * \brief the saved message, its sub fields are the fields of the decoded input
+   */
+  image_field root() const { return *this ? image_field(this, 0, std::size_t(header_.node_count)) : image_field(); }
+
+  /**
+   * \brief build a message tree from the image, no raw spans, serialize() encodes the fields
+   */
+  message to_message() const { return to_message(root()); }
+
+  /**
+   * \brief build a message tree from one field of this image and its sub fields
+   */
+  message to_message(const image_field& field) const
+  {
+    message _result;
+    if (this != field.view_) return _result;
+
+    struct frame
+    {
+      message*    msg;
+      std::size_t end;
+    };
+    std::vector<frame> _stack;
+
+    auto _end = std::size_t(node(field.index_).end);
+    for (auto i = field.index_; i < _end; ++i)
+    {
+      while (!_stack.empty() && _stack.back().end == i)
+      {
+        _stack.pop_back();
+      }
+
+      auto     _node = node(i);
+      message* _msg  = &_result;
+      if (!_stack.empty()) _msg = &_stack.back().msg->childs_.emplace_back();
+
+      _msg->type_ = types(_node.type);
+      _msg->id_   = _node.id;
+      _msg->values_.reserve(_node.value_count);
+      for (std::size_t v = 0; v < _node.value_count; ++v)
+      {
+        _msg->values_.push_back(value(std::size_t(_node.values) + v));
+      }
+      _msg->binary_values_.reserve(_node.string_count);
+      for (std::size_t s = 0; s < _node.string_count; ++s)
+      {
+        auto _string = string(std::size_t(_node.strings) + s);
+        _msg->binary_values_.emplace_back(reinterpret_cast<const char*>(pool_ + _string.offset),
+                                          std::size_t(_string.size));
+      }
+      if (i + 1 < _node.end) _stack.push_back(frame{_msg, std::size_t(_node.end)});
+    }
+    return _result;
+  }
+
+private:
+  friend class image_field;
+
+  detail::image_node   node(std::size_t index) const { return detail::load_pod<detail::image_node>(nodes_, index); }
+  std::uint64_t        value(std::size_t index) const { return detail::load_pod<std::uint64_t>(values_, index); }
+  detail::image_string string(std::size_t index) const
+  {
+    return detail::load_pod<detail::image_string>(strings_, index);
+  }
+
+  /**
+   * \brief every subtree nested in its parent, child counts right, value and string ranges inside their sections
+   */
+  bool check() const
+  {
+    struct frame
+    {
+      std::uint64_t end;
+      std::uint32_t childs; // children expected but not seen yet
+    };
+    std::vector<frame> _stack;
+
+    for (std::uint64_t i = 0; i < header_.node_count; ++i)
+    {
+      while (!_stack.empty() && _stack.back().end == i)
+      {
+        if (0 != _stack.back().childs) return false;
+        _stack.pop_back();
+      }
+
+      auto _node = node(std::size_t(i));
+      if (_node.end <= i || _node.end > header_.node_count) return false;
+      if (0 == i && _node.end != header_.node_count) return false;
+      if (_node.type > std::uint32_t(type_repeat)) return false;
+      if (_node.values > header_.value_count || _node.value_count > header_.value_count - _node.values)
+        return false;
+      if (_node.strings > header_.string_count || _node.string_count > header_.string_count - _node.strings)
+        return false;
+
+      if (!_stack.empty())
+      {
+        if (_node.end > _stack.back().end || 0 == _stack.back().childs) return false;
+        --_stack.back().childs;
+      }
+      if (i + 1 < _node.end)
+        _stack.push_back(frame{_node.end, _node.child_count});
+      else if (0 != _node.child_count)
+        return false;
+    }
+    while (!_stack.empty())
+    {
+      if (0 != _stack.back().childs) return false;
+      _stack.pop_back();
+    }
+
+    for (std::uint64_t i = 0; i < header_.string_count; ++i)
+    {
+      auto _string = string(std::size_t(i));
+      if (_string.offset > header_.pool_size || _string.size > header_.pool_size - _string.offset) return false;
+    }
+    return true;
+  }
+
+  detail::image_header header_  = detail::image_header();
+  const unsigned char* nodes_   = nullptr;
+  const unsigned char* values_  = nullptr;
+  const unsigned char* strings_ = nullptr;
+  const unsigned char* pool_    = nullptr;
+};
+
+inline detail::image_node image_field::node() const
+{
+  if (view_) return view_->node(index_);
+
+  detail::image_node _empty{};
+  _empty.type = std::uint32_t(type_undefined);
+  return _empty;
+}
+
+inline std::uint64_t image_field::value(std::size_t index) const
+{
+  return view_->value(std::size_t(node().values) + index);
+}
+
+inline const char* image_field::binary_data(std::size_t index) const
+{
+  return reinterpret_cast<const char*>(view_->pool_ + view_->string(std::size_t(node().strings) + index).offset);
+}
+
+inline std::size_t image_field::binary_size(std::size_t index) const
+{
+  return std::size_t(view_->string(std::size_t(node().strings) + index).size);
+}
+
+} // namespace proto
+
+#endif // !__PROTO_IMAGE_HPP__
@@ -0,0 +1,288 @@
+#ifndef __PROTO_PARALLEL_HPP__
+#define __PROTO_PARALLEL_HPP__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#  pragma once
+#endif // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+/**
+ * worker threads for the parallel printers of proto_print.hpp and message::serialize_parallel()
+ *
+ *   proto::thread_pool pool;                      // hardware threads but the calling one
+ *   std::string bin = msg.serialize_parallel(pool);
+ *   std::string txt = proto::to_string_parallel(msg, pool);
+ *
+ * proto.hpp only declares thread_pool, programs without a pool do not pull in the thread headers
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "proto.hpp"
+
+namespace proto {
+
+/**
+ * \brief fixed set of worker threads, parallel printing and encoding spread their pieces over it
+ *   tasks must not call run() of the pool they run on
+ */
+class thread_pool
+{
+public:
+  /**
+   * \param threads workers besides the thread calling run(), 0 runs every task on the caller
+   */
+  explicit thread_pool(std::size_t threads = default_threads())
+  {
+    for (std::size_t i = 0; i < threads; ++i)
+    {
+      workers_.emplace_back([this] { work(); });
+    }
+  }
+
+  thread_pool(const thread_pool&)            = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+
+  ~thread_pool()
+  {
+    {
+      std::lock_guard<std::mutex> _lock(mutex_);
+      stop_ = true;
+    }
+    ready_.notify_all();
+    for (auto& t : workers_) t.join();
+  }
+
+  /**
+   * \brief hardware threads but the calling one
+   */
+  static std::size_t default_threads()
+  {
+    auto _threads = std::size_t(std::thread::hardware_concurrency());
+    return _threads > 1 ? _threads - 1 : 0;
+  }
+
+  std::size_t size() const { return workers_.size(); }
+
+  /**
+   * \brief task(i) for every i below count, on the workers and the calling thread, returns when all ran
+   *   a task that throws stops the tasks not started yet, run() waits for the running ones and rethrows the
+   *   first exception on the calling thread
+   */
+  template<typename Task>
+  void run(std::size_t count, Task&& task)
+  {
+    std::atomic<std::size_t> _next{0};
+    std::exception_ptr       _error; // first exception of a task, guarded by mutex_
+    auto                     _drain = [&] {
+      try
+      {
+        for (auto i = _next++; i < count; i = _next++) task(i);
+      }
+      catch (...)
+      {
+        _next = count;
+        std::lock_guard<std::mutex> _lock(mutex_);
+        if (!_error) _error = std::current_exception();
+      }
+    };
+
+    auto        _helpers = count > 1 ? std::min(workers_.size(), count - 1) : std::size_t(0);
+    std::size_t _done    = 0; // helpers finished, guarded by mutex_
+    if (_helpers > 0)
+    {
+      {
+        std::lock_guard<std::mutex> _lock(mutex_);
+        std::size_t                 _queued = 0;
+        try
+        {
+          for (; _queued < _helpers; ++_queued)
+          {
+            tasks_.emplace_back([&] {
+              _drain();
+              std::lock_guard<std::mutex> _done_lock(mutex_);
+              ++_done;
+              finished_.notify_all();
+            });
+          }
+        }
+        catch (...)
+        {
+          // the caller drains what the helpers that could not be queued would have run
+          _helpers = _queued;
+        }
+      }
+      ready_.notify_all();
+    }
+
+    _drain();
+
+    {
+      std::unique_lock<std::mutex> _lock(mutex_);
+      finished_.wait(_lock, [&] { return _done == _helpers; });
+    }
+    if (_error) std::rethrow_exception(_error);
+  }
+
+private:
+  void work()
+  {
+    while (true)
+    {
+      std::function<void()> _task;
+      {
+        std::unique_lock<std::mutex> _lock(mutex_);
+        ready_.wait(_lock, [this] { return stop_ || !tasks_.empty(); });
+        if (tasks_.empty()) return;
+        _task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      _task();
+    }
+  }
+
+  std::vector<std::thread>          workers_;
+  std::deque<std::function<void()>> tasks_;
+  std::mutex                        mutex_;
+  std::condition_variable           ready_;    // tasks_ filled or stop_ set
+  std::condition_variable           finished_; // a helper of run() finished
+  bool                              stop_ = false;
+};
+
+namespace detail {
+/**
+ * \brief where the keys written in place and the pieces of serialize_parallel() go in the output
+ */
+struct serialize_plan
+{
+  struct header
+  {
+    std::size_t offset;
+    std::string bytes; // a group or packed key and length, or a group end key
+  };
+
+  struct piece
+  {
+    std::size_t                 offset = 0;
+    std::size_t                 size   = 0;
+    std::vector<const message*> fields; // siblings encoded one after another
+  };
+
+  explicit serialize_plan(std::size_t piece_bytes)
+    : piece_bytes(piece_bytes)
+  {}
+
+  std::size_t         piece_bytes;
+  std::vector<header> headers;
+  std::vector<piece>  pieces;
+};
+} // namespace detail
+
+inline std::string message::serialize_parallel(thread_pool& pool, std::size_t piece_bytes) const
+{
+  PROTO_TRACE_SCOPE("serialize_parallel");
+  if (raw_ || childs_.empty()) return serialize();
+
+  detail::serialize_plan _plan(piece_bytes > 0 ? piece_bytes : 1);
+  std::string            _result;
+  {
+    PROTO_TRACE_SCOPE("calc_serialized_size");
+    _result.resize(plan_serialize(_plan, pool, *this, 0));
+  }
+
+  // keys of the fields cut into pieces, then the pieces
+  auto _buffer = &_result[0];
+  for (const auto& h : _plan.headers)
+  {
+    std::memcpy(_buffer + h.offset, h.bytes.data(), h.bytes.size());
+  }
+  pool.run(_plan.pieces.size(), [&](std::size_t i) {
+    detail::slot_writer _writer{_buffer + _plan.pieces[i].offset};
+    for (auto f : _plan.pieces[i].fields)
+    {
+      serialize(_writer, *f);
+    }
+  });
+  return _result;
+}
+
+inline std::size_t message::plan_serialize(
+  detail::serialize_plan& plan, thread_pool& pool, const message& msg, std::size_t offset) const
+{
+  const auto                  _limit = 4 * plan.piece_bytes;
+  std::vector<const message*> _fields;
+  _fields.reserve(msg.childs_.size());
+  for (const auto& f : msg.childs_) _fields.push_back(&f);
+
+  std::vector<std::size_t> _sizes(_fields.size());
+  auto                     _blocks = std::min(_fields.size(), 4 * (pool.size() + 1));
+  pool.run(_blocks, [&](std::size_t b) {
+    for (auto i = b * _fields.size() / _blocks; i < (b + 1) * _fields.size() / _blocks; ++i)
+    {
+      _sizes[i] = calc_serialized_size_below(*_fields[i], _limit);
+    }
+  });
+
+  // sub fields from 0, moved behind the key once the size of msg is known
+  auto        _first_header = plan.headers.size();
+  auto        _first_piece  = plan.pieces.size();
+  std::size_t _pos          = 0;
+  for (std::size_t i = 0; i < _fields.size(); ++i)
+  {
+    const auto& f = *_fields[i];
+    if (_sizes[i] >= _limit && !f.raw_ && !f.childs_.empty())
+    {
+      _pos += plan_serialize(plan, pool, f, _pos);
+      continue;
+    }
+
+    // siblings with nothing written between them share a piece until it is large enough
+    auto& _pieces = plan.pieces;
+    if (_pieces.size() == _first_piece || _pieces.back().offset + _pieces.back().size != _pos
+        || _pieces.back().size >= plan.piece_bytes)
+    {
+      _pieces.emplace_back();
+      _pieces.back().offset = _pos;
+    }
+    _pieces.back().size += _sizes[i];
+    _pieces.back().fields.push_back(&f);
+    _pos += _sizes[i];
+  }
+
+  // the key of a group or packed field before its sub fields, as serialize() writes it
+  std::string _open;
+  if (type_group == msg.type_)
+  {
+    _open = encode_key(type_group, msg.id_);
+  }
+  else if (type_packed == msg.type_)
+  {
+    _open = encode_key(type_binary, msg.id_);
+    _open += encode_varint(_pos);
+  }
+
+  auto _shift = offset + _open.size();
+  for (auto i = _first_header; i < plan.headers.size(); ++i) plan.headers[i].offset += _shift;
+  for (auto i = _first_piece; i < plan.pieces.size(); ++i) plan.pieces[i].offset += _shift;
+
+  auto _size = _open.size() + _pos;
+  if (!_open.empty()) plan.headers.push_back(detail::serialize_plan::header{offset, std::move(_open)});
+  if (type_group == msg.type_)
+  {
+    plan.headers.push_back(detail::serialize_plan::header{offset + _size, encode_key(type_end, msg.id_)});
+    _size += plan.headers.back().bytes.size();
+  }
+  return _size;
+}
+
+} // namespace proto
+
+#endif // !__PROTO_PARALLEL_HPP__
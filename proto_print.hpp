@@ -0,0 +1,776 @@
+#ifndef __PROTO_PRINT_HPP__
+#define __PROTO_PRINT_HPP__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#  pragma once
+#endif // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include <charconv>
+#include <string>
+#include <vector>
+#include "proto.hpp"
+#include "proto_parallel.hpp"
+
+namespace proto {
+
+inline char byte_to_hex(unsigned char b, bool lower = true)
+{
+  static const char* hex_map[2] = {"0123456789ABCDEF", "0123456789abcdef"};
+
+  return hex_map[int(lower)][int(b)];
+}
+
+/**
+ * \brief convert un-printable character to escape sequences
+ */
+inline std::string to_readable_string(const void* data, size_t len)
+{
+  using byte_p_t = unsigned char*;
+
+  std::string _result;
+  _result.reserve(len * 3);
+
+  for (std::size_t i = 0; i < len; i++)
+  {
+    auto c = (byte_p_t(data))[i];
+    if (c > 31 && c < 127 && c != '\"' && c != '\'')
+    {
+      _result += c;
+    }
+    else
+    {
+      // write "\xhh"
+      _result += "\\x";
+      _result += byte_to_hex((c >> 4) & 0x0f);
+      _result += byte_to_hex(c & 0x0f);
+    }
+  }
+  return _result;
+}
+
+
+/**
+ * \brief print payload as an array if scalars take it for packed repeated scalars
+ * \return false if payload is left to the caller
+ */
+inline bool to_scalars_string(std::string& result, int id, const void* payload, std::size_t size, int leftspace,
+  int show_type, const packed_scalar_options& scalars)
+{
+  static const char* _kind_desc[] = {"", "varint", "fixed32", "fixed64"};
+
+  auto _kind = classify_packed(payload, size, scalars);
+  if (packed_none == _kind) return false;
+
+  std::vector<std::uint64_t> _values;
+  if (!decode_packed(payload, size, _kind, _values)) return false;
+
+  // 1 : [1, 2, 3], /* packed varint */
+  result += std::string(leftspace, ' ');
+  result += std::to_string(id);
+  result += " : [";
+
+  // written in place, 20 digits and a separator at most per value
+  auto _begin = result.size();
+  result.resize(_begin + _values.size() * 22);
+  auto _out = &result[_begin];
+  for (std::size_t i = 0; i < _values.size(); ++i)
+  {
+    if (0 != i)
+    {
+      *_out++ = ',';
+      *_out++ = ' ';
+    }
+    _out = std::to_chars(_out, _out + 20, _values[i]).ptr;
+  }
+  result.resize(std::size_t(_out - result.data()));
+  result += "],";
+  if (show_type > 0)
+  {
+    result += " /* packed ";
+    result += _kind_desc[int(_kind)];
+    result += " */";
+  }
+  result += '\n';
+  return true;
+}
+
+const std::size_t PRINT_PIECE_BYTES = 256 * 1024; // estimated printed bytes per task of the parallel printers
+
+namespace detail {
+/**
+ * \brief estimated printed bytes of msg and its sub fields, counting stops at limit
+ */
+inline std::size_t print_cost(const message& msg, std::size_t limit)
+{
+  std::size_t _cost = 16 + 16 * msg.values_.size();
+  for (const auto& v : msg.binary_values_)
+  {
+    _cost += 16 + v.size();
+  }
+  for (const auto& f : msg.childs_)
+  {
+    if (_cost >= limit) break;
+    _cost += print_cost(f, limit - _cost);
+  }
+  return _cost;
+}
+
+/**
+ * \brief runs of sibling fields cut out of a serial print, printed on a thread pool and put back in order
+ *   the serial print keeps the lines of fields too large for one piece and descends into them
+ */
+class print_split
+{
+public:
+  struct piece
+  {
+    std::size_t                 offset    = 0; // where text goes in the serial output
+    int                         leftspace = 0; // given to the printer of each field
+    int                         depth     = 0;
+    std::size_t                 cost      = 0;
+    std::vector<const message*> fields;        // siblings printed one after another
+    std::string                 text;
+  };
+
+  explicit print_split(std::size_t piece_bytes)
+    : piece_bytes_(piece_bytes > 0 ? piece_bytes : 1)
+  {}
+
+  /**
+   * \brief take f into a piece, false if f has sub fields and is too large for one, it is printed in place
+   * \param offset size of the serial output so far
+   */
+  bool take(const message& f, int leftspace, int depth, std::size_t offset)
+  {
+    auto _cost = print_cost(f, 4 * piece_bytes_);
+    if (_cost >= 4 * piece_bytes_ && !f.childs_.empty()) return false;
+
+    // siblings with nothing printed between them share a piece until it is large enough
+    if (pieces_.empty() || pieces_.back().offset != offset || pieces_.back().leftspace != leftspace
+        || pieces_.back().depth != depth || pieces_.back().cost >= piece_bytes_)
+    {
+      pieces_.emplace_back();
+      pieces_.back().offset    = offset;
+      pieces_.back().leftspace = leftspace;
+      pieces_.back().depth     = depth;
+    }
+    pieces_.back().cost += _cost;
+    pieces_.back().fields.push_back(&f);
+    return true;
+  }
+
+  /**
+   * \brief print(text, piece) every piece on pool, then write(data, size) the serial output with the pieces in
+   *   place, each piece is freed once written
+   */
+  template<typename Print, typename Write>
+  void write(const std::string& serial, thread_pool& pool, Print&& print, Write&& write)
+  {
+    pool.run(pieces_.size(), [&](std::size_t i) { print(pieces_[i].text, pieces_[i]); });
+
+    std::size_t _pos = 0;
+    for (auto& p : pieces_)
+    {
+      if (p.offset > _pos) write(serial.data() + _pos, p.offset - _pos);
+      if (!p.text.empty()) write(p.text.data(), p.text.size());
+      std::string().swap(p.text);
+      _pos = p.offset;
+    }
+    if (serial.size() > _pos) write(serial.data() + _pos, serial.size() - _pos);
+  }
+
+private:
+  std::size_t        piece_bytes_;
+  std::vector<piece> pieces_;
+};
+} // namespace detail
+
+/**
+ * \brief get human readble string of data struct view
+ * \param split optional, sub fields taken by it are left out of result, see to_string_parallel()
+ */
+inline void to_string(std::string& result, const message& msg, int indent, int leftspace, int depth, int show_type,
+  bool show_size, const packed_scalar_options* scalars = nullptr, detail::print_split* split = nullptr)
+{
+  auto _cur_leftspace = leftspace + indent;
+
+  if (0 == depth) return;
+
+  if (-1 != depth) --depth;
+
+  switch (msg.type_)
+  {
+  case type_varint:
+  case type_int32:
+  case type_int64:
+  {
+    static const char* _value_type_desc[] = {"varint", "int64", "", "", "", "int32"};
+    for (const auto& value : msg.values_)
+    {
+      // 1 : /* varint */ 12345
+      result += std::string(_cur_leftspace, ' ');
+      result += std::to_string(msg.id_);
+      result += " : ";
+      result += std::to_string(value);
+      result += ',';
+      if (show_type > 0)
+      {
+        result += " /* ";
+        result += _value_type_desc[int(msg.type_)];
+        result += " */ ";
+      }
+      result += '\n';
+    }
+    break;
+  }
+  case type_binary:
+  {
+    for (const auto& value : msg.binary_values_)
+    {
+      if (scalars
+          && to_scalars_string(result, msg.id_, value.data(), value.size(), _cur_leftspace, show_type, *scalars))
+        continue;
+
+      // "1" : "saddf"
+      result += std::string(_cur_leftspace, ' ');
+      result += std::to_string(msg.id_);
+      result += " : \"";
+      result += to_readable_string(value.data(), value.size());
+      result += "\",\n";
+    }
+    break;
+  }
+  case type_group:
+  {
+    // 1 : { /* group */ /* child: 4 */
+    //     1 : xxx
+    // }
+    result += std::string(_cur_leftspace, ' ');
+    result += "";
+    result += std::to_string(msg.id_);
+    result += " : {";
+    if (2 == show_type) result += " /* group */";
+
+    if (show_size)
+    {
+      result += " /* childs: ";
+      result += std::to_string(msg.childs_.size());
+      result += " */\n";
+    }
+    else
+      result += '\n';
+
+    for (const auto& f : msg.childs_)
+    {
+      if (split && split->take(f, _cur_leftspace, depth, result.size())) continue;
+      to_string(result, f, indent, _cur_leftspace, depth, show_type, show_size, scalars, split);
+    }
+    result += std::string(_cur_leftspace, ' ');
+    result += "},\n";
+    break;
+  }
+  case type_packed:
+  {
+    // 1 : { /* packed binary */ /* len: 4 */ /* child: 4 */
+    //     1 : xxx
+    // }
+    if (scalars)
+    {
+      // the kept copy or the decoded span is classified in place, only built sub fields are encoded again
+      std::string _built;
+      auto        _data = msg.payload_data();
+      auto        _size = _data ? msg.payload_size() : 0;
+      if (!_data)
+      {
+        _built = msg.payload();
+        _data  = _built.data();
+        _size  = _built.size();
+      }
+      if (to_scalars_string(result, msg.id_, _data, _size, _cur_leftspace, show_type, *scalars))
+        break;
+    }
+
+    result += std::string(_cur_leftspace, ' ');
+    result += std::to_string(msg.id_);
+    result += " : {";
+    if (show_type > 0) result += " /* packed binary */";
+
+    if (show_size)
+    {
+      // the kept copy, the decoded span or the sub fields as they would be encoded
+      result += " /* len: ";
+      result += std::to_string(msg.payload_size());
+      result += " */ /* child: ";
+      result += std::to_string(msg.childs_.size());
+      result += " */\n";
+    }
+    else
+      result += '\n';
+
+    for (const auto& f : msg.childs_)
+    {
+      if (split && split->take(f, _cur_leftspace, depth, result.size())) continue;
+      to_string(result, f, indent, _cur_leftspace, depth, show_type, show_size, scalars, split);
+    }
+    result += std::string(_cur_leftspace, ' ');
+    result += "},\n";
+    break;
+  }
+  case type_repeat:
+  {
+    result += std::string(_cur_leftspace, ' ');
+    result += "/* repeat count: ";
+    result += std::to_string(msg.childs_.size());
+    result += "*/\n";
+  }
+  default:
+  {
+    for (const auto& f : msg.childs_)
+    {
+      if (split && split->take(f, _cur_leftspace - 2, depth, result.size())) continue;
+      to_string(result, f, indent, _cur_leftspace - 2, depth, show_type, show_size, scalars, split);
+    }
+    break;
+  }
+  }
+}
+
+/**
+ * \brief get human readble string view struct
+ * \param show_type
+ *    control how to show type info
+ *    0: do not show
+ *    1: less (varint, int64, int32, packed)
+ *    2: full (varint, int64, int32, packed, binary, group)
+ * \param show_size
+ *    control how to show size info
+ *    false: do not show
+ *    true: show (packed, binary, group)
+ * \param scalars
+ *    optional, binary and packed fields classify_packed() takes for packed repeated scalars print as arrays
+ * \return readble string
+ */
+inline std::string to_string(const message& msg, int indent = 2, int leftspace = 0, int depth = -1,
+  int show_type = 2, bool show_size = true, const packed_scalar_options* scalars = nullptr)
+{
+  PROTO_TRACE_SCOPE("to_string");
+
+  std::string result;
+  result += "{\n";
+  to_string(result, msg, indent, leftspace, depth, show_type, show_size, scalars);
+  result += "}\n";
+  return result;
+}
+
+/**
+ * \brief to_string() with runs of sub fields printed on pool, the same text given to write(data, size) in order
+ *   in several parts, without joining them first
+ * \param piece_bytes estimated printed bytes per task
+ */
+template<typename Write>
+void to_string_parallel(Write&& write, const message& msg, thread_pool& pool, int indent = 2, int leftspace = 0,
+  int depth = -1, int show_type = 2, bool show_size = true, const packed_scalar_options* scalars = nullptr,
+  std::size_t piece_bytes = PRINT_PIECE_BYTES)
+{
+  PROTO_TRACE_SCOPE("to_string_parallel");
+
+  detail::print_split _split(piece_bytes);
+  std::string         _serial;
+  _serial += "{\n";
+  to_string(_serial, msg, indent, leftspace, depth, show_type, show_size, scalars, &_split);
+  _serial += "}\n";
+
+  _split.write(_serial, pool, [&](std::string& result, const detail::print_split::piece& p) {
+    for (auto f : p.fields)
+    {
+      to_string(result, *f, indent, p.leftspace, p.depth, show_type, show_size, scalars);
+    }
+  }, write);
+}
+
+/**
+ * \brief to_string() with runs of sub fields printed on pool, the same output
+ */
+inline std::string to_string_parallel(const message& msg, thread_pool& pool, int indent = 2, int leftspace = 0,
+  int depth = -1, int show_type = 2, bool show_size = true, const packed_scalar_options* scalars = nullptr,
+  std::size_t piece_bytes = PRINT_PIECE_BYTES)
+{
+  std::string _result;
+  auto        _append = [&](const char* data, std::size_t size) { _result.append(data, size); };
+  to_string_parallel(_append, msg, pool, indent, leftspace, depth, show_type, show_size, scalars, piece_bytes);
+  return _result;
+}
+
+/**
+ * \brief get cpp code
+ * \param split optional, sub fields taken by it are left out of result, see to_cpp_code_parallel()
+ */
+inline void to_cpp_code(std::string& result, const message& msg, int indent, int leftspace, int depth,
+  bool use_namespace, detail::print_split* split = nullptr)
+{
+  auto _cur_leftspace = leftspace + indent;
+
+  if (0 == depth) return;
+
+  if (-1 != depth) --depth;
+
+  switch (msg.type_)
+  {
+  case type_varint:
+  case type_int32:
+  case type_int64:
+  {
+    static const char* _value_type_desc[] = {"varint", "int64", "", "", "", "int32"};
+
+    for (const auto& value : msg.values_)
+    {
+      // proto::varint<1>{ 3 },
+      result += std::string(_cur_leftspace, ' ');
+      if (use_namespace) result += "proto::";
+      result += _value_type_desc[int(msg.type_)];
+      result += "<";
+      result += std::to_string(msg.id_);
+      result += ">{ ";
+      result += std::to_string(value);
+      result += " },\n";
+    }
+  }
+  break;
+  case type_binary:
+  {
+    for (const auto& value : msg.binary_values_)
+    {
+      // proto::binary<2>{ "saddf" },
+      result += std::string(_cur_leftspace, ' ');
+      if (use_namespace) result += "proto::";
+      result += "binary<";
+      result += std::to_string(msg.id_);
+      result += ">{ \"";
+      result += to_readable_string(value.data(), value.size());
+      result += "\" },\n";
+    }
+  }
+  break;
+  case type_group:
+  {
+    // proto::group<3>{
+    result += std::string(_cur_leftspace, ' ');
+    if (use_namespace) result += "proto::";
+    result += "group<";
+    result += std::to_string(msg.id_);
+    result += ">{\n";
+
+    for (const auto& f : msg.childs_)
+    {
+      if (split && split->take(f, _cur_leftspace, depth, result.size())) continue;
+      to_cpp_code(result, f, indent, _cur_leftspace, depth, use_namespace, split);
+    }
+
+    result += std::string(_cur_leftspace, ' ');
+    result += "},\n";
+  }
+  break;
+  case type_packed:
+  {
+    // proto::packed<4>{
+    result += std::string(_cur_leftspace, ' ');
+    if (use_namespace) result += "proto::";
+    result += "packed<";
+    result += std::to_string(msg.id_);
+    result += ">{\n";
+
+    for (const auto& f : msg.childs_)
+    {
+      if (split && split->take(f, _cur_leftspace, depth, result.size())) continue;
+      to_cpp_code(result, f, indent, _cur_leftspace, depth, use_namespace, split);
+    }
+    result += std::string(_cur_leftspace, ' ');
+    result += "},\n";
+    break;
+  }
+  default:
+  {
+    for (const auto& f : msg.childs_)
+    {
+      if (split && split->take(f, _cur_leftspace - 2, depth, result.size())) continue;
+      to_cpp_code(result, f, indent, _cur_leftspace - 2, depth, use_namespace, split);
+    }
+  }
+  break;
+  }
+}
+
+/**
+ * \brief get cpp code
+ */
+inline std::string to_cpp_code(const message& msg, int indent = 2, int leftspace = 0, int depth = -1,
+  bool use_namespace = false)
+{
+  PROTO_TRACE_SCOPE("to_cpp_code");
+
+  std::string result;
+  result += "{\n";
+  to_cpp_code(result, msg, indent, leftspace, depth, use_namespace);
+  result += "}\n";
+  return result;
+}
+
+/**
+ * \brief to_cpp_code() with runs of sub fields printed on pool, the same text given to write(data, size) in order
+ *   in several parts, without joining them first
+ * \param piece_bytes estimated printed bytes per task
+ */
+template<typename Write>
+void to_cpp_code_parallel(Write&& write, const message& msg, thread_pool& pool, int indent = 2, int leftspace = 0,
+  int depth = -1, bool use_namespace = false, std::size_t piece_bytes = PRINT_PIECE_BYTES)
+{
+  PROTO_TRACE_SCOPE("to_cpp_code_parallel");
+
+  detail::print_split _split(piece_bytes);
+  std::string         _serial;
+  _serial += "{\n";
+  to_cpp_code(_serial, msg, indent, leftspace, depth, use_namespace, &_split);
+  _serial += "}\n";
+
+  _split.write(_serial, pool, [&](std::string& result, const detail::print_split::piece& p) {
+    for (auto f : p.fields)
+    {
+      to_cpp_code(result, *f, indent, p.leftspace, p.depth, use_namespace);
+    }
+  }, write);
+}
+
+/**
+ * \brief to_cpp_code() with runs of sub fields printed on pool, the same output
+ */
+inline std::string to_cpp_code_parallel(const message& msg, thread_pool& pool, int indent = 2, int leftspace = 0,
+  int depth = -1, bool use_namespace = false, std::size_t piece_bytes = PRINT_PIECE_BYTES)
+{
+  std::string _result;
+  auto        _append = [&](const char* data, std::size_t size) { _result.append(data, size); };
+  to_cpp_code_parallel(_append, msg, pool, indent, leftspace, depth, use_namespace, piece_bytes);
+  return _result;
+}
+
+namespace detail {
+/**
+ * \brief visit nodes of a flat message front to back with the left space the message printers give them
+ *   open(node, index, leftspace) for every printed node, close(node, leftspace) after the sub fields of
+ *   group and packed nodes, nodes below depth are skipped
+ */
+template<typename Open, typename Close>
+void walk_flat(const flat_message& msg, int indent, int leftspace, int depth, Open&& open, Close&& close)
+{
+  struct frame
+  {
+    std::size_t end;
+    int         leftspace;       // of the node, its closing line
+    int         child_leftspace; // passed to sub fields
+    int         child_depth;
+  };
+  std::vector<frame> _stack;
+
+  auto _close = [&]() {
+    const auto& f = _stack.back();
+    if (f.leftspace >= 0) close(f.leftspace);
+    _stack.pop_back();
+  };
+
+  const auto& _nodes = msg.nodes();
+  for (std::size_t i = 0; i < _nodes.size();)
+  {
+    while (!_stack.empty() && _stack.back().end == i)
+    {
+      _close();
+    }
+
+    const auto& _node   = _nodes[i];
+    auto        _left   = _stack.empty() ? leftspace : _stack.back().child_leftspace;
+    auto        _depth  = _stack.empty() ? depth : _stack.back().child_depth;
+    auto        _cur    = _left + indent;
+    if (0 == _depth)
+    {
+      i = _node.end;
+      continue;
+    }
+    if (-1 != _depth) --_depth;
+
+    open(_node, i, _cur);
+    switch (_node.type)
+    {
+    case type_varint:
+    case type_int32:
+    case type_int64:
+    case type_binary: break;
+    case type_group:
+    case type_packed: _stack.push_back(frame{_node.end, _cur, _cur, _depth}); break;
+    default: _stack.push_back(frame{_node.end, -1, _cur - 2, _depth}); break;
+    }
+    ++i;
+  }
+  while (!_stack.empty())
+  {
+    _close();
+  }
+}
+
+/**
+ * \brief sub fields of the node at index
+ */
+inline std::size_t flat_child_count(const flat_message& msg, std::size_t index)
+{
+  std::size_t _count = 0;
+  for (auto j = index + 1; j < msg[index].end; j = msg[j].end)
+  {
+    ++_count;
+  }
+  return _count;
+}
+} // namespace detail
+
+/**
+ * \brief get human readble string of a flat message, see to_string(const message&)
+ *   fields are printed in input order, a repeated field is printed once per occurrence without a repeat count
+ */
+inline std::string to_string(const flat_message& msg, int indent = 2, int leftspace = 0, int depth = -1,
+  int show_type = 2, bool show_size = true)
+{
+  PROTO_TRACE_SCOPE("flat_to_string");
+
+  static const char* _value_type_desc[] = {"varint", "int64", "", "", "", "int32"};
+
+  std::string result;
+  result += "{\n";
+  detail::walk_flat(
+    msg, indent, leftspace, depth,
+    [&](const flat_node& node, std::size_t index, int leftspace) {
+      switch (node.type)
+      {
+      case type_varint:
+      case type_int32:
+      case type_int64:
+      {
+        result += std::string(leftspace, ' ');
+        result += std::to_string(node.id);
+        result += " : ";
+        result += std::to_string(node.value);
+        result += ',';
+        if (show_type > 0)
+        {
+          result += " /* ";
+          result += _value_type_desc[int(node.type)];
+          result += " */ ";
+        }
+        result += '\n';
+        break;
+      }
+      case type_binary:
+      {
+        result += std::string(leftspace, ' ');
+        result += std::to_string(node.id);
+        result += " : \"";
+        result += to_readable_string(msg.binary_data(node), node.size);
+        result += "\",\n";
+        break;
+      }
+      case type_group:
+      {
+        result += std::string(leftspace, ' ');
+        result += std::to_string(node.id);
+        result += " : {";
+        if (2 == show_type) result += " /* group */";
+
+        if (show_size)
+        {
+          result += " /* childs: ";
+          result += std::to_string(detail::flat_child_count(msg, index));
+          result += " */\n";
+        }
+        else
+          result += '\n';
+        break;
+      }
+      case type_packed:
+      {
+        result += std::string(leftspace, ' ');
+        result += std::to_string(node.id);
+        result += " : {";
+        if (show_type > 0) result += " /* packed binary */";
+
+        if (show_size)
+        {
+          result += " /* len: ";
+          result += std::to_string(node.size);
+          result += " */ /* child: ";
+          result += std::to_string(detail::flat_child_count(msg, index));
+          result += " */\n";
+        }
+        else
+          result += '\n';
+        break;
+      }
+      default: break;
+      }
+    },
+    [&](int leftspace) {
+      result += std::string(leftspace, ' ');
+      result += "},\n";
+    });
+  result += "}\n";
+  return result;
+}
+
+/**
+ * \brief get cpp code of a flat message, fields in input order
+ */
+inline std::string to_cpp_code(const flat_message& msg, int indent = 2, int leftspace = 0, int depth = -1,
+  bool use_namespace = false)
+{
+  PROTO_TRACE_SCOPE("flat_to_cpp_code");
+
+  static const char* _type_desc[] = {"varint", "int64", "binary", "group", "", "int32", "", "", "", "packed"};
+
+  std::string result;
+  result += "{\n";
+  detail::walk_flat(
+    msg, indent, leftspace, depth,
+    [&](const flat_node& node, std::size_t, int leftspace) {
+      if (type_undefined == node.type || type_repeat == node.type) return;
+
+      // proto::varint<1>{ 3 }, proto::binary<2>{ "saddf" }, proto::group<3>{
+      result += std::string(leftspace, ' ');
+      if (use_namespace) result += "proto::";
+      result += _type_desc[int(node.type)];
+      result += "<";
+      result += std::to_string(node.id);
+      switch (node.type)
+      {
+      case type_binary:
+      {
+        result += ">{ \"";
+        result += to_readable_string(msg.binary_data(node), node.size);
+        result += "\" },\n";
+        break;
+      }
+      case type_group:
+      case type_packed: result += ">{\n"; break;
+      default:
+      {
+        result += ">{ ";
+        result += std::to_string(node.value);
+        result += " },\n";
+        break;
+      }
+      }
+    },
+    [&](int leftspace) {
+      result += std::string(leftspace, ' ');
+      result += "},\n";
+    });
+  result += "}\n";
+  return result;
+}
+
+} // namespace proto
+
+#endif // !__PROTO_PRINT_HPP__
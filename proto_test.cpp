@@ -0,0 +1,434 @@
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "proto.hpp"
+#include "proto_image.hpp"
+#include "proto_parallel.hpp"
+#include "proto_print.hpp"
+
+namespace {
+int g_failed = 0;
+
+void expect(bool ok, const char* what)
+{
+  if (ok) return;
+  std::fprintf(stderr, "failed: %s\n", what);
+  ++g_failed;
+}
+
+/**
+ * \brief a packed field 2 holding varint 1 = 1, decoded from a shared buffer so it keeps its span
+ */
+proto::message decoded_packed()
+{
+  proto::message _inner{proto::type_packed, 2};
+  _inner.append_child(proto::message{proto::type_varint, 1, std::uint64_t(1)});
+  proto::message _root;
+  _root.append_child(_inner);
+
+  proto::message _msg;
+  _msg.deserialize(std::make_shared<const std::string>(_root.serialize()));
+  return _msg;
+}
+
+/**
+ * \brief an edited child of a decoded packed field is encoded again under a length prefix of the new size
+ */
+void test_edited_packed_child()
+{
+  // 0x4000 takes 3 varint bytes
+  auto _value = decoded_packed();
+  _value.id(2).id(1).set_value(std::uint64_t(0x4000));
+  auto _out = _value.serialize();
+  expect(std::string("\x12\x04\x08\x80\x80\x01", 6) == _out, "packed length prefix after a large value");
+
+  proto::message _back;
+  expect(_back.deserialize(_out) && 0x4000 == _back.id(2).id(1).value(), "large value decodes again");
+
+  // the key of field 20 takes 2 bytes
+  auto _id = decoded_packed();
+  _id.id(2).set_child(proto::message{proto::type_varint, 20, std::uint64_t(6)});
+  _out = _id.serialize();
+  expect(std::string("\x12\x03\xa0\x01\x06", 5) == _out, "packed length prefix after a key of 2 bytes");
+  proto::message _again;
+  expect(_again.deserialize(_out) && 6 == _again.id(2).id(20).value(), "field 20 decodes again");
+}
+
+/**
+ * \brief packed_copies = false keeps the bytes of packed fields when no span of the input is kept
+ */
+void test_packed_without_copies()
+{
+  // field 2 twice, "x" then a packed varint 1 in the non canonical form 81 00
+  const std::string _bin("\x12\x01\x78\x12\x03\x08\x81\x00", 8);
+  proto::decode_options _options;
+  _options.packed_copies = false;
+
+  proto::message _copied;
+  expect(_copied.deserialize(_bin, _options) && _copied.serialize() == _bin, "const std::string& keeps packed bytes");
+
+  std::size_t    _length = _bin.size();
+  proto::message _pointer;
+  expect(_pointer.deserialize(_bin.data(), &_length, _options) && _pointer.serialize() == _bin,
+    "const void* keeps packed bytes");
+
+  proto::message _shared;
+  expect(_shared.deserialize(std::make_shared<const std::string>(_bin), _options) && _shared.serialize() == _bin,
+    "shared buffer reads packed bytes from its span");
+}
+
+/**
+ * \brief a packed field built in code prints the size it encodes to
+ */
+void test_print_built_packed_size()
+{
+  proto::message _packed{proto::type_packed, 2};
+  _packed.append_child(proto::message{proto::type_varint, 1, std::uint64_t(1)});
+  proto::message _root;
+  _root.append_child(_packed);
+
+  auto _text = proto::to_string(_root);
+  expect(std::string::npos != _text.find("/* len: 2 */"), "built packed field prints its length");
+}
+
+/**
+ * \brief only the std::string&& and shared buffer overloads keep spans of the input
+ */
+void test_copying_overloads_keep_no_span()
+{
+  proto::message _source{proto::type_group, 3};
+  _source.append_child(proto::message{proto::type_varint, 1, std::uint64_t(7)});
+  auto _bin = proto::message{_source}.serialize();
+
+  proto::message _copied;
+  expect(_copied.deserialize(_bin) && !_copied.raw_ && _copied.serialize() == _bin, "const std::string& keeps no span");
+
+  std::size_t    _length = _bin.size();
+  proto::message _pointer;
+  expect(_pointer.deserialize(_bin.data(), &_length) && !_pointer.raw_ && _length == _bin.size(),
+    "const void* keeps no span");
+
+  proto::message _moved;
+  expect(_moved.deserialize(std::string(_bin)) && _moved.raw_ && _moved.serialize() == _bin,
+    "std::string&& keeps a span");
+}
+/**
+ * \brief values_ and binary_values_ keep the std::vector operations code used on them
+ */
+void test_value_vector_operations()
+{
+  proto::message _msg{proto::type_varint, 1, {std::uint64_t(1), std::uint64_t(4)}};
+  _msg.values_.insert(_msg.values_.begin() + 1, {std::uint64_t(2), std::uint64_t(3)});
+  _msg.values_.erase(_msg.values_.begin());
+  expect(3 == _msg.values_.size() && 2 == _msg.values_[0] && 4 == _msg.values_.back(), "insert and erase values");
+
+  _msg.values_.assign(2, 9);
+  expect((proto::small_vector<std::uint64_t, 1>{9, 9}) == _msg.values_, "assign values");
+
+  proto::message _text{proto::type_binary, 2, {std::string("a"), std::string("c")}};
+  _text.binary_values_.insert(_text.binary_values_.begin() + 1, "b");
+  _text.binary_values_.erase(_text.binary_values_.begin(), _text.binary_values_.begin());
+  expect(3 == _text.binary_values_.size() && "b" == _text.binary_values_[1] && "c" == _text.binary_values_[2],
+    "insert strings, erase an empty range");
+}
+
+/**
+ * \brief hashes stay binary, packed values of one field are taken for scalars
+ */
+void test_classify_packed_evidence()
+{
+  // md5("abc") and sha256("abc")
+  const unsigned char _md5[] = {0x90, 0x01, 0x50, 0x98, 0x3c, 0xd2, 0x4f, 0xb0,
+    0xd6, 0x96, 0x3f, 0x7d, 0x28, 0xe1, 0x7f, 0x72};
+  const unsigned char _sha256[] = {0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae,
+    0x22, 0x23, 0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad};
+  proto::packed_scalar_options _fixed;
+  _fixed.fixed = true;
+  expect(proto::packed_none == proto::classify_packed(_md5, sizeof(_md5), _fixed), "md5 stays binary");
+  expect(proto::packed_none == proto::classify_packed(_sha256, sizeof(_sha256), _fixed), "sha256 stays binary");
+
+  const unsigned char _varints[] = {0x01, 0x02, 0x03, 0x96, 0x01, 0x07};
+  expect(proto::packed_varint == proto::classify_packed(_varints, sizeof(_varints)), "varints of one field");
+
+  const float _floats[] = {1.5f, -2.25f, 100.0f, 0.125f};
+  expect(proto::packed_fixed32 != proto::classify_packed(_floats, sizeof(_floats)), "fixed runs are opt-in");
+  expect(proto::packed_fixed32 == proto::classify_packed(_floats, sizeof(_floats), _fixed), "floats");
+}
+
+/**
+ * \brief a throwing task reaches the caller of run() after the other tasks stopped, the pool stays usable
+ */
+void test_pool_rethrows()
+{
+  proto::thread_pool       _pool(2);
+  std::atomic<std::size_t> _ran{0};
+  bool                     _caught = false;
+  try
+  {
+    _pool.run(1000, [&](std::size_t i) {
+      if (3 == i) throw std::runtime_error("task 3");
+      ++_ran;
+    });
+  }
+  catch (const std::runtime_error&)
+  {
+    _caught = true;
+  }
+  expect(_caught && _ran < 1000, "task exception rethrown");
+
+  _ran = 0;
+  _pool.run(100, [&](std::size_t) { ++_ran; });
+  expect(100 == _ran, "pool runs after an exception");
+
+  proto::message _msg;
+  for (auto i = 1; i <= 64; ++i) _msg.append_child(proto::message{proto::type_varint, i, std::uint64_t(i)});
+  expect(_msg.serialize_parallel(_pool, 16) == _msg.serialize(), "serialize_parallel");
+}
+
+/**
+ * \brief a tree with every wire type, a group, a packed field and a value over IOV_MIN_BYTES
+ *   binary values start with 0x07, a key of wire type 7, so they never decode as packed fields
+ */
+proto::message sample_tree()
+{
+  proto::message _group{proto::type_group, 3};
+  _group.append_child(proto::message{proto::type_varint, 1, std::uint64_t(1)});
+  _group.append_child(proto::message{proto::type_int64, 2, std::uint64_t(0x1122334455667788)});
+  _group.append_child(proto::message{proto::type_int32, 3, std::uint64_t(0x11223344)});
+
+  proto::message _packed{proto::type_packed, 4};
+  _packed.append_child(proto::message{proto::type_varint, 1, std::uint64_t(300)});
+  _packed.append_child(proto::message{proto::type_binary, 2, std::string("\x07packed")});
+
+  proto::message _root;
+  _root.append_child(proto::message{proto::type_varint, 1, std::uint64_t(150)});
+  _root.append_child(proto::message{proto::type_binary, 2, std::string("\x07text")});
+  _root.append_child(_group);
+  _root.append_child(_packed);
+  _root.append_child(proto::message{proto::type_binary, 5, std::string(2 * proto::IOV_MIN_BYTES, '\x07')});
+  _root.append_child(proto::message{proto::type_varint, 6, {std::uint64_t(1), std::uint64_t(2), std::uint64_t(3)}});
+  return _root;
+}
+
+/**
+ * \brief handles of a frozen tree share it, a sub field handle keeps it alive, thaw() copies
+ */
+void test_frozen_sharing()
+{
+  auto                  _bin = sample_tree().serialize();
+  proto::frozen_message _root;
+  expect(_root.deserialize(std::make_shared<const std::string>(_bin)) && _root.serialize() == _bin, "frozen decode");
+
+  auto _group = _root.id(3);
+  expect(2 == _root.use_count(), "sub field handle shares the tree");
+  {
+    auto _copy = _root;
+    expect(3 == _group.use_count(), "copies share the tree");
+  }
+
+  _root = proto::frozen_message();
+  expect(_group && 1 == _group.use_count(), "sub field keeps the tree alive");
+  expect(1 == _group.id(1)->value(), "sub field reads after the root is dropped");
+
+  auto _thawed = _group.thaw();
+  _thawed.id(1).set_value(std::uint64_t(9));
+  expect(1 == _group.id(1)->value() && 9 == _thawed.id(1).value(), "thaw copies before modification");
+}
+
+/**
+ * \brief a copied tree shares its lists until one copy writes, const reads clone nothing
+ */
+void test_cow_isolation()
+{
+  auto           _bin = sample_tree().serialize();
+  proto::message _first;
+  expect(_first.deserialize(std::make_shared<const std::string>(_bin)), "cow decode");
+
+  proto::message _second = _first;
+  expect(!_first.childs_.unique() && !_second.childs_.unique(), "copy shares sub fields");
+
+  const proto::message& _read = _second;
+  std::size_t           _count = 0;
+  for (const auto& f : _read.childs_) _count += f.id_ > 0 ? 1 : 0;
+  expect(6 == _count && !_second.childs_.unique(), "const iteration does not clone");
+
+  _second.id(3).id(1).set_value(std::uint64_t(42));
+  expect(_second.childs_.unique() && _first.childs_.unique(), "a write clones the list, the original keeps its own");
+
+  const proto::message& _original = _first;
+  const proto::message* _group    = nullptr;
+  for (const auto& f : _original.childs_)
+  {
+    if (3 == f.id_) _group = &f;
+  }
+  expect(_group && 1 == _group->childs_.front().value() && 42 == _second.id(3).id(1).value(), "copies are isolated");
+  expect(_first.serialize() == _bin && _second.serialize() != _bin, "the original encodes unchanged");
+}
+
+/**
+ * \brief hints leave out attempts on a path that keeps failing and still decode a message there
+ */
+void test_decode_hints()
+{
+  proto::message _text;
+  _text.append_child(proto::message{proto::type_varint, 1, std::uint64_t(1)});
+  _text.append_child(proto::message{proto::type_binary, 2, std::string("\x07\x07\x07\x80")});
+  auto _text_bin = _text.serialize();
+
+  proto::decode_hints   _hints;
+  proto::decode_stats   _stats;
+  proto::decode_options _options;
+  _options.hints = &_hints;
+  _options.stats = &_stats;
+  for (auto i = 0; i < 8; ++i)
+  {
+    proto::message _msg;
+    expect(_msg.deserialize(_text_bin, _options) && _msg.serialize() == _text_bin, "hinted decode");
+  }
+  expect(_stats.packed_hint_skips > 0, "failing attempts are left out");
+  expect(proto::decode_hints::kind_string == _hints.kind(std::vector<int>{2}), "path learned as string");
+
+  proto::message _nested;
+  _nested.append_child(proto::message{proto::type_varint, 1, std::uint64_t(1)});
+  _nested.append_child(proto::message{proto::type_binary, 2, std::string("\x08\x05")});
+  proto::message _msg;
+  expect(_msg.deserialize(_nested.serialize(), _options) && proto::type_packed == _msg.id(2).type_
+           && 5 == _msg.id(2).id(1).value(),
+    "a message on a learned path still decodes");
+}
+
+/**
+ * \brief the node array of flat_message holds the tree of message in input order
+ */
+void test_flat_equivalence()
+{
+  auto           _built = sample_tree();
+  auto           _bin   = _built.serialize();
+  auto           _input = std::make_shared<const std::string>(_bin);
+  proto::message _tree;
+  expect(_tree.deserialize(_input), "tree decode");
+
+  for (auto _index : {false, true})
+  {
+    proto::decode_options _options;
+    _options.index_varints = _index;
+    proto::flat_message _flat;
+    expect(_flat.deserialize(_input, _options) && _flat.serialize() == _bin, "flat decode encodes the input");
+    expect(_flat.to_message().serialize() == _tree.serialize() && _flat.to_message().hash() == _tree.hash(),
+      "flat tree equals the message tree");
+  }
+  expect(proto::flat_message(_built).serialize() == _bin, "flattened tree encodes as the message");
+}
+
+/**
+ * \brief every instruction set of varint_index decodes as decode_varint()
+ */
+void test_varint_index_levels()
+{
+  std::string   _data(1000, '\0');
+  std::uint32_t _seed = 1;
+  for (auto& c : _data)
+  {
+    _seed = _seed * 1664525u + 1013904223u;
+    // mostly continuation bytes, so varints cross the 64 byte words of the index
+    c = char((_seed >> 24) < 200 ? 0x80 | (_seed >> 16) : (_seed >> 16) & 0x7f);
+  }
+
+  std::vector<proto::simd_levels> _levels{proto::simd_none, proto::simd_level()};
+  if (proto::simd_avx2 == proto::simd_level()) _levels.push_back(proto::simd_sse2);
+
+  auto _bytes = reinterpret_cast<const unsigned char*>(_data.data());
+  for (auto _level : _levels)
+  {
+    proto::varint_index _index;
+    _index.build(_bytes, _data.size(), _level);
+    bool _same = true;
+    for (std::size_t i = 0; i < _data.size(); ++i)
+    {
+      std::uint64_t _expected = 0, _value = 0;
+      auto          _size = proto::decode_varint(_bytes + i, _data.size() - i, _expected);
+      _same = _same && _size == _index.decode(_bytes + i, _data.size() - i, _value) && (0 == _size || _expected == _value);
+    }
+    expect(_same, "varint_index level decodes as decode_varint");
+  }
+}
+
+/**
+ * \brief a saved tree image opens without decoding and gives the tree back
+ */
+void test_image_round_trip()
+{
+  proto::message _tree;
+  expect(_tree.deserialize(sample_tree().serialize()), "image source decode");
+
+  auto             _image = proto::write_image(_tree, 77);
+  proto::image_view _view;
+  expect(_view.open(_image.data(), _image.size()) && 77 == _view.key(), "image opens");
+  expect(_view.to_message().serialize() == _tree.serialize(), "image gives the tree back");
+  expect(0x11223344 == _view.root().id(3).id(3).value(0) && "\x07text" == _view.root().id(2).binary(0),
+    "image fields read in place");
+
+  proto::image_view _cut;
+  expect(!_cut.open(_image.data(), _image.size() - 8), "truncated image does not open");
+}
+
+/**
+ * \brief parallel and gathered encodings are the bytes of serialize()
+ */
+void test_serialize_equivalents()
+{
+  auto           _built = sample_tree();
+  auto           _input = std::make_shared<const std::string>(_built.serialize());
+  proto::message _decoded;
+  expect(_decoded.deserialize(_input), "equivalents decode");
+  _decoded.id(3).id(1).set_value(std::uint64_t(7));
+
+  proto::thread_pool _pool(2);
+  for (const auto* _msg : {&_built, &_decoded})
+  {
+    expect(_msg->serialize_parallel(_pool, 16) == _msg->serialize(), "serialize_parallel equals serialize");
+#if !defined(_WIN32)
+    std::string _scratch, _joined;
+    for (const auto& b : _msg->serialize_iov(_scratch)) _joined.append(static_cast<const char*>(b.iov_base), b.iov_len);
+    expect(_joined == _msg->serialize(), "serialize_iov equals serialize");
+#endif
+  }
+
+#if !defined(_WIN32)
+  // the large value is handed out where it is, not copied to scratch
+  std::string _scratch;
+  bool        _points = false;
+  for (const auto& b : _decoded.serialize_iov(_scratch))
+  {
+    auto _base = static_cast<const char*>(b.iov_base);
+    _points    = _points || (b.iov_len >= 2 * proto::IOV_MIN_BYTES
+                             && (_base < _scratch.data() || _base >= _scratch.data() + _scratch.size()));
+  }
+  expect(_points, "serialize_iov points at large values");
+#endif
+}
+} // namespace
+
+int main()
+{
+  test_edited_packed_child();
+  test_copying_overloads_keep_no_span();
+  test_packed_without_copies();
+  test_print_built_packed_size();
+  test_value_vector_operations();
+  test_classify_packed_evidence();
+  test_pool_rethrows();
+  test_frozen_sharing();
+  test_cow_isolation();
+  test_decode_hints();
+  test_flat_equivalence();
+  test_varint_index_levels();
+  test_image_round_trip();
+  test_serialize_equivalents();
+
+  if (0 == g_failed) std::printf("all passed\n");
+  return 0 == g_failed ? 0 : 1;
+}
@@ -0,0 +1,262 @@
+#ifndef __PROTO_TRACE_HPP__
+#define __PROTO_TRACE_HPP__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#  pragma once
+#endif // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+/**
+ * trace scopes compile to nothing unless PROTO_ENABLE_TRACE is defined,
+ * when defined they record only after trace::enable()
+ *
+ *   PROTO_TRACE_SCOPE("name");
+ *   PROTO_TRACE_SCOPE_ARG("name", "arg name", int_value);
+ *
+ * spans that do not follow a C++ scope keep the begin time themselves
+ *
+ *   std::uint64_t begin = PROTO_TRACE_BEGIN();
+ *   PROTO_TRACE_END("name", "arg name", int_value, begin);
+ */
+
+#if defined(PROTO_ENABLE_TRACE)
+
+#  include <atomic>
+#  include <chrono>
+#  include <cstdint>
+#  include <fstream>
+#  include <ostream>
+#  include <string>
+#  include <vector>
+
+namespace proto {
+namespace trace {
+
+namespace {
+const std::size_t RING_CAPACITY = 1 << 16; // events kept per thread, oldest are overwritten
+} // namespace
+
+/**
+ * \brief one finished scope
+ */
+struct event
+{
+  const char*   name;
+  const char*   arg_name;
+  std::int64_t  arg;
+  std::uint64_t begin_ns;
+  std::uint64_t end_ns;
+};
+
+/**
+ * \brief single writer ring buffer owned by one thread
+ */
+class ring_buffer
+{
+public:
+  explicit ring_buffer(std::uint32_t tid)
+    : tid_(tid)
+    , head_(0)
+    , events_(RING_CAPACITY)
+  {}
+
+  void push(const event& e)
+  {
+    auto _head                     = head_.load(std::memory_order_relaxed);
+    events_[_head % RING_CAPACITY] = e;
+    head_.store(_head + 1, std::memory_order_release);
+  }
+
+  /**
+   * \brief copy kept events, oldest first
+   *   events written while copying may be torn, dump after traced work finished
+   */
+  std::vector<event> snapshot() const
+  {
+    auto _head  = head_.load(std::memory_order_acquire);
+    auto _count = (_head < RING_CAPACITY) ? _head : RING_CAPACITY;
+
+    std::vector<event> _result;
+    _result.reserve(std::size_t(_count));
+    for (auto i = _head - _count; i < _head; ++i)
+    {
+      _result.push_back(events_[i % RING_CAPACITY]);
+    }
+    return _result;
+  }
+
+  std::uint32_t tid() const { return tid_; }
+
+private:
+  std::uint32_t              tid_;
+  std::atomic<std::uint64_t> head_;
+  std::vector<event>         events_;
+};
+
+/**
+ * \brief registered thread buffers, a lock-free push-only list
+ */
+struct buffer_node
+{
+  explicit buffer_node(std::uint32_t tid)
+    : buffer(tid)
+    , next(nullptr)
+  {}
+
+  ring_buffer  buffer;
+  buffer_node* next;
+};
+
+inline std::atomic<buffer_node*>& buffers()
+{
+  static std::atomic<buffer_node*> _head{nullptr};
+  return _head;
+}
+
+inline std::atomic<bool>& enabled_flag()
+{
+  static std::atomic<bool> _enabled{false};
+  return _enabled;
+}
+
+inline bool enabled() { return enabled_flag().load(std::memory_order_relaxed); }
+
+inline std::uint64_t now_ns()
+{
+  return std::uint64_t(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count());
+}
+
+/**
+ * \brief ring buffer of the calling thread, registered on first use and kept until exit
+ */
+inline ring_buffer& local_buffer()
+{
+  static std::atomic<std::uint32_t> _next_tid{1};
+  thread_local ring_buffer*         _buffer = nullptr;
+
+  if (nullptr == _buffer)
+  {
+    auto _node = new buffer_node(_next_tid.fetch_add(1, std::memory_order_relaxed));
+    auto _head = buffers().load(std::memory_order_relaxed);
+    do
+    {
+      _node->next = _head;
+    } while (!buffers().compare_exchange_weak(_head, _node, std::memory_order_release, std::memory_order_relaxed));
+    _buffer = &_node->buffer;
+  }
+  return *_buffer;
+}
+
+/**
+ * \brief start or stop recording, the calling thread buffer is allocated here rather than in its first scope
+ */
+inline void enable(bool on = true)
+{
+  if (on) local_buffer();
+  enabled_flag().store(on, std::memory_order_relaxed);
+}
+
+/**
+ * \brief record the lifetime of this object as one event
+ */
+class scope
+{
+public:
+  explicit scope(const char* name, const char* arg_name = nullptr, std::int64_t arg = 0)
+    : name_(enabled() ? name : nullptr)
+    , arg_name_(arg_name)
+    , arg_(arg)
+    , begin_ns_(name_ ? now_ns() : 0)
+  {}
+
+  ~scope()
+  {
+    if (name_) local_buffer().push(event{name_, arg_name_, arg_, begin_ns_, now_ns()});
+  }
+
+  scope(const scope&) = delete;
+  scope& operator=(const scope&) = delete;
+
+private:
+  const char*   name_;
+  const char*   arg_name_;
+  std::int64_t  arg_;
+  std::uint64_t begin_ns_;
+};
+
+/**
+ * \brief begin time of a manually ended span, 0 when not recording
+ */
+inline std::uint64_t begin() { return enabled() ? now_ns() : 0; }
+
+/**
+ * \brief record a span started by begin()
+ */
+inline void end(const char* name, const char* arg_name, std::int64_t arg, std::uint64_t begin_ns)
+{
+  if (begin_ns) local_buffer().push(event{name, arg_name, arg, begin_ns, now_ns()});
+}
+
+/**
+ * \brief write recorded events of all threads as chrome trace_event json
+ */
+inline void write_chrome_json(std::ostream& out)
+{
+  out << "{\"traceEvents\":[";
+  bool _first = true;
+  for (auto _node = buffers().load(std::memory_order_acquire); _node; _node = _node->next)
+  {
+    for (const auto& e : _node->buffer.snapshot())
+    {
+      out << (_first ? "\n" : ",\n");
+      out << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << _node->buffer.tid()
+          << ",\"ts\":" << double(e.begin_ns) / 1e3 << ",\"dur\":" << double(e.end_ns - e.begin_ns) / 1e3;
+      if (e.arg_name)
+      {
+        out << ",\"args\":{\"" << e.arg_name << "\":" << e.arg << '}';
+      }
+      out << '}';
+      _first = false;
+    }
+  }
+  out << "\n]}\n";
+}
+
+/**
+ * \brief write chrome trace json to file
+ * \return true if file written
+ */
+inline bool dump_chrome_json(const std::string& path)
+{
+  std::ofstream _file(path, std::ios::out | std::ios::trunc);
+  if (!_file.is_open()) return false;
+
+  _file.precision(3);
+  _file << std::fixed;
+  write_chrome_json(_file);
+  return !_file.fail();
+}
+
+} // namespace trace
+} // namespace proto
+
+#  define PROTO_TRACE_CONCAT_IMPL(a, b) a##b
+#  define PROTO_TRACE_CONCAT(a, b) PROTO_TRACE_CONCAT_IMPL(a, b)
+#  define PROTO_TRACE_SCOPE(name) ::proto::trace::scope PROTO_TRACE_CONCAT(_proto_trace_, __LINE__)(name)
+#  define PROTO_TRACE_SCOPE_ARG(name, arg_name, arg)                                                                  \
+    ::proto::trace::scope PROTO_TRACE_CONCAT(_proto_trace_, __LINE__)(name, arg_name, std::int64_t(arg))
+#  define PROTO_TRACE_BEGIN() ::proto::trace::begin()
+#  define PROTO_TRACE_END(name, arg_name, arg, begin_ns)                                                              \
+    ::proto::trace::end(name, arg_name, std::int64_t(arg), begin_ns)
+
+#else
+
+#  define PROTO_TRACE_SCOPE(name) ((void)0)
+#  define PROTO_TRACE_SCOPE_ARG(name, arg_name, arg) ((void)0)
+#  define PROTO_TRACE_BEGIN() (std::uint64_t(0))
+#  define PROTO_TRACE_END(name, arg_name, arg, begin_ns) ((void)(begin_ns))
+
+#endif // defined(PROTO_ENABLE_TRACE)
+
+#endif // !__PROTO_TRACE_HPP__
@@ -1,498 +1,1726 @@
-#include <iostream>
-#include <fstream>
-#include <string>
-#include "proto.hpp"
-
-// (Text and binary are the same on non-Windows platforms.)
-#if defined(WIN32) || defined(_WIN32) || defined(__CYGWIN__) || defined(__MINGW32__)
-#  include <io.h>
-#  if defined(_MSC_VER) || defined(__MINGW32__)
-#    include <fcntl.h>
-#    ifndef _O_BINARY
-#      define _O_BINARY O_BINARY
-#    endif
-#    ifndef _O_TEXT
-#      define _O_TEXT O_TEXT
-#    endif
-#  else
-#    include <sys/fcntl.h>
-#  endif
-#  define SET_STDIN_BINARY_MODE()                                                                                      \
-    {                                                                                                                  \
-      _setmode(0, _O_BINARY);                                                                                          \
-    }
-#  define SET_STDIN_TEXT_MODE()                                                                                        \
-    {                                                                                                                  \
-      _setmode(0, _O_TEXT);                                                                                            \
-    }
-#else
-#  define SET_STDIN_BINARY_MODE()                                                                                      \
-    {}
-#  define SET_STDIN_TEXT_MODE()                                                                                        \
-    {}
-#endif
-
-enum out_style {
-	human = 0,
-	cpp = 1
-};
-
-
-char byte_to_hex(unsigned char b, bool lower = true)
-{
-  static const char* hex_map[2] = {"0123456789ABCDEF", "0123456789abcdef"};
-
-  return hex_map[int(lower)][int(b)];
-}
-
-/**
- * \brief convert un-printable character to escape sequences
- */
-std::string to_readable_string(const void* data, size_t len)
-{
-  using byte_p_t = unsigned char*;
-
-  std::string _result;
-  _result.reserve(len * 3);
-
-  for (auto i = 0; i < int(len); i++)
-  {
-    auto c = (byte_p_t(data))[i];
-    if (c > 31 && c < 127 && c != '\"' && c != '\'')
-    {
-      _result += c;
-    }
-    else
-    {
-      // write "\xhh"
-      _result += "\\x";
-      _result += byte_to_hex((c >> 4) & 0x0f);
-      _result += byte_to_hex(c & 0x0f);
-    }
-  }
-  return _result;
-}
-
-
-/**
- * \brief get human readble string of data struct view
- */
-void to_string(std::string& result, const proto::message& msg, int indent, int leftspace, int depth, int show_type,
-  bool show_size)
-{
-  auto _cur_leftspace = leftspace + indent;
-
-  if (0 == depth) return;
-
-  if (-1 != depth) --depth;
-
-  switch (msg.type_)
-  {
-  case proto::type_varint:
-  case proto::type_int32:
-  case proto::type_int64:
-  {
-    static const char* _value_type_desc[] = {"varint", "int64", "", "", "", "int32"};
-    for (const auto& value : msg.values_)
-    {
-      // 1 : /* varint */ 12345
-      result += std::string(_cur_leftspace, ' ');
-      result += std::to_string(msg.id_);
-      result += " : ";
-      result += std::to_string(value);
-      result += ',';
-      if (show_type > 0)
-      {
-        result += " /* ";
-        result += _value_type_desc[int(msg.type_)];
-        result += " */ ";
-      }
-      result += '\n';
-    }
-    break;
-  }
-  case proto::type_binary:
-  {
-    for (const auto& value : msg.binary_values_)
-    {
-      // "1" : "saddf"
-      result += std::string(_cur_leftspace, ' ');
-      result += std::to_string(msg.id_);
-      result += " : \"";
-      result += to_readable_string(value.data(), value.size());
-      result += "\",\n";
-    }
-    break;
-  }
-  case proto::type_group:
-  {
-    // 1 : { /* group */ /* child: 4 */
-    //     1 : xxx
-    // }
-    result += std::string(_cur_leftspace, ' ');
-    result += "";
-    result += std::to_string(msg.id_);
-    result += " : {";
-    if (2 == show_type) result += " /* group */";
-
-    if (show_size)
-    {
-      result += " /* childs: ";
-      result += std::to_string(msg.childs_.size());
-      result += " */\n";
-    }
-    else
-      result += '\n';
-
-    for (const auto& f : msg.childs_)
-    {
-      to_string(result, f, indent, _cur_leftspace, depth, show_type, show_size);
-    }
-    result += std::string(_cur_leftspace, ' ');
-    result += "},\n";
-    break;
-  }
-  case proto::type_packed:
-  {
-    // 1 : { /* packed binary */ /* len: 4 */ /* child: 4 */
-    //     1 : xxx
-    // }
-    result += std::string(_cur_leftspace, ' ');
-    result += std::to_string(msg.id_);
-    result += " : {";
-    if (show_type > 0) result += " /* packed binary */";
-
-    if (show_size)
-    {
-      if (!msg.binary_values_.empty())
-      {
-        result += " /* len: ";
-        result += std::to_string(msg.binary_values_[0].size());
-        result += " */ /* child: ";
-        result += std::to_string(msg.childs_.size());
-        result += " */\n";
-      }
-      else
-      {
-        result += " /* len:  */ /* child: ";
-        result += std::to_string(msg.childs_.size());
-        result += " */\n";
-      }
-    }
-    else
-      result += '\n';
-
-    for (const auto& f : msg.childs_)
-    {
-      to_string(result, f, indent, _cur_leftspace, depth, show_type, show_size);
-    }
-    result += std::string(_cur_leftspace, ' ');
-    result += "},\n";
-    break;
-  }
-  case proto::type_repeat:
-  {
-    result += std::string(_cur_leftspace, ' ');
-    result += "/* repeat count: ";
-    result += std::to_string(msg.childs_.size());
-    result += "*/\n";
-  }
-  default:
-  {
-    for (const auto& f : msg.childs_)
-    {
-      to_string(result, f, indent, _cur_leftspace - 2, depth, show_type, show_size);
-    }
-    break;
-  }
-  }
-}
-
-/**
- * \brief get human readble string view struct
- * \param show_type
- *    control how to show type info
- *    0: do not show
- *    1: less (varint, int64, int32, packed)
- *    2: full (varint, int64, int32, packed, binary, group)
- * \param show_size
- *    control how to show size info
- *    false: do not show
- *    true: show (packed, binary, group)
- * \return readble string
- */
-std::string to_string(const proto::message& msg, int indent = 2, int leftspace = 0, int depth = -1,
-  int show_type = 2, bool show_size = true)
-{
-  std::string result;
-  result += "{\n";
-  to_string(result, msg, indent, leftspace, depth, show_type, show_size);
-  result += "}\n";
-  return result;
-}
-
-/**
- * \brief get cpp code
- */
-void to_cpp_code(
-  std::string& result, const proto::message& msg, int indent, int leftspace, int depth, bool use_namespace)
-{
-  auto _cur_leftspace = leftspace + indent;
-
-  if (0 == depth) return;
-
-  if (-1 != depth) --depth;
-
-  switch (msg.type_)
-  {
-  case proto::type_varint:
-  case proto::type_int32:
-  case proto::type_int64:
-  {
-    static const char* _value_type_desc[] = {"varint", "int64", "", "", "", "int32"};
-
-    for (const auto& value : msg.values_)
-    {
-      // proto::varint<1>{ 3 },
-      result += std::string(_cur_leftspace, ' ');
-      if (use_namespace) result += "proto::";
-      result += _value_type_desc[int(msg.type_)];
-      result += "<";
-      result += std::to_string(msg.id_);
-      result += ">{ ";
-      result += std::to_string(value);
-      result += " },\n";
-    }
-  }
-  break;
-  case proto::type_binary:
-  {
-    for (const auto& value : msg.binary_values_)
-    {
-      // proto::binary<2>{ "saddf" },
-      result += std::string(_cur_leftspace, ' ');
-      if (use_namespace) result += "proto::";
-      result += "binary<";
-      result += std::to_string(msg.id_);
-      result += ">{ \"";
-      result += to_readable_string(value.data(), value.size());
-      result += "\" },\n";
-    }
-  }
-  break;
-  case proto::type_group:
-  {
-    // proto::group<3>{
-    result += std::string(_cur_leftspace, ' ');
-    if (use_namespace) result += "proto::";
-    result += "group<";
-    result += std::to_string(msg.id_);
-    result += ">{\n";
-
-    for (const auto& f : msg.childs_) to_cpp_code(result, f, indent, _cur_leftspace, depth, use_namespace);
-
-    result += std::string(_cur_leftspace, ' ');
-    result += "},\n";
-  }
-  break;
-  case proto::type_packed:
-  {
-    // proto::packed<4>{
-    result += std::string(_cur_leftspace, ' ');
-    if (use_namespace) result += "proto::";
-    result += "packed<";
-    result += std::to_string(msg.id_);
-    result += ">{\n";
-
-    for (const auto& f : msg.childs_)
-    {
-      to_cpp_code(result, f, indent, _cur_leftspace, depth, use_namespace);
-    }
-    result += std::string(_cur_leftspace, ' ');
-    result += "},\n";
-    break;
-  }
-  default:
-  {
-    for (const auto& f : msg.childs_) to_cpp_code(result, f, indent, _cur_leftspace - 2, depth, use_namespace);
-  }
-  break;
-  }
-}
-
-/**
- * \brief get cpp code
- */
-std::string to_cpp_code(const proto::message& msg, int indent = 2, int leftspace = 0, int depth = -1,
-  bool use_namespace = false)
-{
-  std::string result;
-  result += "{\n";
-  to_cpp_code(result, msg, indent, leftspace, depth, use_namespace);
-  result += "}\n";
-  return result;
-}
-
-
-bool load_from_stdin(proto::message& msg, int dec_pack_depth = -1)
-{
-  SET_STDIN_BINARY_MODE();
-
-  std::string data;
-  {
-    char            buf[8192] = {0};
-    std::streamsize r;
-
-    while (r = std::cin.rdbuf()->sgetn(buf, 8190), r > 0 && r <= 8190)
-    {
-      buf[r] = 0;
-      if (data.capacity() < 10)
-      {
-        data.reserve(8192);
-      }
-      data.append(buf, std::size_t(r));
-    }
-  }
-
-  SET_STDIN_TEXT_MODE();
-
-  if (msg.deserialize(data, dec_pack_depth)) return true;
-
-  std::cin.rdbuf()->sputn(data.data(), data.size());
-  return false;
-}
-
-/**
- * \brief decode protobuf read from file
- * \param file
- */
-bool load_from_file(proto::message& msg, std::istream& file, int dec_pack_depth = -1)
-{
-  if (file.fail()) return false;
-
-  std::string data;
-
-  {
-    char            buf[8192] = {0};
-    std::streamsize r;
-
-    while (r = file.rdbuf()->sgetn(buf, 8190), r > 0 && r <= 8190)
-    {
-      buf[r] = 0;
-      if (data.capacity() < 10)
-      {
-        data.reserve(8192);
-      }
-      data.append(buf, std::size_t(r));
-    }
-  }
-
-  if (msg.deserialize(data, dec_pack_depth)) return true;
-
-  file.rdbuf()->sputn(data.data(), data.size());
-  return false;
-}
-
-void print_help()
-{
-	std::cout << 
-				"protobuf decode\n"
-				"protoc [option] <file|stdin>\n"
-				"-h, --help    show this help\n"
-				"-v, --version show version\n"
-				"-d, --depth   set decode depth\n"
-				"-f, --force   force output until error\n"
-				"-s, --style   set output style(human, cpp)\n"
-				"--decode_raw  use stdin input\n\n";
-}
-
-int main(int argc, char *argv[])
-{
-	bool opt_from_file = true;
-	bool opt_force = false;
-	int opt_depth = 2;
-	out_style opt_style = human;
-	std::string file;
-
-	if (argc == 1)
-	{
-		print_help();
-		return 0;
-	}
-
-	for (auto i = 1; i < argc; ++i)
-	{
-		std::string arg(argv[i]);
-		if ("-h" == arg || "--help" == arg)
-		{
-			print_help();
-			return 0;
-		}
-		if ("-v" == arg || "--version" == arg)
-		{
-			std::cout << "libprotoc 9.9.9 diy version" << std::endl;
-			return 0;
-		}
-		else if ("-d" == arg || "-depth" == arg)
-		{
-			++i;
-			opt_depth = std::atoi(argv[i]);
-		}
-		else if ("-f" == arg || "-force" == arg)
-		{
-			opt_force = true;
-		}
-		else if ("-s" == arg || "-style" == arg)
-		{
-			++i;
-			std::string style(argv[i]);
-			if ("cpp" == style || "1" == style)
-				opt_style = cpp;
-			else
-				opt_style = human;
-		}
-		else if ("--decode_raw" == arg)
-		{
-			opt_from_file = false;
-		}
-		else
-		{
-			file = arg;
-		}
-	}
-
-	proto::message msg;
-	bool success = false;
-	if (opt_from_file && !file.empty())
-	{
-		std::ifstream infile(file, std::ios::binary | std::ios::in);
-		if (infile.is_open())
-		{
-			success = load_from_file(msg, infile, opt_depth);
-		}
-	}
-	else
-	{
-		success = load_from_stdin(msg, opt_depth);
-	}
-
-	if (success || opt_force)
-	{
-		switch (opt_style)
-		{
-		case cpp:
-			std::cout << to_cpp_code(msg);
-			break;
-		default:
-			std::cout << to_string(msg);
-			break;
-		}
-	}
-
-	if (!success)
-	{
-		std::cout << "// decode fail" << std::endl;
-		return -1;
-	}
-	return 0;
-}
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "proto.hpp"
+#include "proto_image.hpp"
+#include "proto_parallel.hpp"
+#include "proto_print.hpp"
+
+// --serve and --client use unix domain sockets, saved trees are mapped
+#if !defined(_WIN32)
+#  include <csignal>
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/socket.h>
+#  include <sys/stat.h>
+#  include <sys/un.h>
+#  include <unistd.h>
+#endif
+
+// (Text and binary are the same on non-Windows platforms.)
+#if defined(WIN32) || defined(_WIN32) || defined(__CYGWIN__) || defined(__MINGW32__)
+#  include <io.h>
+#  if defined(_MSC_VER) || defined(__MINGW32__)
+#    include <fcntl.h>
+#    ifndef _O_BINARY
+#      define _O_BINARY O_BINARY
+#    endif
+#    ifndef _O_TEXT
+#      define _O_TEXT O_TEXT
+#    endif
+#  else
+#    include <sys/fcntl.h>
+#  endif
+#  define SET_STDIN_BINARY_MODE()                                                                                      \
+    {                                                                                                                  \
+      _setmode(0, _O_BINARY);                                                                                          \
+    }
+#  define SET_STDIN_TEXT_MODE()                                                                                        \
+    {                                                                                                                  \
+      _setmode(0, _O_TEXT);                                                                                            \
+    }
+#else
+#  define SET_STDIN_BINARY_MODE()                                                                                      \
+    {}
+#  define SET_STDIN_TEXT_MODE()                                                                                        \
+    {}
+#endif
+
+enum out_style {
+	human = 0,
+	cpp = 1
+};
+
+
+enum in_format {
+	in_binary = 0,
+	in_hex = 1,
+	in_base64 = 2,
+	in_tree = 3
+};
+
+void read_from_stdin(std::string& data)
+{
+  SET_STDIN_BINARY_MODE();
+
+  char            buf[8192] = {0};
+  std::streamsize r;
+
+  while (r = std::cin.rdbuf()->sgetn(buf, 8190), r > 0 && r <= 8190)
+  {
+    buf[r] = 0;
+    if (data.capacity() < 10)
+    {
+      data.reserve(8192);
+    }
+    data.append(buf, std::size_t(r));
+  }
+
+  SET_STDIN_TEXT_MODE();
+}
+
+/**
+ * \brief read whole file
+ * \param file
+ */
+bool read_from_file(std::istream& file, std::string& data)
+{
+  if (file.fail()) return false;
+
+  // regular file, read at once into a buffer of its size
+  file.seekg(0, std::ios::end);
+  auto size = file.tellg();
+  file.seekg(0, std::ios::beg);
+  if (size > 0)
+  {
+    data.resize(std::size_t(size));
+    file.read(&data[0], size);
+    data.resize(std::size_t(file.gcount()));
+    return true;
+  }
+
+  file.clear();
+
+  char            buf[8192] = {0};
+  std::streamsize r;
+
+  while (r = file.rdbuf()->sgetn(buf, 8190), r > 0 && r <= 8190)
+  {
+    buf[r] = 0;
+    if (data.capacity() < 10)
+    {
+      data.reserve(8192);
+    }
+    data.append(buf, std::size_t(r));
+  }
+  return true;
+}
+
+namespace {
+const unsigned char TEXT_SPACE   = 0x40; // whitespace, skipped
+const unsigned char TEXT_PAD     = 0x41; // base64 padding
+const unsigned char TEXT_INVALID = 0x80;
+const int           TEXT_BLOCK   = 16; // characters checked at once by the fast loops
+} // namespace
+
+/**
+ * \brief digit value of each character, or one of the TEXT_ flags
+ *   base64 takes both the standard and the url safe alphabet
+ */
+const unsigned char* text_table(in_format format)
+{
+  struct table
+  {
+    explicit table(in_format format)
+    {
+      for (auto& v : values) v = TEXT_INVALID;
+      for (auto c : {' ', '\t', '\r', '\n', '\v', '\f'}) values[(unsigned char)c] = TEXT_SPACE;
+
+      if (in_hex == format)
+      {
+        for (auto i = 0; i < 10; ++i) values['0' + i] = (unsigned char)i;
+        for (auto i = 0; i < 6; ++i) values['a' + i] = values['A' + i] = (unsigned char)(10 + i);
+        return;
+      }
+
+      for (auto i = 0; i < 26; ++i)
+      {
+        values['A' + i] = (unsigned char)i;
+        values['a' + i] = (unsigned char)(26 + i);
+      }
+      for (auto i = 0; i < 10; ++i) values['0' + i] = (unsigned char)(52 + i);
+      values['+'] = values['-'] = 62;
+      values['/'] = values['_'] = 63;
+      values['=']               = TEXT_PAD;
+    }
+
+    unsigned char values[256];
+  };
+
+  static const table _hex(in_hex);
+  static const table _base64(in_base64);
+  return (in_hex == format ? _hex : _base64).values;
+}
+
+/**
+ * \brief decode hex digits of [in, end) to out, whitespace anywhere allowed
+ *   out may be in, the output never overtakes the input
+ * \return end of output, nullptr on an invalid character or an odd digit count
+ */
+char* hex_to_binary(const char* in, const char* end, char* out)
+{
+  auto _table = text_table(in_hex);
+
+  unsigned char _high = TEXT_SPACE; // first digit of a pair split by whitespace
+
+  while (in < end)
+  {
+    // runs of digits without whitespace, a block at a time
+    while (TEXT_SPACE == _high && end - in >= TEXT_BLOCK)
+    {
+      unsigned char _values[TEXT_BLOCK];
+      unsigned char _flags = 0;
+      for (auto i = 0; i < TEXT_BLOCK; ++i)
+      {
+        _values[i] = _table[(unsigned char)in[i]];
+        _flags |= _values[i];
+      }
+      if (_flags & 0xF0) break;
+
+      for (auto i = 0; i < TEXT_BLOCK / 2; ++i)
+      {
+        out[i] = char((_values[2 * i] << 4) | _values[2 * i + 1]);
+      }
+      in += TEXT_BLOCK;
+      out += TEXT_BLOCK / 2;
+    }
+
+    // a block holding whitespace, or the tail, a character at a time
+    auto _stop = (end - in > TEXT_BLOCK) ? in + TEXT_BLOCK : end;
+    while (in < _stop)
+    {
+      auto _value = _table[(unsigned char)*in++];
+      if (TEXT_SPACE == _value) continue;
+      if (_value > 0x0F) return nullptr;
+
+      if (TEXT_SPACE == _high)
+      {
+        _high = _value;
+        continue;
+      }
+      *out++ = char((_high << 4) | _value);
+      _high  = TEXT_SPACE;
+    }
+  }
+  return (TEXT_SPACE == _high) ? out : nullptr;
+}
+
+/**
+ * \brief decode base64 of [in, end) to out, whitespace anywhere and missing padding allowed
+ *   out may be in, the output never overtakes the input
+ * \return end of output, nullptr on an invalid character or a truncated group
+ */
+char* base64_to_binary(const char* in, const char* end, char* out)
+{
+  auto _table = text_table(in_base64);
+
+  std::uint32_t _bits  = 0;
+  int           _count = 0; // digits in _bits
+  bool          _pad   = false;
+
+  while (in < end)
+  {
+    // whole groups without whitespace or padding, a block at a time
+    while (0 == _count && !_pad && end - in >= TEXT_BLOCK)
+    {
+      unsigned char _values[TEXT_BLOCK];
+      unsigned char _flags = 0;
+      for (auto i = 0; i < TEXT_BLOCK; ++i)
+      {
+        _values[i] = _table[(unsigned char)in[i]];
+        _flags |= _values[i];
+      }
+      if (_flags & 0xC0) break;
+
+      for (auto i = 0; i < TEXT_BLOCK / 4; ++i)
+      {
+        auto _group = (std::uint32_t(_values[4 * i]) << 18) | (std::uint32_t(_values[4 * i + 1]) << 12) |
+                      (std::uint32_t(_values[4 * i + 2]) << 6) | std::uint32_t(_values[4 * i + 3]);
+        out[3 * i]     = char(_group >> 16);
+        out[3 * i + 1] = char(_group >> 8);
+        out[3 * i + 2] = char(_group);
+      }
+      in += TEXT_BLOCK;
+      out += TEXT_BLOCK / 4 * 3;
+    }
+
+    // a block holding whitespace or padding, or the tail, a character at a time
+    auto _stop = (end - in > TEXT_BLOCK) ? in + TEXT_BLOCK : end;
+    while (in < _stop)
+    {
+      auto _value = _table[(unsigned char)*in++];
+      if (TEXT_SPACE == _value) continue;
+      if (TEXT_PAD == _value)
+      {
+        _pad = true;
+        continue;
+      }
+      if (_value > 63 || _pad) return nullptr;
+
+      _bits = (_bits << 6) | _value;
+      if (4 == ++_count)
+      {
+        *out++ = char(_bits >> 16);
+        *out++ = char(_bits >> 8);
+        *out++ = char(_bits);
+        _bits  = 0;
+        _count = 0;
+      }
+    }
+  }
+
+  // a partial group holds 8 bits per 6 bit digit after the first
+  if (1 == _count) return nullptr;
+  if (_count > 1) *out++ = char(_bits >> (6 * _count - 8));
+  if (_count > 2) *out++ = char(_bits >> (6 * _count - 16));
+  return out;
+}
+
+/**
+ * \brief decode hex or base64 text in place
+ * \param records if not null, each non-blank line is one message, receives the start of each
+ *   decoded message followed by the end of the last one
+ * \return false on invalid text, the line is printed to err
+ */
+bool text_to_binary(std::string& data, in_format format, std::vector<std::size_t>* records, std::ostream& err)
+{
+  if (in_binary == format || in_tree == format) return true;
+
+  auto _decode = (in_hex == format) ? hex_to_binary : base64_to_binary;
+  auto _begin  = &data[0];
+  auto _in     = static_cast<const char*>(_begin);
+  auto _end    = _in + data.size();
+  auto _out    = _begin;
+
+  std::size_t _line = 1;
+  while (_in < _end)
+  {
+    auto _next = _end;
+    if (records)
+    {
+      auto _newline = static_cast<const char*>(std::memchr(_in, '\n', std::size_t(_end - _in)));
+      if (_newline) _next = _newline + 1;
+    }
+
+    auto _record = _out;
+    _out         = _decode(_in, _next, _out);
+    if (nullptr == _out)
+    {
+      err << "invalid " << (in_hex == format ? "hex" : "base64") << " input";
+      if (records) err << " at line " << _line;
+      err << std::endl;
+      return false;
+    }
+    if (records && _out != _record) records->push_back(std::size_t(_record - _begin));
+
+    _in = _next;
+    ++_line;
+  }
+
+  data.resize(std::size_t(_out - _begin));
+  if (records) records->push_back(data.size());
+  return true;
+}
+
+/**
+ * \brief print decode statistics as comments
+ */
+void print_stats(std::ostream& out, const proto::decode_stats& stats)
+{
+  static const char* _wire_type_desc[] = {"varint", "int64", "binary", "group", "end", "int32", "", ""};
+
+  out << "// decode time: " << double(stats.decode_ns) / 1e6 << " ms\n";
+  for (auto i = 0; i < 6; ++i)
+  {
+    if (0 == stats.fields[i]) continue;
+    out << "// " << _wire_type_desc[i] << " fields: " << stats.fields[i] << ", bytes: " << stats.bytes[i] << '\n';
+  }
+  out << "// packed attempts: " << stats.packed_attempts << ", successes: " << stats.packed_successes
+      << ", wasted bytes: " << stats.packed_wasted_bytes << '\n';
+  if (stats.packed_hint_skips) out << "// packed attempts skipped by hints: " << stats.packed_hint_skips << '\n';
+  if (stats.packed_check_skips || stats.packed_text_skips)
+  {
+    out << "// packed attempts skipped by field check: " << stats.packed_check_skips
+        << ", as text: " << stats.packed_text_skips << '\n';
+  }
+  if (stats.packed_scalar_skips) out << "// packed attempts skipped as scalars: " << stats.packed_scalar_skips << '\n';
+  out << "// max depth: " << stats.max_depth << '\n';
+  out << "// work bytes: " << stats.work_bytes << '\n';
+  out << "// repeat conversions: " << stats.repeat_conversions << '\n';
+  out << "// node allocations: " << stats.node_allocations
+      << ", binary allocations: " << stats.binary_allocations << '\n';
+}
+
+using field_hashes = std::unordered_map<const proto::message*, std::uint64_t>;
+
+/**
+ * \brief structural compare of two decoded trees, fields matched by id and repeats by index
+ */
+class tree_diff
+{
+public:
+  tree_diff(const proto::message& a, const proto::message& b)
+    : a_(a)
+    , b_(b)
+  {
+    a.hash(&a_hashes_);
+    b.hash(&b_hashes_);
+  }
+
+  /**
+   * \brief print changed paths, "+ path" added in b, "- path" removed, "~ path" changed
+   * \return number of printed differences
+   */
+  std::size_t print(std::ostream& out)
+  {
+    count_ = 0;
+    diff_childs(out, a_, b_, "");
+    return count_;
+  }
+
+private:
+  bool same(const proto::message& a, const proto::message& b) const
+  {
+    return a_hashes_.at(&a) == b_hashes_.at(&b);
+  }
+
+  static std::string join(const std::string& path, int id)
+  {
+    return path.empty() ? std::to_string(id) : path + "." + std::to_string(id);
+  }
+
+  static std::string type_name(proto::types type)
+  {
+    static const char* _type_desc[] = {
+      "varint", "int64", "binary", "group", "end", "int32", "", "", "undefined", "packed", "repeat"};
+    return _type_desc[int(type)];
+  }
+
+  static std::string value_text(const proto::message& f, std::size_t index)
+  {
+    if (proto::type_binary == f.type_)
+    {
+      const auto& v = f.binary_values_[index];
+      return "\"" + proto::to_readable_string(v.data(), v.size()) + "\"";
+    }
+    return std::to_string(f.values_[index]);
+  }
+
+  static std::size_t value_count(const proto::message& f)
+  {
+    return proto::type_binary == f.type_ ? f.binary_values_.size() : f.values_.size();
+  }
+
+  static bool has_values(const proto::message& f)
+  {
+    return proto::type_varint == f.type_ || proto::type_int32 == f.type_ || proto::type_int64 == f.type_ ||
+           proto::type_binary == f.type_;
+  }
+
+  /**
+   * \brief one line for a field only present on one side
+   */
+  void print_field(std::ostream& out, char op, const std::string& path, const proto::message& f)
+  {
+    ++count_;
+    out << op << ' ' << path << ": ";
+    if (has_values(f))
+    {
+      auto _count = value_count(f);
+      for (std::size_t i = 0; i < _count; ++i)
+      {
+        out << (i ? ", " : "") << value_text(f, i);
+      }
+      out << '\n';
+      return;
+    }
+    out << type_name(f.type_) << " { " << f.childs_.size() << " fields }\n";
+  }
+
+  void diff_childs(std::ostream& out, const proto::message& a, const proto::message& b, const std::string& path)
+  {
+    if (same(a, b)) return;
+
+    // ids are unique among decoded sub fields, repeats are merged under one field
+    std::unordered_map<int, const proto::message*> _fields_b;
+    for (const auto& fb : b.childs_)
+    {
+      _fields_b.emplace(fb.id_, &fb);
+    }
+
+    for (const auto& fa : a.childs_)
+    {
+      auto _fb = _fields_b.find(fa.id_);
+      if (_fields_b.end() == _fb)
+      {
+        print_field(out, '-', join(path, fa.id_), fa);
+        continue;
+      }
+      diff_field(out, fa, *_fb->second, join(path, fa.id_));
+      _fields_b.erase(_fb);
+    }
+
+    // left in b order
+    for (const auto& fb : b.childs_)
+    {
+      if (_fields_b.count(fb.id_)) print_field(out, '+', join(path, fb.id_), fb);
+    }
+  }
+
+  void diff_field(std::ostream& out, const proto::message& a, const proto::message& b, const std::string& path)
+  {
+    if (same(a, b)) return;
+
+    // a repeated group or packed field, items compared in order, a single item is a repeat of one
+    if (proto::type_repeat == a.type_ || proto::type_repeat == b.type_)
+    {
+      auto _items_a = repeat_items(a);
+      auto _items_b = repeat_items(b);
+      for (std::size_t i = 0; i < _items_a.size() || i < _items_b.size(); ++i)
+      {
+        auto _path = path + "[" + std::to_string(i) + "]";
+        if (i >= _items_b.size())
+          print_field(out, '-', _path, *_items_a[i]);
+        else if (i >= _items_a.size())
+          print_field(out, '+', _path, *_items_b[i]);
+        else
+          diff_field(out, *_items_a[i], *_items_b[i], _path);
+      }
+      return;
+    }
+
+    if (a.type_ != b.type_)
+    {
+      ++count_;
+      out << "~ " << path << ": " << type_name(a.type_) << " -> " << type_name(b.type_) << '\n';
+      return;
+    }
+
+    if (!has_values(a))
+    {
+      diff_childs(out, a, b, path);
+      return;
+    }
+
+    auto _count_a = value_count(a);
+    auto _count_b = value_count(b);
+    auto _single  = 1 == _count_a && 1 == _count_b;
+    for (std::size_t i = 0; i < _count_a || i < _count_b; ++i)
+    {
+      auto _path = _single ? path : path + "[" + std::to_string(i) + "]";
+      if (i >= _count_b)
+      {
+        ++count_;
+        out << "- " << _path << ": " << value_text(a, i) << '\n';
+      }
+      else if (i >= _count_a)
+      {
+        ++count_;
+        out << "+ " << _path << ": " << value_text(b, i) << '\n';
+      }
+      else if (value_text(a, i) != value_text(b, i))
+      {
+        ++count_;
+        out << "~ " << _path << ": " << value_text(a, i) << " -> " << value_text(b, i) << '\n';
+      }
+    }
+  }
+
+  static std::vector<const proto::message*> repeat_items(const proto::message& f)
+  {
+    std::vector<const proto::message*> _result;
+    if (proto::type_repeat != f.type_)
+    {
+      _result.push_back(&f);
+      return _result;
+    }
+    for (const auto& item : f.childs_)
+    {
+      _result.push_back(&item);
+    }
+    return _result;
+  }
+
+  const proto::message& a_;
+  const proto::message& b_;
+  field_hashes          a_hashes_;
+  field_hashes          b_hashes_;
+  std::size_t           count_ = 0;
+};
+
+/**
+ * \brief first occurrence of needle in data, memchr finds the candidates
+ */
+const char* find_bytes(const char* data, std::size_t size, const std::string& needle)
+{
+  if (needle.empty()) return data;
+  if (needle.size() > size) return nullptr;
+
+  auto _last = data + (size - needle.size());
+  while (data <= _last)
+  {
+    auto _first = static_cast<const char*>(std::memchr(data, needle[0], std::size_t(_last - data) + 1));
+    if (nullptr == _first) return nullptr;
+    if (0 == std::memcmp(_first, needle.data(), needle.size())) return _first;
+    data = _first + 1;
+  }
+  return nullptr;
+}
+
+/**
+ * \brief field path predicate of --grep
+ *   "3.1 == 12345" numeric field, "4 == \"text\"" or "4 contains \"text\"" binary field,
+ *   text takes \" \\ \n \t and \xhh escapes
+ */
+class grep_expr
+{
+public:
+  /**
+   * \return false if expr is not a valid predicate
+   */
+  bool parse(const std::string& expr)
+  {
+    auto _op_begin = expr.find(' ');
+    if (std::string::npos == _op_begin) return false;
+    auto _op_end = expr.find(' ', _op_begin + 1);
+    if (std::string::npos == _op_end) return false;
+
+    // 3.1
+    auto _path = expr.substr(0, _op_begin);
+    for (std::size_t i = 0; i < _path.size();)
+    {
+      auto _dot = _path.find('.', i);
+      if (std::string::npos == _dot) _dot = _path.size();
+      auto _id = std::atoi(_path.substr(i, _dot - i).c_str());
+      if (_id <= 0) return false;
+      path_.push_back(_id);
+      i = _dot + 1;
+    }
+
+    auto _op    = expr.substr(_op_begin + 1, _op_end - _op_begin - 1);
+    auto _value = expr.substr(_op_end + 1);
+    contains_   = ("contains" == _op);
+    if (!contains_ && "==" != _op) return false;
+
+    if (!_value.empty() && '"' == _value[0])
+    {
+      if (_value.size() < 2 || '"' != _value.back()) return false;
+      return unescape(_value.substr(1, _value.size() - 2));
+    }
+    if (contains_ || _value.empty()) return false;
+
+    // numbers compare with varint, int32 and int64 fields, negative ones as two's complement
+    char* _end = nullptr;
+    number_    = ('-' == _value[0]) ? std::uint64_t(std::strtoll(_value.c_str(), &_end, 0))
+                                    : std::uint64_t(std::strtoull(_value.c_str(), &_end, 0));
+    is_number_ = true;
+    if (*_end) return false;
+
+    // any wire encoding of the number is a needle of the prefilter
+    needles_.push_back(proto::encode_varint(number_));
+    needles_.emplace_back(reinterpret_cast<const char*>(&number_), proto::INT64_BYTES);
+    int32_ = number_ <= 0xffffffffULL || number_ >= 0xffffffff80000000ULL;
+    if (int32_)
+    {
+      needles_.emplace_back(reinterpret_cast<const char*>(&number_), proto::INT32_BYTES);
+    }
+    return true;
+  }
+
+  /**
+   * \brief true if the record may match, false if none of the needle bytes occur in it
+   */
+  bool prefilter(const char* data, std::size_t size) const
+  {
+    for (const auto& needle : needles_)
+    {
+      if (find_bytes(data, size, needle)) return true;
+    }
+    return false;
+  }
+
+  /**
+   * \brief walk the path in encoded data, sub messages on the path are scanned, others skipped
+   */
+  bool match(const unsigned char* data, std::size_t size, std::size_t level = 0) const
+  {
+    bool _found = false;
+    proto::scan_fields(data, size, [&](const proto::wire_field& f) {
+      if (path_[level] != f.id) return true;
+
+      if (level + 1 < path_.size())
+      {
+        // binary payloads that are not messages stop their own scan only
+        if (proto::type_binary == f.type || proto::type_group == f.type) _found = match(f.payload, f.size, level + 1);
+      }
+      else
+      {
+        _found = match_value(f);
+      }
+      return !_found;
+    });
+    return _found;
+  }
+
+private:
+  bool match_value(const proto::wire_field& f) const
+  {
+    if (is_number_)
+    {
+      switch (f.type)
+      {
+      case proto::type_varint:
+      case proto::type_int64: return number_ == f.value;
+      case proto::type_int32: return int32_ && (number_ & 0xffffffffULL) == f.value;
+      default: return false;
+      }
+    }
+
+    if (proto::type_binary != f.type) return false;
+    auto _payload = reinterpret_cast<const char*>(f.payload);
+    if (contains_) return nullptr != find_bytes(_payload, f.size, text_);
+    return f.size == text_.size() && 0 == std::memcmp(_payload, text_.data(), f.size);
+  }
+
+  bool unescape(const std::string& value)
+  {
+    for (std::size_t i = 0; i < value.size(); ++i)
+    {
+      if ('\\' != value[i] || i + 1 == value.size())
+      {
+        text_ += value[i];
+        continue;
+      }
+
+      auto c = value[++i];
+      if ('n' == c)
+        text_ += '\n';
+      else if ('t' == c)
+        text_ += '\t';
+      else if ('x' == c && i + 2 < value.size())
+      {
+        text_ += char(std::strtol(value.substr(i + 1, 2).c_str(), nullptr, 16));
+        i += 2;
+      }
+      else
+        text_ += c;
+    }
+    needles_.push_back(text_);
+    return true;
+  }
+
+  std::vector<int>         path_;
+  bool                     contains_  = false;
+  bool                     is_number_ = false;
+  bool                     int32_     = false; // number_ fits 32 bits, signed or not
+  std::uint64_t            number_    = 0;
+  std::string              text_;
+  std::vector<std::string> needles_; // byte strings one of which a matching record contains
+};
+
+/**
+ * \brief messages of a length delimited stream, each a varint size followed by the message
+ * \return false if the stream is truncated
+ */
+bool split_delimited(const std::string& data, std::vector<std::pair<std::size_t, std::size_t>>& records)
+{
+  std::size_t _pos = 0;
+  while (_pos < data.size())
+  {
+    std::uint64_t _size;
+    auto          _prefix = proto::decode_varint(data.data() + _pos, data.size() - _pos, _size);
+    if (0 == _prefix || _size > data.size() - _pos - _prefix) return false;
+    records.emplace_back(_pos + _prefix, std::size_t(_size));
+    _pos += _prefix + std::size_t(_size);
+  }
+  return true;
+}
+
+/**
+ * \brief options of one run, parsed from the command line or from a --client request
+ */
+struct run_options
+{
+  bool               from_file  = true;
+  bool               force      = false;
+  bool               stats      = false;
+  std::string        trace;
+  std::string        diff;
+  int                depth      = 2;
+  int                max_depth  = 0;
+  unsigned long long budget     = 0;
+  int                check_fields = 0;
+  int                text_percent = 0;
+  int                scalars    = 0; // min values of binary fields printed as packed scalar arrays, 0 off
+  bool               scalars_fixed = false; // scalars also takes fixed32 and fixed64 runs
+  out_style          style      = human;
+  in_format          in         = in_binary;
+  bool               lines      = false;
+  std::string        grep;
+  bool               grep_print = false;
+  std::string        select;
+  std::string        save_tree;
+  std::string        cache_dir;
+  std::string        serve;
+  std::string        client;
+  int                threads    = 0;
+  std::string        file;
+  std::string        error; // invalid option found by parse_options, reported by check_options
+};
+
+/**
+ * \brief ids of a path joined by dots
+ */
+std::vector<int> select_path(const std::string& path)
+{
+  std::vector<int> _ids;
+  for (std::size_t i = 0; i < path.size();)
+  {
+    auto _dot = path.find('.', i);
+    if (std::string::npos == _dot) _dot = path.size();
+    _ids.push_back(std::atoi(path.substr(i, _dot - i).c_str()));
+    i = _dot + 1;
+  }
+  return _ids;
+}
+
+/**
+ * \brief sub field at a path of ids joined by dots, a repeated field on the way is entered at its first item
+ * \return nullptr if not found
+ */
+const proto::message* select_field(const proto::message& msg, const std::string& path)
+{
+  auto _node = &msg;
+  for (auto _id : select_path(path))
+  {
+    if (proto::type_repeat == _node->type_ && !_node->childs_.empty()) _node = &_node->childs_.front();
+
+    const proto::message* _child = nullptr;
+    for (const auto& f : _node->childs_)
+    {
+      if (_id == f.id_)
+      {
+        _child = &f;
+        break;
+      }
+    }
+    if (nullptr == _child) return nullptr;
+    _node = _child;
+  }
+  return _node;
+}
+
+/**
+ * \brief field of a saved tree at a path, as select_field()
+ * \return empty handle if not found
+ */
+proto::image_field select_field(const proto::image_field& root, const std::string& path)
+{
+  auto _node = root;
+  for (auto _id : select_path(path))
+  {
+    if (proto::type_repeat == _node.type() && _node.first_child()) _node = _node.first_child();
+
+    _node = _node.id(_id);
+    if (!_node) break;
+  }
+  return _node;
+}
+
+/**
+ * \brief heuristic taking binary fields for packed repeated scalars, as --scalars says
+ */
+proto::packed_scalar_options scalar_options(const run_options& opt)
+{
+  proto::packed_scalar_options _scalars;
+  _scalars.min_values = std::size_t(opt.scalars);
+  _scalars.fixed      = opt.scalars_fixed;
+  return _scalars;
+}
+
+void print_field(std::ostream& out, const proto::message& msg, const run_options& opt)
+{
+  auto  _options = scalar_options(opt);
+  auto* _scalars = opt.scalars > 0 ? &_options : nullptr;
+
+  // large trees are printed in pieces on a pool, the output is the same
+  const auto _parallel_bytes = 8 * proto::PRINT_PIECE_BYTES;
+  if (1 != opt.threads && proto::detail::print_cost(msg, _parallel_bytes) >= _parallel_bytes)
+  {
+    proto::thread_pool _pool(opt.threads > 1 ? std::size_t(opt.threads - 1) : proto::thread_pool::default_threads());
+    if (_pool.size() > 0)
+    {
+      auto _write = [&](const char* data, std::size_t size) { out.write(data, std::streamsize(size)); };
+      switch (opt.style)
+      {
+      case cpp: proto::to_cpp_code_parallel(_write, msg, _pool); break;
+      default: proto::to_string_parallel(_write, msg, _pool, 2, 0, -1, 2, true, _scalars); break;
+      }
+      return;
+    }
+  }
+
+  switch (opt.style)
+  {
+  case cpp: out << proto::to_cpp_code(msg); break;
+  default: out << proto::to_string(msg, 2, 0, -1, 2, true, _scalars); break;
+  }
+}
+
+/**
+ * \brief print msg, or the field selected by --select
+ */
+void print_message(std::ostream& out, const proto::message& msg, const run_options& opt)
+{
+  auto _msg = opt.select.empty() ? &msg : select_field(msg, opt.select);
+  if (nullptr == _msg)
+  {
+    out << "// select: " << opt.select << " not found\n";
+    return;
+  }
+  print_field(out, *_msg, opt);
+}
+
+/**
+ * \brief print a saved tree, or the field selected by --select, other fields are not read
+ */
+void print_message(std::ostream& out, const proto::image_view& view, const run_options& opt)
+{
+  auto _field = opt.select.empty() ? view.root() : select_field(view.root(), opt.select);
+  if (!_field)
+  {
+    out << "// select: " << opt.select << " not found\n";
+    return;
+  }
+  print_field(out, view.to_message(_field), opt);
+}
+
+void print_help(std::ostream& out)
+{
+	out <<
+				"protobuf decode\n"
+				"protoc [option] <file|stdin>\n"
+				"-h, --help    show this help\n"
+				"-v, --version show version\n"
+				"-d, --depth   set decode depth\n"
+				"-f, --force   force output until error\n"
+				"-s, --style   set output style(human, cpp)\n"
+				"--decode_raw  use stdin input\n"
+				"--in <format> input format, binary(default), hex or base64, whitespace ignored\n"
+				"              hex-lines, base64-lines decode each line as one message, not with --diff\n"
+				"              tree reads a tree saved by --save-tree, not with --diff or --grep\n"
+				"--max-depth <n> limit nesting of groups and packed fields\n"
+				"--budget <bytes> stop decoding after scanning bytes, speculative decodes included\n"
+				"--check-fields <n> scan the first n fields of a binary field before trying it as a message\n"
+				"--text-percent <n> keep binary fields with n percent printable bytes or more as strings\n"
+				"--scalars <n> print binary fields taken for n or more packed varints as arrays, 0 off(default)\n"
+				"--scalars-fixed also take fixed32 and fixed64 runs with --scalars, hashes and other bytes may pass\n"
+				"--stats       print decode statistics\n"
+				"--select <path> print only the field at a path of ids joined by dots\n"
+				"--save-tree <file> save the decoded tree, read back with --in tree without decoding\n"
+				"--cache-dir <dir> save decoded trees in dir by input hash and options, reuse them on later runs\n"
+				"--grep <expr> print records where a field path matches, \"3.1 == 12345\", \"4 contains \\\"text\\\"\"\n"
+				"              records are length delimited messages, or lines with --in *-lines\n"
+				"              exit 1 if none matches\n"
+				"--grep-print  print matching records decoded\n"
+				"--diff <file> compare file with the input by field path, exit 1 if they differ\n"
+				"              lines are + added, - removed, ~ changed, paths are ids joined by dots\n"
+				"--trace <file> write chrome trace json (PROTO_ENABLE_TRACE build)\n"
+				"--serve <socket> decode requests of --client on a unix socket until killed\n"
+				"--threads <n> worker threads of --serve, or threads printing a large tree (default hardware threads)\n"
+				"--client <socket> run through a --serve process, other options as for a local run\n\n";
+}
+
+/**
+ * \brief parse options, args exclude the program name
+ * \return false if the run is done, help or version printed
+ */
+bool parse_options(const std::vector<std::string>& args, run_options& opt, std::ostream& out)
+{
+  for (std::size_t i = 0; i < args.size(); ++i)
+  {
+    const auto& arg  = args[i];
+    auto        next = [&]() { return (i + 1 < args.size()) ? args[++i] : std::string(); };
+
+    if ("-h" == arg || "--help" == arg)
+    {
+      print_help(out);
+      return false;
+    }
+    if ("-v" == arg || "--version" == arg)
+    {
+      out << "libprotoc 9.9.9 diy version" << std::endl;
+      return false;
+    }
+    else if ("-d" == arg || "-depth" == arg)
+    {
+      opt.depth = std::atoi(next().c_str());
+    }
+    else if ("-f" == arg || "-force" == arg)
+    {
+      opt.force = true;
+    }
+    else if ("-s" == arg || "-style" == arg)
+    {
+      auto style = next();
+      if ("cpp" == style || "1" == style)
+        opt.style = cpp;
+      else
+        opt.style = human;
+    }
+    else if ("--decode_raw" == arg)
+    {
+      opt.from_file = false;
+    }
+    else if ("--in" == arg)
+    {
+      auto format = next();
+      opt.lines   = format.size() > 6 && 0 == format.compare(format.size() - 6, 6, "-lines");
+      if (opt.lines) format.resize(format.size() - 6);
+      if ("hex" == format)
+        opt.in = in_hex;
+      else if ("base64" == format)
+        opt.in = in_base64;
+      else if ("tree" == format && !opt.lines)
+        opt.in = in_tree;
+      else if ("binary" == format && !opt.lines)
+        opt.in = in_binary;
+      else
+        opt.error = "unknown input format: " + args[i];
+    }
+    else if ("--max-depth" == arg)
+    {
+      opt.max_depth = std::atoi(next().c_str());
+    }
+    else if ("--budget" == arg)
+    {
+      opt.budget = std::strtoull(next().c_str(), nullptr, 10);
+    }
+    else if ("--check-fields" == arg)
+    {
+      opt.check_fields = std::atoi(next().c_str());
+    }
+    else if ("--text-percent" == arg)
+    {
+      opt.text_percent = std::atoi(next().c_str());
+    }
+    else if ("--scalars" == arg)
+    {
+      opt.scalars = std::atoi(next().c_str());
+    }
+    else if ("--scalars-fixed" == arg)
+    {
+      opt.scalars_fixed = true;
+    }
+    else if ("--stats" == arg)
+    {
+      opt.stats = true;
+    }
+    else if ("--select" == arg)
+    {
+      opt.select = next();
+    }
+    else if ("--save-tree" == arg)
+    {
+      opt.save_tree = next();
+    }
+    else if ("--cache-dir" == arg)
+    {
+      opt.cache_dir = next();
+    }
+    else if ("--trace" == arg)
+    {
+      opt.trace = next();
+    }
+    else if ("--grep" == arg)
+    {
+      opt.grep = next();
+    }
+    else if ("--grep-print" == arg)
+    {
+      opt.grep_print = true;
+    }
+    else if ("--diff" == arg)
+    {
+      opt.diff = next();
+    }
+    else if ("--serve" == arg)
+    {
+      opt.serve = next();
+    }
+    else if ("--threads" == arg)
+    {
+      opt.threads = std::atoi(next().c_str());
+    }
+    else if ("--client" == arg)
+    {
+      opt.client = next();
+    }
+    else
+    {
+      opt.file = arg;
+    }
+  }
+  return true;
+}
+
+/**
+ * \brief print the error of options that can not run together or did not parse
+ * \return false if the run must not start
+ */
+bool check_options(const run_options& opt, std::ostream& err)
+{
+  if (!opt.error.empty())
+  {
+    err << opt.error << std::endl;
+    return false;
+  }
+  if (opt.lines && !opt.diff.empty())
+  {
+    err << "--diff compares two single messages, not available with --in *-lines" << std::endl;
+    return false;
+  }
+  if (in_tree == opt.in && (!opt.diff.empty() || !opt.grep.empty()))
+  {
+    err << "--diff and --grep read protobuf input, not available with --in tree" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * \brief read only contents of a file, mapped where the platform allows
+ */
+class mapped_file
+{
+public:
+  mapped_file() = default;
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  ~mapped_file()
+  {
+#if !defined(_WIN32)
+    if (map_) ::munmap(map_, size_);
+#endif
+  }
+
+  bool open(const std::string& path)
+  {
+#if !defined(_WIN32)
+    auto _fd = ::open(path.c_str(), O_RDONLY);
+    if (_fd < 0) return false;
+
+    struct stat _stat;
+    auto _ok = 0 == ::fstat(_fd, &_stat) && _stat.st_size > 0;
+    if (_ok)
+    {
+      size_ = std::size_t(_stat.st_size);
+      map_  = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, _fd, 0);
+      if (MAP_FAILED == map_) map_ = nullptr;
+      _ok = nullptr != map_;
+    }
+    ::close(_fd);
+    return _ok;
+#else
+    std::ifstream _file(path, std::ios::binary | std::ios::in);
+    return _file.is_open() && read_from_file(_file, buffer_);
+#endif
+  }
+
+  const char* data() const { return map_ ? static_cast<const char*>(map_) : buffer_.data(); }
+  std::size_t size() const { return map_ ? size_ : buffer_.size(); }
+
+private:
+  void*       map_  = nullptr;
+  std::size_t size_ = 0;
+  std::string buffer_; // file contents where mapping is not available
+};
+
+/**
+ * \brief hash of the input and the options changing the decoded tree
+ */
+std::uint64_t tree_cache_key(const std::string& input, const run_options& opt)
+{
+  auto _key = proto::detail::hash_bytes(input.data(), input.size());
+  _key      = proto::detail::hash_mix(_key, std::uint64_t(std::int64_t(opt.depth)));
+  _key      = proto::detail::hash_mix(_key, std::uint64_t(std::int64_t(opt.max_depth)));
+  _key      = proto::detail::hash_mix(_key, std::uint64_t(std::int64_t(opt.check_fields)));
+  _key      = proto::detail::hash_mix(_key, std::uint64_t(std::int64_t(opt.text_percent)));
+  _key      = proto::detail::hash_mix(_key, std::uint64_t(std::int64_t(opt.scalars)));
+  _key      = proto::detail::hash_mix(_key, std::uint64_t(opt.scalars_fixed));
+  return proto::detail::hash_mix(_key, opt.budget);
+}
+
+std::string tree_cache_path(const std::string& dir, std::uint64_t key)
+{
+  std::string _name(16, '0');
+  for (auto i = 0; i < 16; ++i)
+  {
+    _name[15 - i] = proto::byte_to_hex((key >> (4 * i)) & 0xf);
+  }
+  return dir + "/" + _name + ".tree";
+}
+
+/**
+ * \brief write a tree image, through a temporary file so readers never see a partial one
+ */
+bool save_tree(const std::string& path, const std::string& image)
+{
+  auto _temp = path + ".tmp";
+#if !defined(_WIN32)
+  _temp += std::to_string(::getpid());
+#endif
+  {
+    std::ofstream _file(_temp, std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!_file.write(image.data(), std::streamsize(image.size()))) return false;
+  }
+  if (0 == std::rename(_temp.c_str(), path.c_str())) return true;
+
+  // rename does not replace an existing file everywhere
+  std::remove(path.c_str());
+  if (0 == std::rename(_temp.c_str(), path.c_str())) return true;
+
+  std::remove(_temp.c_str());
+  return false;
+}
+
+/**
+ * \brief decode data as opt says and print to out
+ * \return exit code
+ */
+int run(const run_options& opt, std::string&& data, bool success, std::ostream& out, std::ostream& err)
+{
+  proto::decode_stats   stats;
+  proto::decode_errors  error = proto::decode_ok;
+  proto::decode_options options;
+  options.dec_pack_depth = opt.depth;
+  options.max_depth      = opt.max_depth;
+  options.work_budget    = opt.budget;
+  options.check_fields   = opt.check_fields;
+  options.text_percent   = opt.text_percent;
+  options.error          = &error;
+  // payloads printed as scalar arrays are not decoded into trees first
+  auto scalars = scalar_options(opt);
+  if (opt.scalars > 0) options.scalars = &scalars;
+  if (opt.stats) options.stats = &stats;
+  // printing needs only the sub fields of packed fields, tree images keep their bytes
+  options.packed_copies = !opt.save_tree.empty() || !opt.cache_dir.empty();
+
+  // records of a stream share paths, attempts that keep failing on a path are left out
+  proto::decode_hints hints;
+  if (opt.lines || !opt.grep.empty()) options.hints = &hints;
+
+  // hex and base64 are decoded in place, records are the messages of line input
+  std::vector<std::size_t> records;
+  success = success && text_to_binary(data, opt.in, opt.lines ? &records : nullptr, err);
+
+  // decoded fields share the buffer, no copy of the input
+  auto input = std::make_shared<const std::string>(std::move(data));
+
+  proto::message msg;
+  std::size_t    differences = 0;
+  std::size_t    matches     = 0;
+  if (!opt.grep.empty())
+  {
+    grep_expr expr;
+    if (!expr.parse(opt.grep))
+    {
+      err << "invalid --grep expression: " << opt.grep << std::endl;
+      return -1;
+    }
+
+    // records are lines of text input, or length delimited messages of binary input
+    std::vector<std::pair<std::size_t, std::size_t>> spans;
+    for (std::size_t i = 0; i + 1 < records.size(); ++i)
+    {
+      spans.emplace_back(records[i], records[i + 1] - records[i]);
+    }
+    success = success && (opt.lines || split_delimited(*input, spans));
+
+    std::size_t skipped = 0;
+    for (std::size_t i = 0; success && i < spans.size(); ++i)
+    {
+      auto record = input->data() + spans[i].first;
+      if (!expr.prefilter(record, spans[i].second))
+      {
+        ++skipped;
+        continue;
+      }
+      if (!expr.match(reinterpret_cast<const unsigned char*>(record), spans[i].second)) continue;
+
+      ++matches;
+      out << "// record " << i << " at offset " << spans[i].first << ", size " << spans[i].second << '\n';
+      if (!opt.grep_print) continue;
+
+      std::size_t length = spans[i].second;
+      if (msg.deserialize_into_reuse(input, spans[i].first, &length, options) || opt.force)
+        print_message(out, msg, opt);
+    }
+
+    if (opt.stats)
+    {
+      out << "// grep records: " << spans.size() << ", skipped by prefilter: " << skipped
+          << ", matches: " << matches << '\n';
+    }
+  }
+  else if (opt.lines)
+  {
+    // one message per line, decoded into one reused message
+    std::size_t failed = 0;
+    for (std::size_t i = 0; success && i + 1 < records.size(); ++i)
+    {
+      std::size_t length         = records[i + 1] - records[i];
+      bool        record_success = msg.deserialize_into_reuse(input, records[i], &length, options);
+      out << "// record " << i << (record_success ? "" : ", decode fail") << '\n';
+      if (record_success || opt.force) print_message(out, msg, opt);
+      if (!record_success) ++failed;
+    }
+    success = success && 0 == failed;
+  }
+  else if (!opt.diff.empty())
+  {
+    // the input is compared against the --diff file
+    std::string    base_data;
+    proto::message base;
+    std::ifstream  basefile(opt.diff, std::ios::binary | std::ios::in);
+    success = success && msg.deserialize(input, options) && basefile.is_open() &&
+              read_from_file(basefile, base_data) && text_to_binary(base_data, opt.in, nullptr, err) &&
+              base.deserialize(std::move(base_data), options);
+    if (success)
+    {
+      differences = tree_diff(base, msg).print(out);
+    }
+  }
+  else if (in_tree == opt.in)
+  {
+    proto::image_view view;
+    success = success && view.open(input->data(), input->size());
+    if (success) print_message(out, view, opt);
+  }
+  else
+  {
+    // a tree cached by an earlier run with the same input and options is used without decoding
+    std::string       cache_path;
+    std::uint64_t     cache_key = 0;
+    mapped_file       cache_file;
+    proto::image_view view;
+    bool              cached = false;
+    if (success && !opt.cache_dir.empty())
+    {
+      cache_key  = tree_cache_key(*input, opt);
+      cache_path = tree_cache_path(opt.cache_dir, cache_key);
+      cached     = cache_file.open(cache_path) && view.open(cache_file.data(), cache_file.size()) &&
+               cache_key == view.key();
+      if (opt.stats) out << "// tree cache " << (cached ? "hit: " : "miss: ") << cache_path << '\n';
+    }
+
+    if (cached)
+    {
+      print_message(out, view, opt);
+      if (!opt.save_tree.empty()) msg = view.to_message();
+    }
+    else
+    {
+      success = success && msg.deserialize(input, options);
+      if (success || opt.force) print_message(out, msg, opt);
+      if (success && !cache_path.empty() && !save_tree(cache_path, proto::write_image(msg, cache_key)))
+        err << "can not write tree cache: " << cache_path << std::endl;
+    }
+    if (success && !opt.save_tree.empty() && !save_tree(opt.save_tree, proto::write_image(msg)))
+      err << "can not write tree: " << opt.save_tree << std::endl;
+  }
+
+  if (opt.stats && (opt.grep.empty() || opt.grep_print)) print_stats(out, stats);
+
+  if (!success)
+  {
+    static const char* _error_desc[] = {"", "", ": max depth exceeded", ": work budget exceeded"};
+    out << "// decode fail" << _error_desc[error] << std::endl;
+    return -1;
+  }
+  return (differences || (!opt.grep.empty() && 0 == matches)) ? 1 : 0;
+}
+
+#if !defined(_WIN32)
+
+namespace {
+const std::uint64_t MAX_REQUEST_ARGS  = 1024;
+const std::uint64_t MAX_REQUEST_BYTES = std::uint64_t(1) << 32; // one argument or payload
+const std::size_t   READ_CHUNK        = 1 << 16; // memory of a request grows only with the bytes received
+
+#if defined(MSG_NOSIGNAL)
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+} // namespace
+
+/**
+ * \brief a peer closing its end fails the write instead of raising SIGPIPE
+ *   macOS has no MSG_NOSIGNAL but the SO_NOSIGPIPE socket option, elsewhere SIGPIPE is ignored
+ */
+void no_sigpipe(int fd)
+{
+#if defined(SO_NOSIGPIPE)
+  int _on = 1;
+  ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &_on, sizeof(_on));
+#elif !defined(MSG_NOSIGNAL)
+  (void)fd;
+  std::signal(SIGPIPE, SIG_IGN);
+#else
+  (void)fd;
+#endif
+}
+
+bool read_exact(int fd, void* data, std::size_t size)
+{
+  auto _data = static_cast<char*>(data);
+  while (size > 0)
+  {
+    auto r = ::read(fd, _data, size);
+    if (r < 0 && EINTR == errno) continue;
+    if (r <= 0) return false;
+    _data += r;
+    size -= std::size_t(r);
+  }
+  return true;
+}
+
+bool write_exact(int fd, const void* data, std::size_t size)
+{
+  auto _data = static_cast<const char*>(data);
+  while (size > 0)
+  {
+    auto r = ::send(fd, _data, size, SEND_FLAGS);
+    if (r < 0 && EINTR == errno) continue;
+    if (r <= 0) return false;
+    _data += r;
+    size -= std::size_t(r);
+  }
+  return true;
+}
+
+/**
+ * \brief frames are little endian 64 bit sizes followed by bytes
+ *   request: argument count, each argument, payload
+ *   response: exit code, output, error output
+ */
+void put_u64(std::string& frame, std::uint64_t value)
+{
+  for (auto i = 0; i < 8; ++i)
+  {
+    frame += char((value >> (8 * i)) & 0xff);
+  }
+}
+
+void put_bytes(std::string& frame, const std::string& bytes)
+{
+  put_u64(frame, bytes.size());
+  frame += bytes;
+}
+
+bool read_u64(int fd, std::uint64_t& value)
+{
+  unsigned char _bytes[8];
+  if (!read_exact(fd, _bytes, 8)) return false;
+
+  value = 0;
+  for (auto i = 0; i < 8; ++i)
+  {
+    value |= std::uint64_t(_bytes[i]) << (8 * i);
+  }
+  return true;
+}
+
+bool read_bytes(int fd, std::string& bytes)
+{
+  std::uint64_t _size;
+  if (!read_u64(fd, _size) || _size > MAX_REQUEST_BYTES) return false;
+
+  // the size comes from the peer, the buffer grows as its bytes arrive
+  bytes.clear();
+  while (bytes.size() < _size)
+  {
+    auto _offset = bytes.size();
+    auto _chunk  = std::size_t(std::min<std::uint64_t>(_size - _offset, READ_CHUNK));
+    bytes.resize(_offset + _chunk);
+    if (!read_exact(fd, &bytes[_offset], _chunk)) return false;
+  }
+  return true;
+}
+
+/**
+ * \brief answer requests of one client until it closes the connection
+ */
+void serve_connection(int fd)
+{
+  while (true)
+  {
+    std::uint64_t _count;
+    if (!read_u64(fd, _count) || _count > MAX_REQUEST_ARGS) return;
+
+    std::vector<std::string> _args(static_cast<std::size_t>(_count));
+    for (auto& arg : _args)
+    {
+      if (!read_bytes(fd, arg)) return;
+    }
+
+    std::string _data;
+    if (!read_bytes(fd, _data)) return;
+
+    std::ostringstream _out;
+    std::ostringstream _err;
+    run_options        _opt;
+    int                _code = 0;
+    if (parse_options(_args, _opt, _out))
+    {
+      if (!check_options(_opt, _err))
+      {
+        _code = -1;
+      }
+      else if (!_opt.diff.empty() || !_opt.trace.empty() || !_opt.serve.empty() || !_opt.save_tree.empty() ||
+          !_opt.cache_dir.empty())
+      {
+        _err << "--diff, --trace, --save-tree, --cache-dir and --serve are not available through --client"
+             << std::endl;
+        _code = -1;
+      }
+      else
+      {
+        // the pool of --serve already runs a request per thread, trees are printed serially
+        _opt.threads = 1;
+        _code        = run(_opt, std::move(_data), true, _out, _err);
+      }
+    }
+
+    std::string _frame;
+    put_u64(_frame, std::uint64_t(std::int64_t(_code)));
+    put_bytes(_frame, _out.str());
+    put_bytes(_frame, _err.str());
+    if (!write_exact(fd, _frame.data(), _frame.size())) return;
+  }
+}
+
+/**
+ * \brief accept clients on a unix socket, each connection is served by one thread of the pool
+ *   decode scratch buffers and allocator caches stay warm in the workers between requests
+ * \return exit code, only on a socket error
+ */
+int serve(const std::string& path, int threads)
+{
+  sockaddr_un _addr{};
+  _addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(_addr.sun_path))
+  {
+    std::cerr << "socket path too long: " << path << std::endl;
+    return -1;
+  }
+  std::memcpy(_addr.sun_path, path.c_str(), path.size() + 1);
+
+  auto _listen = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  ::unlink(path.c_str());
+  if (_listen < 0 || 0 != ::bind(_listen, reinterpret_cast<const sockaddr*>(&_addr), sizeof(_addr)) ||
+      0 != ::listen(_listen, SOMAXCONN))
+  {
+    std::cerr << "can not listen on " << path << ": " << std::strerror(errno) << std::endl;
+    return -1;
+  }
+
+  std::mutex              _mutex;
+  std::condition_variable _ready;
+  std::deque<int>         _pending; // accepted connections
+
+  if (threads <= 0) threads = int(std::thread::hardware_concurrency());
+  if (threads <= 0) threads = 1;
+
+  std::vector<std::thread> _workers;
+  for (auto i = 0; i < threads; ++i)
+  {
+    _workers.emplace_back([&] {
+      while (true)
+      {
+        int _fd;
+        {
+          std::unique_lock<std::mutex> _lock(_mutex);
+          _ready.wait(_lock, [&] { return !_pending.empty(); });
+          _fd = _pending.front();
+          _pending.pop_front();
+        }
+        serve_connection(_fd);
+        ::close(_fd);
+      }
+    });
+  }
+
+  while (true)
+  {
+    auto _fd = ::accept(_listen, nullptr, nullptr);
+    if (_fd < 0)
+    {
+      if (EINTR == errno || ECONNABORTED == errno) continue;
+      std::cerr << "accept failed: " << std::strerror(errno) << std::endl;
+      ::_exit(-1);
+    }
+
+    no_sigpipe(_fd);
+    std::lock_guard<std::mutex> _lock(_mutex);
+    _pending.push_back(_fd);
+    _ready.notify_one();
+  }
+}
+
+/**
+ * \brief send args and data to a --serve process, print its output
+ * \return exit code of the remote run
+ */
+int client(const std::string& path, const std::vector<std::string>& args, const std::string& data)
+{
+  sockaddr_un _addr{};
+  _addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(_addr.sun_path))
+  {
+    std::cerr << "socket path too long: " << path << std::endl;
+    return -1;
+  }
+  std::memcpy(_addr.sun_path, path.c_str(), path.size() + 1);
+
+  auto _fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (_fd < 0 || 0 != ::connect(_fd, reinterpret_cast<const sockaddr*>(&_addr), sizeof(_addr)))
+  {
+    std::cerr << "can not connect to " << path << ": " << std::strerror(errno) << std::endl;
+    if (_fd >= 0) ::close(_fd);
+    return -1;
+  }
+  no_sigpipe(_fd);
+
+  std::string _frame;
+  put_u64(_frame, args.size());
+  for (const auto& arg : args)
+  {
+    put_bytes(_frame, arg);
+  }
+  put_u64(_frame, data.size()); // the payload follows the frame without a copy
+
+  std::uint64_t _code = std::uint64_t(-1);
+  std::string   _out;
+  std::string   _err;
+  bool          _ok = write_exact(_fd, _frame.data(), _frame.size()) && write_exact(_fd, data.data(), data.size()) &&
+                      read_u64(_fd, _code) && read_bytes(_fd, _out) && read_bytes(_fd, _err);
+  ::close(_fd);
+  if (!_ok)
+  {
+    std::cerr << "no answer from " << path << std::endl;
+    return -1;
+  }
+
+  std::cout.write(_out.data(), std::streamsize(_out.size()));
+  std::cerr.write(_err.data(), std::streamsize(_err.size()));
+  return int(std::int64_t(_code));
+}
+
+#endif // !defined(_WIN32)
+
+int main(int argc, char *argv[])
+{
+	if (argc == 1)
+	{
+		print_help(std::cout);
+		return 0;
+	}
+
+	std::vector<std::string> args(argv + 1, argv + argc);
+	run_options opt;
+	if (!parse_options(args, opt, std::cout)) return 0;
+	if (!check_options(opt, std::cerr)) return -1;
+
+	if (!opt.serve.empty())
+	{
+#if !defined(_WIN32)
+		return serve(opt.serve, opt.threads);
+#else
+		std::cerr << "--serve needs unix sockets" << std::endl;
+		return -1;
+#endif
+	}
+
+	if (!opt.trace.empty())
+	{
+#if defined(PROTO_ENABLE_TRACE)
+		proto::trace::enable();
+#else
+		std::cerr << "protoc built without PROTO_ENABLE_TRACE, --trace ignored" << std::endl;
+#endif
+	}
+
+	std::string data;
+	bool success = true;
+	if (opt.from_file && !opt.file.empty())
+	{
+		std::ifstream infile(opt.file, std::ios::binary | std::ios::in);
+		success = infile.is_open() && read_from_file(infile, data);
+	}
+	else
+	{
+		read_from_stdin(data);
+	}
+
+	if (!opt.client.empty())
+	{
+#if !defined(_WIN32)
+		if (!success)
+		{
+			std::cerr << "can not read " << opt.file << std::endl;
+			return -1;
+		}
+
+		// the server takes the input from the request, the file argument is not read there
+		std::vector<std::string> remote;
+		for (std::size_t i = 0; i < args.size(); ++i)
+		{
+			if ("--client" == args[i])
+				++i;
+			else
+				remote.push_back(args[i]);
+		}
+		return client(opt.client, remote, data);
+#else
+		std::cerr << "--client needs unix sockets" << std::endl;
+		return -1;
+#endif
+	}
+
+	auto code = run(opt, std::move(data), success, std::cout, std::cerr);
+
+#if defined(PROTO_ENABLE_TRACE)
+	if (!opt.trace.empty() && !proto::trace::dump_chrome_json(opt.trace))
+	{
+		std::cerr << "can not write trace file: " << opt.trace << std::endl;
+	}
+#endif
+
+	return code;
+}